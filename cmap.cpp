@@ -0,0 +1,117 @@
+/* -------------------------------------------------------------------------- *
+ *                                  CMap                                      *
+ * -------------------------------------------------------------------------- *
+ * Implements the C interface declared in cmap.h on top of HashMap. Each      *
+ * function is a thin forwarding call; see cmap.h for the documentation of   *
+ * the individual functions.                                                  *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "hashmap.h"
+#include "cmap.h"
+
+//CMapCursor is handed to HashMap as a HashMapCursor
+static_assert(sizeof(CMapCursor) == sizeof(HashMapCursor), "CMapCursor must match HashMapCursor");
+static_assert(offsetof(CMapCursor, key) == offsetof(HashMapCursor, key), "CMapCursor::key must match HashMapCursor");
+static_assert(offsetof(CMapCursor, value) == offsetof(HashMapCursor, value), "CMapCursor::value must match HashMapCursor");
+static_assert(offsetof(CMapCursor, keylen) == offsetof(HashMapCursor, keyLength), "CMapCursor::keylen must match HashMapCursor");
+static_assert(offsetof(CMapCursor, node) == offsetof(HashMapCursor, node), "CMapCursor::node must match HashMapCursor");
+static_assert(offsetof(CMapCursor, bucket) == offsetof(HashMapCursor, bucket), "CMapCursor::bucket must match HashMapCursor");
+
+struct CMapImplementation{
+    HashMap map;
+
+    CMapImplementation(int capacity, int valuesz, CleanupValueFn fn)
+        : map(capacity, valuesz, fn) {}
+};
+
+// the CMap interface passes const CMap* to lookups, but HashMap lookups may
+// advance an incremental rehash
+static HashMap* getMap(const CMap *cm)
+{
+    return &const_cast<CMap*>(cm)->map;
+}
+
+CMap *cmap_create(int valuesz, int capacity_hint, CleanupValueFn fn)
+{
+    assert(valuesz > 0);
+    assert(capacity_hint >= 0);
+    CMap *cm = new CMap(capacity_hint, valuesz, fn);
+    assert(cm != NULL);
+    return cm;
+}
+
+void cmap_dispose(CMap *cm)
+{
+    delete cm;
+}
+
+int cmap_count(const CMap *cm)
+{
+    return getMap(cm)->getSize();
+}
+
+void cmap_put(CMap *cm, const char *key, const void *addr)
+{
+    bool stored = cm->map.set((char*)key, (void*)addr);
+    assert(stored);
+    (void)stored; //only checked by the assert
+}
+
+void *cmap_get(const CMap *cm, const char *key)
+{
+    return getMap(cm)->get((char*)key);
+}
+
+void cmap_remove(CMap *cm, const char *key)
+{
+    cm->map.remove((char*)key);
+}
+
+void cmap_put_bytes(CMap *cm, const void *key, size_t keylen, const void *addr)
+{
+    bool stored = cm->map.set(key, keylen, (void*)addr);
+    assert(stored);
+    (void)stored; //only checked by the assert
+}
+
+void *cmap_get_bytes(const CMap *cm, const void *key, size_t keylen)
+{
+    return getMap(cm)->get(key, keylen);
+}
+
+void cmap_remove_bytes(CMap *cm, const void *key, size_t keylen)
+{
+    cm->map.remove(key, keylen);
+}
+
+const char *cmap_first(const CMap *cm)
+{
+    return getMap(cm)->firstNode();
+}
+
+const char *cmap_next(const CMap *cm, const char *prevkey)
+{
+    return getMap(cm)->nextNode((char*)prevkey);
+}
+
+int cmap_cursor_first(const CMap *cm, CMapCursor *cursor)
+{
+    return getMap(cm)->firstEntry((HashMapCursor*)cursor);
+}
+
+int cmap_cursor_next(const CMap *cm, CMapCursor *cursor)
+{
+    return getMap(cm)->nextEntry((HashMapCursor*)cursor);
+}
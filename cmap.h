@@ -15,6 +15,11 @@
 #ifndef _cmap_h
 #define _cmap_h
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
  /**
   * Type: CleanupValueFn
@@ -152,6 +157,23 @@ void *cmap_get(const CMap *cm, const char *key);
 void cmap_remove(CMap *cm, const char *key);
 
 
+/**
+ * Functions: cmap_put_bytes, cmap_get_bytes, cmap_remove_bytes
+ * Usage: cmap_put_bytes(m, &id, sizeof(id), &val)
+ * -----------------------------------------------
+ * These functions behave like cmap_put/cmap_get/cmap_remove, except that the
+ * key is given as keylen bytes starting at key rather than as a C string.
+ * The key bytes may contain zeros, so binary keys such as packed ids or UUIDs
+ * can be stored as they are, and the key doesn't have to be scanned for its
+ * length. A string key and the bytes of that string without the terminating
+ * '\0' are the same key, e.g. cmap_get(m, "CS107") and
+ * cmap_get_bytes(m, "CS107", 5) find the same entry.
+ */
+void cmap_put_bytes(CMap *cm, const void *key, size_t keylen, const void *addr);
+void *cmap_get_bytes(const CMap *cm, const void *key, size_t keylen);
+void cmap_remove_bytes(CMap *cm, const void *key, size_t keylen);
+
+
 /**
  * Functions: cmap_first, cmap_next
  * Usage: for (const char *key = cmap_first(m); key != NULL; key = cmap_next(m, key))
@@ -169,4 +191,43 @@ void cmap_remove(CMap *cm, const char *key);
 const char *cmap_first(const CMap *cm);
 const char *cmap_next(const CMap *cm, const char *prevkey);
 
+
+/**
+ * Type: CMapCursor
+ * ----------------
+ * Holds the position of a cursor iteration over a CMap. After a successful
+ * call to cmap_cursor_first/cmap_cursor_next, key and value point to the
+ * current entry and keylen holds the number of bytes in the key (which is
+ * also '\0' terminated); key and value are NULL once the iteration is done.
+ * The remaining fields are private to the CMap and must not be modified by
+ * the client.
+ */
+typedef struct CMapCursor {
+    const char *key;
+    void *value;
+    size_t keylen;
+    void *node;
+    int bucket;
+} CMapCursor;
+
+
+/**
+ * Functions: cmap_cursor_first, cmap_cursor_next
+ * Usage: for (CMapCursor c; cmap_cursor_first(m, &c) ...; cmap_cursor_next(m, &c))
+ * ---------------------------------------------------------------------------------
+ * These functions provide iteration over the CMap entries through a cursor
+ * owned by the client. cmap_cursor_first positions the cursor at the first
+ * entry and cmap_cursor_next advances it; both return nonzero if the cursor
+ * points at an entry and zero once there are no more. Unlike cmap_next, the
+ * cursor remembers where it is, so no key has to be looked up again and
+ * each step takes constant time. The same restrictions as for cmap_first/
+ * cmap_next apply to modifying the CMap in the midst of iterating.
+ */
+int cmap_cursor_first(const CMap *cm, CMapCursor *cursor);
+int cmap_cursor_next(const CMap *cm, CMapCursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,144 @@
+/* -------------------------------------------------------------------------- *
+ *                                CMapTest                                    *
+ * -------------------------------------------------------------------------- *
+ * This program tests the C interface of cmap.h from C, linked against the   *
+ * cmap library built over HashMap.                                           *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "cmap.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static int numCleanupCalled = 0; //values passed to countCleanup
+
+static void countCleanup(void *addr)
+{
+    numCleanupCalled++;
+}
+/**
+ * string_key_test()
+ * ----------------------------------------------------------------------------
+ * Tests cmap_put/cmap_get/cmap_remove with string keys, replacing values and
+ * the cleanup function.
+ */
+static void string_key_test(void)
+{
+    printf("Testing String Keys...\n");
+    CMap *map = cmap_create(sizeof(int), 0, countCleanup);
+    char key[16];
+    for(int x = 0; x < 1000; x++)
+    {
+        snprintf(key, sizeof(key), "%d", x);
+        cmap_put(map, key, &x);
+    }
+    assert(cmap_count(map) == 1000);
+
+    int replacement = -1;
+    cmap_put(map, "7", &replacement);
+    assert(numCleanupCalled == 1);
+    int *value = (int *)cmap_get(map, "7");
+    assert(value != NULL && *value == -1);
+    value = (int *)cmap_get(map, "999");
+    assert(value != NULL && *value == 999);
+    assert(cmap_get(map, "1000") == NULL);
+
+    cmap_remove(map, "7");
+    cmap_remove(map, "missing");
+    assert(cmap_count(map) == 999 && cmap_get(map, "7") == NULL);
+    assert(numCleanupCalled == 2);
+
+    cmap_dispose(map);
+    assert(numCleanupCalled == 1001);
+}
+/**
+ * bytes_key_test()
+ * ----------------------------------------------------------------------------
+ * Tests binary keys containing zero bytes, and that a string key and its
+ * bytes without the '\0' are the same key.
+ */
+static void bytes_key_test(void)
+{
+    printf("Testing Byte Keys...\n");
+    CMap *map = cmap_create(sizeof(uint64_t), 16, NULL);
+    for(uint64_t id = 0; id < 500; id++)
+        cmap_put_bytes(map, &id, sizeof(id), &id);
+    assert(cmap_count(map) == 500);
+
+    uint64_t id = 256; //0x100: a zero low byte
+    uint64_t *value = (uint64_t *)cmap_get_bytes(map, &id, sizeof(id));
+    assert(value != NULL && *value == 256);
+    cmap_remove_bytes(map, &id, sizeof(id));
+    assert(cmap_get_bytes(map, &id, sizeof(id)) == NULL);
+
+    uint64_t named = 5;
+    cmap_put(map, "CS107", &named);
+    value = (uint64_t *)cmap_get_bytes(map, "CS107", 5);
+    assert(value != NULL && *value == 5);
+    cmap_dispose(map);
+}
+/**
+ * iteration_test()
+ * ----------------------------------------------------------------------------
+ * Tests that cmap_first/cmap_next and the cursor functions visit every entry
+ * once, and that a finished cursor stays finished.
+ */
+static void iteration_test(void)
+{
+    printf("Testing Iteration...\n");
+    CMap *map = cmap_create(sizeof(int), 4, NULL);
+    char key[16];
+    int sum = 0;
+    for(int x = 0; x < 300; x++)
+    {
+        snprintf(key, sizeof(key), "%d", x);
+        cmap_put(map, key, &x);
+        sum += x;
+    }
+
+    int count = 0, keySum = 0;
+    for(const char *k = cmap_first(map); k != NULL; k = cmap_next(map, k))
+    {
+        count++;
+        keySum += atoi(k);
+    }
+    assert(count == 300 && keySum == sum);
+
+    CMapCursor cursor;
+    count = 0;
+    int valueSum = 0;
+    for(int more = cmap_cursor_first(map, &cursor); more; more = cmap_cursor_next(map, &cursor))
+    {
+        assert(cursor.keylen == strlen(cursor.key));
+        assert(*(int *)cursor.value == atoi(cursor.key));
+        count++;
+        valueSum += *(int *)cursor.value;
+    }
+    assert(count == 300 && valueSum == sum && cursor.key == NULL);
+    int more = cmap_cursor_next(map, &cursor);
+    assert(!more && cursor.key == NULL);
+    cmap_dispose(map);
+}
+
+int main(int argc, char *argv[])
+{
+    string_key_test();
+    bytes_key_test();
+    iteration_test();
+    printf("All tests pass!\n");
+    return 0;
+}
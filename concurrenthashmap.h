@@ -0,0 +1,476 @@
+/* -------------------------------------------------------------------------- *
+ *                            ConcurrentHashMap                               *
+ * -------------------------------------------------------------------------- *
+ * A thread-safe hash map built from independent HashMap shards. The high     *
+ * bits of a key's hash pick its shard and every shard is guarded by its own  *
+ * reader-writer lock, so threads working on different shards never contend. *
+ * Each shard's lock and map pointer are padded out to a cache line so that   *
+ * neighbouring shards don't share one. Values are copied in and out under    *
+ * the shard's lock; pointers into a shard are never handed out, since        *
+ * another thread could remove the entry as soon as the lock is released.     *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _concurrenthashmap_h
+#define _concurrenthashmap_h
+
+#include "hashmap.h"
+#include <pthread.h>
+
+namespace{ //local namespace variables
+    const int DEFAULT_SHARD_COUNT = 64;
+}
+
+class ConcurrentHashMap{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    ConcurrentHashMap(int mapSize, int elementSize);
+    ConcurrentHashMap(int mapSize, int elementSize, CleanupValueFn fn);
+    ConcurrentHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount);
+    ConcurrentHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn);
+    ~ConcurrentHashMap();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    bool set(char *key, void *addr);
+    bool set(const void *key, size_t keyLength, void *addr);
+    bool get(char *key, void *out);
+    bool get(const void *key, size_t keyLength, void *out);
+    bool upsert(char *key, void *addr, MergeValueFn mergeFn);
+    bool remove(char *key);
+    bool remove(const void *key, size_t keyLength);
+    void clear();
+
+    ///////////////////////////////////
+    // PERSISTENCE METHODS
+    ///////////////////////////////////
+    void setLog(WriteAheadLog *log);
+
+    ///////////////////////////////////
+    // DATA STRUCTURE PROPERTIES
+    ///////////////////////////////////
+    int getSize();
+    int getElementSize();
+    float getLoadFactor();
+    int getShardCount();
+    HashMapStats stats(int sampleBuckets = STATS_SAMPLE_BUCKETS);
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation* getInstrumentation();
+#endif
+
+private:
+    //one shard per cache line
+    struct alignas(CACHE_LINE_SIZE) Shard{
+        pthread_rwlock_t lock;
+        ChainedHashMap* map;
+    };
+
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn);
+    Shard* getShardForHash(uint64_t keyHash);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    int sizeOfElements; //the size of each value element
+    int numberOfShards; //a power of two
+    int shardShift; //64 - log2(numberOfShards)
+    HashKeyFn hashFunction; //shared by every shard
+    Shard* shards;
+    WriteAheadLog* log; //also attached to every shard, or NULL
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation instrumentation; //counters and latency samples of set/get/remove
+#endif
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * ConcurrentHashMap()
+ * ----------------------------------------------------------------------------
+ * Creates a ConcurrentHashMap with shardCount shards (64 if not specified,
+ * rounded up to a power of two) that together start out with about mapSize
+ * buckets. Each shard is a HashMap with a power-of-two bucket count, so its
+ * buckets are picked by the low bits of the hash while the shard is picked
+ * by the high bits. fn and hashFn are passed on to every shard.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k + s); k = mapSize, s = number of shards
+ */
+ConcurrentHashMap::ConcurrentHashMap(int mapSize, int elementSize){
+    initialize(mapSize, elementSize, NULL, DEFAULT_SHARD_COUNT, NULL);
+}
+ConcurrentHashMap::ConcurrentHashMap(int mapSize, int elementSize, CleanupValueFn fn){
+    initialize(mapSize, elementSize, fn, DEFAULT_SHARD_COUNT, NULL);
+}
+ConcurrentHashMap::ConcurrentHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount){
+    initialize(mapSize, elementSize, fn, shardCount, NULL);
+}
+ConcurrentHashMap::ConcurrentHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn){
+    initialize(mapSize, elementSize, fn, shardCount, hashFn);
+}
+/**
+ * ~ConcurrentHashMap()
+ * ----------------------------------------------------------------------------
+ * Destroys every shard. No other thread may be using the map.
+ * ----------------------------------------------------------------------------
+ * Runtime: see ~HashMap()
+ */
+ConcurrentHashMap::~ConcurrentHashMap()
+{
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        delete shards[x].map;
+        pthread_rwlock_destroy(&shards[x].lock);
+    }
+    delete[] shards;
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * set(char* key, void* addr), set(const void* key, size_t keyLength, void* addr)
+ * ----------------------------------------------------------------------------
+ * Associates key with a copy of the value at addr, replacing (and cleaning
+ * up) any existing value. Takes the shard's lock exclusively. Returns false
+ * on allocation failure. As in HashMap, set, get and remove also take a key
+ * as keyLength raw bytes.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool ConcurrentHashMap::set(char *key, void *addr)
+{
+    return set(key, strlen(key), addr);
+}
+bool ConcurrentHashMap::set(const void *key, size_t keyLength, void *addr)
+{
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_SET);
+#endif
+    pthread_rwlock_wrlock(&shard->lock);
+#ifdef HASHMAP_INSTRUMENT
+    int size = shard->map->numberOfElements;
+    int bucketCount = shard->map->numberOfBuckets;
+#endif
+    bool stored = shard->map->setHashed((char*)key, keyLength, keyHash, addr);
+#ifdef HASHMAP_INSTRUMENT
+    if(stored)
+        operation.setEvent((shard->map->numberOfElements > size) ? INSTRUMENT_INSERTS : INSTRUMENT_UPDATES);
+    if(shard->map->numberOfBuckets != bucketCount)
+        instrumentation.count(INSTRUMENT_RESIZES);
+#endif
+    pthread_rwlock_unlock(&shard->lock);
+    return stored;
+}
+/**
+ * get(char* key, void* out), get(const void* key, size_t keyLength, void* out)
+ * ----------------------------------------------------------------------------
+ * Copies the value of key into out and returns true, or returns false if the
+ * key isn't in the map. Takes the shard's lock shared, so lookups in the same
+ * shard run in parallel; they never advance the shard's incremental rehash.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool ConcurrentHashMap::get(char *key, void *out)
+{
+    return get(key, strlen(key), out);
+}
+bool ConcurrentHashMap::get(const void *key, size_t keyLength, void *out)
+{
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_GET);
+#endif
+    pthread_rwlock_rdlock(&shard->lock);
+    int foundKey = 0;
+    void** nodePointer = shard->map->findKey((char*)key, keyLength, keyHash, &foundKey);
+    if(foundKey)
+        memcpy(out, ChainedHashMap::getValueFromNode(*nodePointer), sizeOfElements);
+    pthread_rwlock_unlock(&shard->lock);
+#ifdef HASHMAP_INSTRUMENT
+    operation.setEvent(foundKey ? INSTRUMENT_HITS : INSTRUMENT_MISSES);
+#endif
+    return foundKey;
+}
+/**
+ * upsert(char* key, void* addr, MergeValueFn mergeFn)
+ * ----------------------------------------------------------------------------
+ * HashMap::upsert() under the shard's exclusive lock; mergeFn runs while the
+ * lock is held, which makes read-modify-write updates atomic.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool ConcurrentHashMap::upsert(char *key, void *addr, MergeValueFn mergeFn)
+{
+    size_t keyLength = strlen(key);
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+    pthread_rwlock_wrlock(&shard->lock);
+#ifdef HASHMAP_INSTRUMENT
+    int bucketCount = shard->map->numberOfBuckets;
+#endif
+    bool stored = shard->map->upsertHashed(key, keyLength, keyHash, addr, mergeFn);
+#ifdef HASHMAP_INSTRUMENT
+    if(shard->map->numberOfBuckets != bucketCount)
+        instrumentation.count(INSTRUMENT_RESIZES);
+#endif
+    pthread_rwlock_unlock(&shard->lock);
+    return stored;
+}
+/**
+ * remove(char* key), remove(const void* key, size_t keyLength)
+ * ----------------------------------------------------------------------------
+ * Removes key and cleans up its value, returning whether the key was found.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool ConcurrentHashMap::remove(char *key)
+{
+    return remove(key, strlen(key));
+}
+bool ConcurrentHashMap::remove(const void *key, size_t keyLength)
+{
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_REMOVE);
+#endif
+    pthread_rwlock_wrlock(&shard->lock);
+    bool removed = shard->map->removeHashed((char*)key, keyLength, keyHash) != NULL;
+    pthread_rwlock_unlock(&shard->lock);
+#ifdef HASHMAP_INSTRUMENT
+    operation.setEvent(removed ? INSTRUMENT_REMOVES : INSTRUMENT_MISSES);
+#endif
+    return removed;
+}
+/**
+ * clear()
+ * ----------------------------------------------------------------------------
+ * Takes every shard's lock (in shard order, so clear() calls can't deadlock)
+ * and then clears the shards, so writers see the whole map cleared at once
+ * and an attached log needs only one record for it.
+ * ----------------------------------------------------------------------------
+ * Runtime: see HashMap::clear()
+ */
+void ConcurrentHashMap::clear()
+{
+    for(int x = 0; x < numberOfShards; x++)
+        pthread_rwlock_wrlock(&shards[x].lock);
+    if(log != NULL)
+        log->logClear();
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        shards[x].map->clearEntries();
+        pthread_rwlock_unlock(&shards[x].lock);
+    }
+}
+///////////////////////////////////
+// PERSISTENCE METHODS
+///////////////////////////////////
+/**
+ * setLog(WriteAheadLog* log)
+ * ----------------------------------------------------------------------------
+ * Attaches a write-ahead log to every shard (or detaches it, if log is NULL).
+ * Shards append their records while holding their exclusive lock, so writes
+ * to a key are logged in the order they were applied, while the append
+ * itself only touches the calling thread's log buffer. Recover by replaying
+ * the log into an empty ConcurrentHashMap before attaching it again.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s); s = number of shards
+ */
+void ConcurrentHashMap::setLog(WriteAheadLog* log)
+{
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_rwlock_wrlock(&shards[x].lock);
+        shards[x].map->setLog(log);
+        pthread_rwlock_unlock(&shards[x].lock);
+    }
+    this->log = log;
+}
+///////////////////////////////////
+// DATA STRUCTURE PROPERTIES
+///////////////////////////////////
+/**
+ * getSize(), getLoadFactor()
+ * ----------------------------------------------------------------------------
+ * Returns the number of elements/the load factor summed over the shards. The
+ * shards are visited one at a time, so under concurrent writes the result is
+ * not a single point-in-time snapshot.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s); s = number of shards
+ */
+int ConcurrentHashMap::getSize()
+{
+    int size = 0;
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_rwlock_rdlock(&shards[x].lock);
+        size += shards[x].map->getSize();
+        pthread_rwlock_unlock(&shards[x].lock);
+    }
+    return size;
+}
+float ConcurrentHashMap::getLoadFactor()
+{
+    float loadFactor = 0;
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_rwlock_rdlock(&shards[x].lock);
+        loadFactor += shards[x].map->getLoadFactor();
+        pthread_rwlock_unlock(&shards[x].lock);
+    }
+    return loadFactor / numberOfShards;
+}
+/**
+ * stats(int sampleBuckets)
+ * ----------------------------------------------------------------------------
+ * Returns HashMap::stats() combined over the shards, each sampling its share
+ * of sampleBuckets (0 walks every bucket): the histograms, bucket and byte
+ * counts are summed, the maxima are the largest of any shard and the probe
+ * averages are weighted by each shard's keys (hits) or sampled buckets
+ * (misses). Each shard is read under its shared lock, so lookups go on while
+ * the scraper walks it and it is safe to call from any thread; as with
+ * getSize() the shards aren't read at a single point in time.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s * (1 + k/n)); s = sampleBuckets, n = number of buckets,
+ * k = size of ConcurrentHashMap
+ */
+HashMapStats ConcurrentHashMap::stats(int sampleBuckets)
+{
+    HashMapStats result;
+    memset(&result, 0, sizeof(result));
+    int shardSample = (sampleBuckets > numberOfShards) ? sampleBuckets/numberOfShards : (sampleBuckets > 0);
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_rwlock_rdlock(&shards[x].lock);
+        HashMapStats shard = shards[x].map->stats(shardSample);
+        pthread_rwlock_unlock(&shards[x].lock);
+
+        result.numberOfElements += shard.numberOfElements;
+        result.numberOfBuckets += shard.numberOfBuckets;
+        result.sampledBuckets += shard.sampledBuckets;
+        for(int bin = 0; bin < STATS_HISTOGRAM_SIZE; bin++)
+        {
+            result.chainLengths[bin] += shard.chainLengths[bin];
+            result.probeDistances[bin] += shard.probeDistances[bin];
+        }
+        if(shard.maxChainLength > result.maxChainLength)
+            result.maxChainLength = shard.maxChainLength;
+        if(shard.maxProbeDistance > result.maxProbeDistance)
+            result.maxProbeDistance = shard.maxProbeDistance;
+        result.successfulProbes += shard.successfulProbes * shard.numberOfElements;
+        result.unsuccessfulProbes += shard.unsuccessfulProbes * shard.sampledBuckets;
+        result.keyBytes += shard.keyBytes;
+        result.valueBytes += shard.valueBytes;
+        result.overheadBytes += shard.overheadBytes;
+        result.allocations += shard.allocations;
+    }
+
+    result.emptyBucketFraction = (double)result.chainLengths[0]/result.sampledBuckets;
+    if(result.numberOfElements > 0)
+        result.successfulProbes /= result.numberOfElements;
+    result.unsuccessfulProbes /= result.sampledBuckets;
+    return result;
+}
+#ifdef HASHMAP_INSTRUMENT
+/**
+ * getInstrumentation()
+ * ----------------------------------------------------------------------------
+ * Returns the counters and sampled latencies of set(), get() and remove(),
+ * lock waits included, kept per calling thread (see instrument.h). Resizes
+ * are those started by set() and upsert() in any shard. Only built with
+ * HASHMAP_INSTRUMENT defined.
+ */
+MapInstrumentation* ConcurrentHashMap::getInstrumentation()
+{
+    return &instrumentation;
+}
+#endif
+/**
+ * getElementSize()
+ * ----------------------------------------------------------------------------
+ * Returns the size in bytes of every value, as passed to the constructor.
+ */
+int ConcurrentHashMap::getElementSize()
+{
+    return sizeOfElements;
+}
+/**
+ * getShardCount()
+ * ----------------------------------------------------------------------------
+ * Returns the number of shards.
+ */
+int ConcurrentHashMap::getShardCount()
+{
+    return numberOfShards;
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void ConcurrentHashMap::initialize(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn)
+{
+    //make sure that we're given valid parameters
+    assert(mapSize >= 0);
+    assert(shardCount > 0);
+
+    //if we're given 0 for our size, use the DEFAULT_SIZE
+    if(mapSize == 0)
+        mapSize = DEFAULT_SIZE;
+
+    sizeOfElements = elementSize;
+    hashFunction = (hashFn != NULL) ? hashFn : wyHash;
+    log = NULL;
+
+    numberOfShards = 1;
+    shardShift = 64;
+    while(numberOfShards < shardCount)
+    {
+        numberOfShards *= 2;
+        shardShift--;
+    }
+
+    int shardSize = 1;
+    while(shardSize * numberOfShards < mapSize)
+        shardSize *= 2;
+
+    shards = new Shard[numberOfShards];
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_rwlock_init(&shards[x].lock, NULL);
+        shards[x].map = new ChainedHashMap(shardSize, elementSize, fn, DEFAULT_MAX_LOAD_FACTOR, hashFunction);
+    }
+}
+//returns the shard picked by the high bits of keyHash
+ConcurrentHashMap::Shard* ConcurrentHashMap::getShardForHash(uint64_t keyHash)
+{
+    if(numberOfShards == 1) //a shift by 64 is undefined
+        return shards;
+    return shards + (keyHash >> shardShift);
+}
+
+#endif
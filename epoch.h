@@ -0,0 +1,172 @@
+/* -------------------------------------------------------------------------- *
+ *                             EpochReclaimer                                 *
+ * -------------------------------------------------------------------------- *
+ * Epoch-based memory reclamation for data structures whose readers take no   *
+ * locks. A reader brackets every access with enter()/exit(), which publish   *
+ * the global epoch it started in to a record owned by its thread (one cache  *
+ * line per thread, so readers never write to a line another reader writes). *
+ * A writer that unlinks a block stamps it with getEpoch() and keeps it until *
+ * advance() reports that every reader still inside the structure started in *
+ * a later epoch; from then on no reader can reach the block and it can be    *
+ * freed.                                                                     *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _epoch_h
+#define _epoch_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "threadrecords.h"
+
+namespace{ //local namespace variables
+    const uint64_t EPOCH_INACTIVE = 0; //record epoch of a thread outside the structure
+    const int EPOCH_THREAD_CACHE_SIZE = 16; //reclaimers a thread finds its record for without a search
+}
+
+class EpochReclaimer{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    EpochReclaimer();
+    ~EpochReclaimer();
+
+    ///////////////////////////////////
+    // READER METHODS
+    ///////////////////////////////////
+    void enter();
+    void exit();
+
+    ///////////////////////////////////
+    // WRITER METHODS
+    ///////////////////////////////////
+    uint64_t getEpoch();
+    uint64_t advance();
+
+private:
+    //per-thread announcement of the epoch the thread entered in
+    struct alignas(64) ThreadRecord{
+        std::atomic<uint64_t> epoch;
+        int depth; //enter() calls not yet matched by exit(); owner only
+        pthread_t owner;
+        ThreadRecord* next;
+        ThreadRecord() : epoch(EPOCH_INACTIVE), depth(0) {}
+    };
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    std::atomic<uint64_t> globalEpoch;
+    //one per thread that ever entered; a thread finds the records of
+    //EPOCH_THREAD_CACHE_SIZE reclaimers (one per map) without a search
+    ThreadRecordList<ThreadRecord, EPOCH_THREAD_CACHE_SIZE> records;
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * EpochReclaimer()
+ * ----------------------------------------------------------------------------
+ * Creates a reclaimer in epoch 1 with no reader records.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+EpochReclaimer::EpochReclaimer() : globalEpoch(1)
+{
+}
+/**
+ * ~EpochReclaimer()
+ * ----------------------------------------------------------------------------
+ * Frees the reader records, through the record list. No thread may be inside
+ * the structure.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t); t = number of threads that ever entered
+ */
+EpochReclaimer::~EpochReclaimer()
+{
+}
+///////////////////////////////////
+// READER METHODS
+///////////////////////////////////
+/**
+ * enter(), exit()
+ * ----------------------------------------------------------------------------
+ * Bracket a read-side access. Between the two calls every block the reader
+ * can reach stays allocated. The calls nest; only the outermost pair
+ * announces and clears the epoch.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) once the calling thread has a record
+ */
+void EpochReclaimer::enter()
+{
+    ThreadRecord* record = records.getThreadRecord();
+    if(record->depth++ > 0)
+        return;
+    record->epoch.store(globalEpoch.load(std::memory_order_relaxed), std::memory_order_release);
+    //the announcement must be visible before any pointer in the structure is
+    //read; pairs with the fence in advance()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+void EpochReclaimer::exit()
+{
+    ThreadRecord* record = records.getThreadRecord();
+    if(--record->depth == 0)
+        record->epoch.store(EPOCH_INACTIVE, std::memory_order_release);
+}
+///////////////////////////////////
+// WRITER METHODS
+///////////////////////////////////
+/**
+ * getEpoch()
+ * ----------------------------------------------------------------------------
+ * Returns the current epoch, which a writer records for a block after
+ * unlinking it. The unlinking store must be visible before the epoch is
+ * read: otherwise another writer could advance the epoch, a reader enter at
+ * the new epoch and still find the block, and the block be freed under it
+ * for carrying the old stamp.
+ */
+uint64_t EpochReclaimer::getEpoch()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst); //orders the unlink before the load
+    return globalEpoch.load(std::memory_order_acquire);
+}
+/**
+ * advance()
+ * ----------------------------------------------------------------------------
+ * Moves the global epoch forward and returns the oldest epoch that a reader
+ * is still inside the structure in (or the new epoch if there are none).
+ * Blocks stamped with an epoch older than the result can be freed.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t); t = number of threads that ever entered
+ */
+uint64_t EpochReclaimer::advance()
+{
+    uint64_t oldest = globalEpoch.fetch_add(1) + 1;
+    //unlinks made before this call must be visible before the records are
+    //read; pairs with the fence in enter()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for(ThreadRecord* record = records.getFirst(); record != NULL; record = record->next)
+    {
+        uint64_t epoch = record->epoch.load(std::memory_order_acquire);
+        if(epoch != EPOCH_INACTIVE && epoch < oldest)
+            oldest = epoch;
+    }
+    return oldest;
+}
+
+#endif
@@ -0,0 +1,757 @@
+/* -------------------------------------------------------------------------- *
+ *                              EpochHashMap                                  *
+ * -------------------------------------------------------------------------- *
+ * A thread-safe hash map for read-heavy workloads: get() and forEach() take  *
+ * no locks and write nothing but the calling thread's own epoch record.      *
+ * Like ConcurrentHashMap the map is split into shards picked by the high     *
+ * bits of the hash, but a shard's mutex only serializes its writers.         *
+ *                                                                            *
+ * Writers never change a node that a reader might be looking at. A new node  *
+ * is filled in completely and then published with a release store into its  *
+ * bucket or its predecessor's next pointer; an update links in a copy with   *
+ * the new value in place of the old node, and a shard grows by copying its  *
+ * nodes into a bigger table and publishing that. Unlinked nodes and tables   *
+ * are retired to the shard's EpochReclaimer list and freed, and for removed  *
+ * or replaced values cleaned up, only once no reader can still reach them.   *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _epochhashmap_h
+#define _epochhashmap_h
+
+#include "hashmap.h"
+#include "epoch.h"
+#include <pthread.h>
+#include <atomic>
+#include <new>
+
+namespace{ //local namespace variables
+    const int EPOCH_MAP_SHARD_COUNT = 64;
+    const int RETIRE_BATCH = 64; //retired blocks a shard collects before it tries to free them
+}
+
+//called by EpochHashMap::forEach() for every entry
+typedef void (*VisitEntryFn)(char* key, void* value, void* context);
+
+class EpochHashMap{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    EpochHashMap(int mapSize, int elementSize);
+    EpochHashMap(int mapSize, int elementSize, CleanupValueFn fn);
+    EpochHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount);
+    EpochHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn);
+    ~EpochHashMap();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    bool set(char *key, void *addr);
+    bool get(char *key, void *out);
+    bool upsert(char *key, void *addr, MergeValueFn mergeFn);
+    int remove(char *key);
+    void clear();
+    void reclaim();
+
+    ///////////////////////////////////
+    // ITERATOR METHODS
+    ///////////////////////////////////
+    void forEach(VisitEntryFn fn, void* context);
+
+    ///////////////////////////////////
+    // DATA STRUCTURE PROPERTIES
+    ///////////////////////////////////
+    int getSize();
+    float getLoadFactor();
+    int getShardCount();
+    int getRetiredCount();
+
+private:
+    //a node is this header followed by the key, its '\0', padding up to the
+    //value alignment and the value; only next changes once the node is
+    //published
+    struct Node{
+        std::atomic<Node*> next;
+        uint64_t hashCode;
+        uint32_t keyLength;
+        uint32_t valueOffset;
+    };
+
+    struct Table{
+        int numberOfBuckets; //a power of two
+        std::atomic<Node*>* buckets;
+    };
+
+    //what a retired block is and what freeing it involves
+    enum RetiredKind{
+        RETIRED_TABLE, //a replaced bucket table
+        RETIRED_NODE, //a node whose value lives on in a copy
+        RETIRED_VALUE //a removed or replaced node; its value gets cleaned up
+    };
+
+    struct Retired{
+        void* block;
+        size_t size;
+        uint64_t epoch; //epoch the block was unlinked in
+        RetiredKind kind;
+    };
+
+    //the table pointer that readers load sits on its own cache line, apart
+    //from the state that writers update
+    struct alignas(CACHE_LINE_SIZE) Shard{
+        std::atomic<Table*> table;
+        alignas(CACHE_LINE_SIZE) pthread_mutex_t writeLock;
+        std::atomic<int> numberOfElements;
+        NodeArena nodeArena;
+        Retired* retired; //malloced, grown on demand
+        int numberRetired;
+        int retiredCapacity;
+        int reclaimThreshold; //numberRetired that triggers the next reclaimShard()
+    };
+
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn);
+    Shard* getShardForHash(uint64_t keyHash);
+    static Table* newTable(int numberOfBuckets);
+    static void deleteTable(Table* table);
+    static char* getKeyFromNode(Node* node);
+    static void* getValueFromNode(Node* node);
+    size_t getValueOffset(size_t keyLength);
+    size_t getNodeSize(size_t keyLength);
+    Node* createNode(Shard* shard, char* key, size_t keyLength, uint64_t keyHash, void* addr);
+    static std::atomic<Node*>* findKey(Table* table, char* key, size_t keyLength, uint64_t keyHash);
+    bool insertNode(Shard* shard, std::atomic<Node*>* link, char* key, size_t keyLength, uint64_t keyHash, void* addr);
+    bool replaceNode(Shard* shard, std::atomic<Node*>* link, void* addr, MergeValueFn mergeFn);
+    bool grow(Shard* shard);
+    bool reserveRetired(Shard* shard, int count);
+    void retire(Shard* shard, void* block, size_t size, RetiredKind kind);
+    void reclaimShard(Shard* shard);
+    void freeRetired(Shard* shard, Retired* item);
+    void destroyShard(Shard* shard);
+    static void emptyCleanUpFunction(void*){}
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    int sizeOfElements; //the size of each value element
+    size_t valueAlignment; //see getDefaultValueAlignment(); never above the arena's
+    int numberOfShards; //a power of two
+    int shardShift; //64 - log2(numberOfShards)
+    CleanupValueFn cleanupFunction;
+    HashKeyFn hashFunction;
+    EpochReclaimer reclaimer;
+    Shard* shards;
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * EpochHashMap()
+ * ----------------------------------------------------------------------------
+ * Creates an EpochHashMap with shardCount shards (64 if not specified,
+ * rounded up to a power of two) that together start out with about mapSize
+ * buckets. fn cleans up removed and replaced values and hashFn hashes the
+ * keys, as for HashMap. Values are aligned like HashMap's default.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k + s); k = mapSize, s = number of shards
+ */
+EpochHashMap::EpochHashMap(int mapSize, int elementSize){
+    initialize(mapSize, elementSize, NULL, EPOCH_MAP_SHARD_COUNT, NULL);
+}
+EpochHashMap::EpochHashMap(int mapSize, int elementSize, CleanupValueFn fn){
+    initialize(mapSize, elementSize, fn, EPOCH_MAP_SHARD_COUNT, NULL);
+}
+EpochHashMap::EpochHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount){
+    initialize(mapSize, elementSize, fn, shardCount, NULL);
+}
+EpochHashMap::EpochHashMap(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn){
+    initialize(mapSize, elementSize, fn, shardCount, hashFn);
+}
+/**
+ * ~EpochHashMap()
+ * ----------------------------------------------------------------------------
+ * Cleans up every value still in the map or waiting to be reclaimed, then
+ * frees the shards. No other thread may be using the map.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n + r + k); n = number of elements, r = retired blocks,
+ *                        k = number of buckets
+ */
+EpochHashMap::~EpochHashMap()
+{
+    for(int x = 0; x < numberOfShards; x++)
+        destroyShard(&shards[x]);
+    delete[] shards;
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * set(char* key, void* addr)
+ * ----------------------------------------------------------------------------
+ * Associates key with a copy of the value at addr. An existing entry is
+ * replaced by a new node and its value is cleaned up once no reader can see
+ * it any more. Takes the shard's write lock. Returns false on allocation
+ * failure.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool EpochHashMap::set(char *key, void *addr)
+{
+    size_t keyLength = strlen(key);
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+    pthread_mutex_lock(&shard->writeLock);
+    Table* table = shard->table.load(std::memory_order_relaxed);
+    std::atomic<Node*>* link = findKey(table, key, keyLength, keyHash);
+    bool stored;
+    if(link->load(std::memory_order_relaxed) != NULL)
+        stored = replaceNode(shard, link, addr, NULL);
+    else
+        stored = insertNode(shard, &table->buckets[keyHash & (table->numberOfBuckets - 1)], key, keyLength, keyHash, addr);
+    pthread_mutex_unlock(&shard->writeLock);
+    return stored;
+}
+/**
+ * get(char* key, void* out)
+ * ----------------------------------------------------------------------------
+ * Copies the value of key into out and returns true, or returns false if the
+ * key isn't in the map. Takes no lock: the lookup only announces the current
+ * epoch in the calling thread's record and follows acquire loads from the
+ * shard's table down the chain, so it never waits for a writer.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool EpochHashMap::get(char *key, void *out)
+{
+    size_t keyLength = strlen(key);
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+    reclaimer.enter();
+    Table* table = shard->table.load(std::memory_order_acquire);
+    Node* node = table->buckets[keyHash & (table->numberOfBuckets - 1)].load(std::memory_order_acquire);
+    while(node != NULL)
+    {
+        if(node->hashCode == keyHash && node->keyLength == keyLength
+           && memcmp(getKeyFromNode(node), key, keyLength) == 0)
+        {
+            memcpy(out, getValueFromNode(node), sizeOfElements);
+            break;
+        }
+        node = node->next.load(std::memory_order_acquire);
+    }
+    reclaimer.exit();
+    return node != NULL;
+}
+/**
+ * upsert(char* key, void* addr, MergeValueFn mergeFn)
+ * ----------------------------------------------------------------------------
+ * Inserts a copy of the value at addr if key is absent. Otherwise the entry
+ * is replaced by a copy whose value is merged with mergeFn(copy, addr), so
+ * readers see either the old or the merged value and never a partial merge.
+ * The old value is not cleaned up, matching HashMap::upsert(). Runs under the
+ * shard's write lock, which makes read-modify-write updates atomic.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool EpochHashMap::upsert(char *key, void *addr, MergeValueFn mergeFn)
+{
+    size_t keyLength = strlen(key);
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+    pthread_mutex_lock(&shard->writeLock);
+    Table* table = shard->table.load(std::memory_order_relaxed);
+    std::atomic<Node*>* link = findKey(table, key, keyLength, keyHash);
+    bool stored;
+    if(link->load(std::memory_order_relaxed) != NULL)
+        stored = replaceNode(shard, link, addr, mergeFn);
+    else
+        stored = insertNode(shard, &table->buckets[keyHash & (table->numberOfBuckets - 1)], key, keyLength, keyHash, addr);
+    pthread_mutex_unlock(&shard->writeLock);
+    return stored;
+}
+/**
+ * remove(char* key)
+ * ----------------------------------------------------------------------------
+ * Unlinks key and returns 1, or returns 0 if the key isn't in the map. The
+ * node and its value are retired; the value is cleaned up once no reader can
+ * see it any more. Returns -1 and leaves the entry in place if there is no
+ * memory to retire the node.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+int EpochHashMap::remove(char *key)
+{
+    size_t keyLength = strlen(key);
+    uint64_t keyHash = hashFunction(key, keyLength);
+    Shard* shard = getShardForHash(keyHash);
+
+    pthread_mutex_lock(&shard->writeLock);
+    std::atomic<Node*>* link = findKey(shard->table.load(std::memory_order_relaxed), key, keyLength, keyHash);
+    Node* node = link->load(std::memory_order_relaxed);
+    int result = 0;
+    if(node != NULL && !reserveRetired(shard, 1))
+        result = -1; //found, but it can't be retired
+    else if(node != NULL)
+    {
+        //readers already on the node still follow its next pointer
+        link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+        shard->numberOfElements.fetch_sub(1, std::memory_order_relaxed);
+        retire(shard, node, getNodeSize(node->keyLength), RETIRED_VALUE);
+        result = 1;
+    }
+    pthread_mutex_unlock(&shard->writeLock);
+    return result;
+}
+/**
+ * clear()
+ * ----------------------------------------------------------------------------
+ * Empties the shards one at a time, retiring every node. Values are cleaned
+ * up once no reader can see them. A shard whose nodes can't all be retired
+ * for lack of memory is left as it is.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n + k); n = number of elements, k = number of buckets
+ */
+void EpochHashMap::clear()
+{
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        Shard* shard = &shards[x];
+        pthread_mutex_lock(&shard->writeLock);
+        Table* table = shard->table.load(std::memory_order_relaxed);
+        if(reserveRetired(shard, shard->numberOfElements.load(std::memory_order_relaxed)))
+        {
+            for(int y = 0; y < table->numberOfBuckets; y++)
+            {
+                Node* node = table->buckets[y].load(std::memory_order_relaxed);
+                table->buckets[y].store(NULL, std::memory_order_release);
+                while(node != NULL)
+                {
+                    Node* next = node->next.load(std::memory_order_relaxed);
+                    retire(shard, node, getNodeSize(node->keyLength), RETIRED_VALUE);
+                    node = next;
+                }
+            }
+            shard->numberOfElements.store(0, std::memory_order_relaxed);
+        }
+        pthread_mutex_unlock(&shard->writeLock);
+    }
+}
+/**
+ * reclaim()
+ * ----------------------------------------------------------------------------
+ * Frees every retired block that no reader can reach any more. Writers do
+ * this on their own in batches; calling it explicitly is only needed to
+ * release memory and run cleanups promptly after the last write.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s * t + r); s = number of shards, t = number of threads that
+ *                        ever read, r = retired blocks
+ */
+void EpochHashMap::reclaim()
+{
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_mutex_lock(&shards[x].writeLock);
+        if(shards[x].numberRetired > 0)
+            reclaimShard(&shards[x]);
+        pthread_mutex_unlock(&shards[x].writeLock);
+    }
+}
+///////////////////////////////////
+// ITERATOR METHODS
+///////////////////////////////////
+/**
+ * forEach(VisitEntryFn fn, void* context)
+ * ----------------------------------------------------------------------------
+ * Calls fn(key, value, context) for every entry without taking any lock. Each
+ * shard is walked inside one epoch, so the key and value pointers stay valid
+ * until fn returns. Entries set or removed concurrently may or may not be
+ * visited, but no entry is visited twice. fn must not modify the value, since
+ * readers may be copying it; it may call other methods of the map.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n + k); n = number of elements, k = number of buckets
+ */
+void EpochHashMap::forEach(VisitEntryFn fn, void* context)
+{
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        reclaimer.enter();
+        Table* table = shards[x].table.load(std::memory_order_acquire);
+        for(int y = 0; y < table->numberOfBuckets; y++)
+        {
+            Node* node = table->buckets[y].load(std::memory_order_acquire);
+            while(node != NULL)
+            {
+                fn(getKeyFromNode(node), getValueFromNode(node), context);
+                node = node->next.load(std::memory_order_acquire);
+            }
+        }
+        reclaimer.exit();
+    }
+}
+///////////////////////////////////
+// DATA STRUCTURE PROPERTIES
+///////////////////////////////////
+/**
+ * getSize(), getLoadFactor()
+ * ----------------------------------------------------------------------------
+ * Returns the number of elements/the load factor summed over the shards,
+ * without locking. Under concurrent writes the result is not a single
+ * point-in-time snapshot.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s); s = number of shards
+ */
+int EpochHashMap::getSize()
+{
+    int size = 0;
+    for(int x = 0; x < numberOfShards; x++)
+        size += shards[x].numberOfElements.load(std::memory_order_relaxed);
+    return size;
+}
+float EpochHashMap::getLoadFactor()
+{
+    float loadFactor = 0;
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        reclaimer.enter();
+        int buckets = shards[x].table.load(std::memory_order_acquire)->numberOfBuckets;
+        reclaimer.exit();
+        loadFactor += (float)shards[x].numberOfElements.load(std::memory_order_relaxed) / buckets;
+    }
+    return loadFactor / numberOfShards;
+}
+/**
+ * getShardCount()
+ * ----------------------------------------------------------------------------
+ * Returns the number of shards.
+ */
+int EpochHashMap::getShardCount()
+{
+    return numberOfShards;
+}
+/**
+ * getRetiredCount()
+ * ----------------------------------------------------------------------------
+ * Returns the number of retired nodes and tables that are waiting for the
+ * readers that might still see them.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s); s = number of shards
+ */
+int EpochHashMap::getRetiredCount()
+{
+    int count = 0;
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        pthread_mutex_lock(&shards[x].writeLock);
+        count += shards[x].numberRetired;
+        pthread_mutex_unlock(&shards[x].writeLock);
+    }
+    return count;
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void EpochHashMap::initialize(int mapSize, int elementSize, CleanupValueFn fn, int shardCount, HashKeyFn hashFn)
+{
+    //make sure that we're given valid parameters
+    assert(mapSize >= 0);
+    assert(shardCount > 0);
+
+    //if we're given 0 for our size, use the DEFAULT_SIZE
+    if(mapSize == 0)
+        mapSize = DEFAULT_SIZE;
+
+    sizeOfElements = elementSize;
+    valueAlignment = getDefaultValueAlignment(elementSize);
+    cleanupFunction = (fn != NULL) ? fn : emptyCleanUpFunction;
+    hashFunction = (hashFn != NULL) ? hashFn : wyHash;
+
+    numberOfShards = 1;
+    shardShift = 64;
+    while(numberOfShards < shardCount)
+    {
+        numberOfShards *= 2;
+        shardShift--;
+    }
+
+    int shardSize = 1;
+    while(shardSize * numberOfShards < mapSize)
+        shardSize *= 2;
+
+    shards = new Shard[numberOfShards];
+    for(int x = 0; x < numberOfShards; x++)
+    {
+        shards[x].table.store(newTable(shardSize), std::memory_order_relaxed);
+        pthread_mutex_init(&shards[x].writeLock, NULL);
+        shards[x].numberOfElements.store(0, std::memory_order_relaxed);
+        shards[x].retired = NULL;
+        shards[x].numberRetired = 0;
+        shards[x].retiredCapacity = 0;
+        shards[x].reclaimThreshold = RETIRE_BATCH;
+    }
+}
+//returns the shard picked by the high bits of keyHash
+EpochHashMap::Shard* EpochHashMap::getShardForHash(uint64_t keyHash)
+{
+    if(numberOfShards == 1) //a shift by 64 is undefined
+        return shards;
+    return shards + (keyHash >> shardShift);
+}
+//allocates a table of empty buckets
+EpochHashMap::Table* EpochHashMap::newTable(int numberOfBuckets)
+{
+    Table* table = new Table;
+    table->numberOfBuckets = numberOfBuckets;
+    table->buckets = new std::atomic<Node*>[numberOfBuckets];
+    for(int x = 0; x < numberOfBuckets; x++)
+        table->buckets[x].store(NULL, std::memory_order_relaxed);
+    return table;
+}
+void EpochHashMap::deleteTable(Table* table)
+{
+    delete[] table->buckets;
+    delete table;
+}
+//the key follows the node header and the value follows the key's '\0' at
+//the offset cached in the header
+char* EpochHashMap::getKeyFromNode(Node* node)
+{
+    return (char*)(node + 1);
+}
+void* EpochHashMap::getValueFromNode(Node* node)
+{
+    return (char*)node + node->valueOffset;
+}
+//arena blocks are aligned at least as strictly as any value, so the padding
+//only depends on the key length
+size_t EpochHashMap::getValueOffset(size_t keyLength)
+{
+    return alignOffset(sizeof(Node) + keyLength + 1, valueAlignment);
+}
+size_t EpochHashMap::getNodeSize(size_t keyLength)
+{
+    return getValueOffset(keyLength) + sizeOfElements;
+}
+//allocates an unpublished node holding key and a copy of the value at addr
+//(zeros if addr is NULL); returns NULL on allocation failure or for keys of
+//4GB or more
+EpochHashMap::Node* EpochHashMap::createNode(Shard* shard, char* key, size_t keyLength, uint64_t keyHash, void* addr)
+{
+    if(keyLength >= UINT32_MAX)
+        return NULL;
+    void* block = shard->nodeArena.allocate(getNodeSize(keyLength));
+    if(block == NULL)
+        return NULL;
+    Node* node = new (block) Node;
+    node->next.store(NULL, std::memory_order_relaxed);
+    node->hashCode = keyHash;
+    node->keyLength = (uint32_t)keyLength;
+    node->valueOffset = (uint32_t)getValueOffset(keyLength);
+    memcpy(getKeyFromNode(node), key, keyLength + 1);
+    if(addr != NULL)
+        memcpy(getValueFromNode(node), addr, sizeOfElements);
+    else
+        memset(getValueFromNode(node), 0, sizeOfElements);
+    return node;
+}
+//returns the link that points at key's node, or the NULL link at the end of
+//its chain. Writers only, under the shard's lock.
+std::atomic<EpochHashMap::Node*>* EpochHashMap::findKey(Table* table, char* key, size_t keyLength, uint64_t keyHash)
+{
+    std::atomic<Node*>* link = &table->buckets[keyHash & (table->numberOfBuckets - 1)];
+    Node* node = link->load(std::memory_order_relaxed);
+    while(node != NULL)
+    {
+        if(node->hashCode == keyHash && node->keyLength == keyLength
+           && memcmp(getKeyFromNode(node), key, keyLength) == 0)
+            break;
+        link = &node->next;
+        node = link->load(std::memory_order_relaxed);
+    }
+    return link;
+}
+//publishes a new node at the front of the chain starting at bucket, growing
+//the shard once its load factor passes DEFAULT_MAX_LOAD_FACTOR
+bool EpochHashMap::insertNode(Shard* shard, std::atomic<Node*>* bucket, char* key, size_t keyLength, uint64_t keyHash, void* addr)
+{
+    Node* node = createNode(shard, key, keyLength, keyHash, addr);
+    if(node == NULL)
+        return false;
+    node->next.store(bucket->load(std::memory_order_relaxed), std::memory_order_relaxed);
+    bucket->store(node, std::memory_order_release); //the node is complete before readers can reach it
+
+    int size = shard->numberOfElements.fetch_add(1, std::memory_order_relaxed) + 1;
+    Table* table = shard->table.load(std::memory_order_relaxed);
+    if(size > table->numberOfBuckets * DEFAULT_MAX_LOAD_FACTOR)
+        grow(shard); //a failed grow leaves a longer chain, not a missing entry
+    return true;
+}
+//swaps the node at link for a copy holding the value at addr, or the old
+//value merged with addr if mergeFn is given, and retires the old node
+bool EpochHashMap::replaceNode(Shard* shard, std::atomic<Node*>* link, void* addr, MergeValueFn mergeFn)
+{
+    if(!reserveRetired(shard, 1))
+        return false;
+    Node* node = link->load(std::memory_order_relaxed);
+    Node* copy = createNode(shard, getKeyFromNode(node), node->keyLength, node->hashCode,
+                            (mergeFn != NULL) ? getValueFromNode(node) : addr);
+    if(copy == NULL)
+        return false;
+    if(mergeFn != NULL)
+        mergeFn(getValueFromNode(copy), addr);
+
+    copy->next.store(node->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    link->store(copy, std::memory_order_release);
+    retire(shard, node, getNodeSize(node->keyLength), (mergeFn != NULL) ? RETIRED_NODE : RETIRED_VALUE);
+    return true;
+}
+//publishes a table with twice the buckets holding copies of every node, then
+//retires the old table and nodes. Readers still in the old table finish their
+//lookups there; nodes can't be relinked in place since that would splice a
+//reader's chain into another bucket.
+bool EpochHashMap::grow(Shard* shard)
+{
+    Table* table = shard->table.load(std::memory_order_relaxed);
+    if(!reserveRetired(shard, shard->numberOfElements.load(std::memory_order_relaxed) + 1))
+        return false;
+    Table* bigger = newTable(table->numberOfBuckets * 2);
+    int mask = bigger->numberOfBuckets - 1;
+
+    for(int x = 0; x < table->numberOfBuckets; x++)
+    {
+        for(Node* node = table->buckets[x].load(std::memory_order_relaxed); node != NULL;
+            node = node->next.load(std::memory_order_relaxed))
+        {
+            Node* copy = createNode(shard, getKeyFromNode(node), node->keyLength, node->hashCode, getValueFromNode(node));
+            if(copy == NULL) //give up; the copies were never published
+            {
+                for(int y = 0; y <= mask; y++)
+                {
+                    Node* orphan = bigger->buckets[y].load(std::memory_order_relaxed);
+                    while(orphan != NULL)
+                    {
+                        Node* next = orphan->next.load(std::memory_order_relaxed);
+                        shard->nodeArena.release(orphan, getNodeSize(orphan->keyLength));
+                        orphan = next;
+                    }
+                }
+                deleteTable(bigger);
+                return false;
+            }
+            std::atomic<Node*>* bucket = &bigger->buckets[node->hashCode & mask];
+            copy->next.store(bucket->load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket->store(copy, std::memory_order_relaxed);
+        }
+    }
+    shard->table.store(bigger, std::memory_order_release);
+
+    for(int x = 0; x < table->numberOfBuckets; x++)
+    {
+        Node* node = table->buckets[x].load(std::memory_order_relaxed);
+        while(node != NULL)
+        {
+            Node* next = node->next.load(std::memory_order_relaxed);
+            retire(shard, node, getNodeSize(node->keyLength), RETIRED_NODE);
+            node = next;
+        }
+    }
+    retire(shard, table, 0, RETIRED_TABLE);
+    return true;
+}
+//makes room for count more retired blocks, so that a writer never unlinks a
+//node it then has nowhere to put
+bool EpochHashMap::reserveRetired(Shard* shard, int count)
+{
+    int needed = shard->numberRetired + count;
+    if(needed <= shard->retiredCapacity)
+        return true;
+    int capacity = (shard->retiredCapacity > 0) ? shard->retiredCapacity : RETIRE_BATCH;
+    while(capacity < needed)
+        capacity *= 2;
+    Retired* retired = (Retired*)realloc(shard->retired, sizeof(Retired) * capacity);
+    if(retired == NULL)
+        return false;
+    shard->retired = retired;
+    shard->retiredCapacity = capacity;
+    return true;
+}
+//records an unlinked block with the current epoch; space must have been
+//reserved. Every RETIRE_BATCH blocks the shard tries to free what it can.
+void EpochHashMap::retire(Shard* shard, void* block, size_t size, RetiredKind kind)
+{
+    Retired* item = &shard->retired[shard->numberRetired++];
+    item->block = block;
+    item->size = size;
+    item->epoch = reclaimer.getEpoch();
+    item->kind = kind;
+    if(shard->numberRetired >= shard->reclaimThreshold)
+        reclaimShard(shard);
+}
+//frees the shard's retired blocks that were unlinked before the oldest epoch
+//a reader is in. Blocks that have to wait raise the next threshold, so a
+//long forEach() doesn't make every write rescan them.
+void EpochHashMap::reclaimShard(Shard* shard)
+{
+    uint64_t oldestEpoch = reclaimer.advance();
+    int kept = 0;
+    for(int x = 0; x < shard->numberRetired; x++)
+    {
+        if(shard->retired[x].epoch < oldestEpoch)
+            freeRetired(shard, &shard->retired[x]);
+        else
+            shard->retired[kept++] = shard->retired[x];
+    }
+    shard->numberRetired = kept;
+    shard->reclaimThreshold = kept + RETIRE_BATCH;
+}
+//frees a retired block, cleaning up its value if it was removed or replaced
+void EpochHashMap::freeRetired(Shard* shard, Retired* item)
+{
+    if(item->kind == RETIRED_TABLE)
+    {
+        deleteTable((Table*)item->block);
+        return;
+    }
+    if(item->kind == RETIRED_VALUE)
+        cleanupFunction(getValueFromNode((Node*)item->block));
+    shard->nodeArena.release(item->block, item->size);
+}
+//cleans up and frees everything a shard holds; the arena frees the nodes
+void EpochHashMap::destroyShard(Shard* shard)
+{
+    Table* table = shard->table.load(std::memory_order_relaxed);
+    if(cleanupFunction != emptyCleanUpFunction)
+    {
+        for(int x = 0; x < table->numberOfBuckets; x++)
+        {
+            for(Node* node = table->buckets[x].load(std::memory_order_relaxed); node != NULL;
+                node = node->next.load(std::memory_order_relaxed))
+                cleanupFunction(getValueFromNode(node));
+        }
+    }
+    for(int x = 0; x < shard->numberRetired; x++)
+        freeRetired(shard, &shard->retired[x]);
+    free(shard->retired);
+    deleteTable(table);
+    pthread_mutex_destroy(&shard->writeLock);
+}
+
+#endif
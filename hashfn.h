@@ -0,0 +1,234 @@
+/* -------------------------------------------------------------------------- *
+ *                              Hash Functions                                *
+ * -------------------------------------------------------------------------- *
+ * The family of key hash functions that HashMap and SwissHashMap can be      *
+ * constructed with. Every function has the HashKeyFn signature and returns a *
+ * 64-bit hash code for the length bytes at key. Clients may also pass their  *
+ * own HashKeyFn; it should mix both the high and the low bits of its result, *
+ * since bucket and slot selection use both.                                  *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _hashfn_h
+#define _hashfn_h
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#endif
+
+typedef uint64_t (*HashKeyFn)(const void *key, size_t length);
+
+uint64_t multiplicativeHash(const void *key, size_t length);
+uint64_t wyHash(const void *key, size_t length);
+uint64_t xxh3Hash(const void *key, size_t length);
+uint64_t crc32cHash(const void *key, size_t length);
+
+namespace{ //local helpers for the hash functions
+    const uint64_t WY_SECRET[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                   0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+    const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t XXH_SECRET[4] = {0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+                                    0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL};
+
+    //unaligned little-endian loads
+    inline uint64_t read64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    inline uint64_t read32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+    //128-bit product of a and b, returned as its two halves
+    inline void multiply128(uint64_t *a, uint64_t *b)
+    {
+        __uint128_t r = (__uint128_t)*a * *b;
+        *a = (uint64_t)r;
+        *b = (uint64_t)(r >> 64);
+    }
+    //128-bit product of a and b folded down to 64 bits
+    inline uint64_t multiplyFold(uint64_t a, uint64_t b)
+    {
+        multiply128(&a, &b);
+        return a ^ b;
+    }
+    //reads 1 to 16 bytes as two words; overlapping loads avoid a byte loop
+    inline void readShort(const uint8_t *p, size_t length, uint64_t *a, uint64_t *b)
+    {
+        if(length >= 4)
+        {
+            size_t shift = (length >> 3) << 2;
+            *a = (read32(p) << 32) | read32(p + shift);
+            *b = (read32(p + length - 4) << 32) | read32(p + length - 4 - shift);
+        }else if(length > 0){
+            *a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            *b = 0;
+        }else{
+            *a = *b = 0;
+        }
+    }
+
+    //the byte-at-a-time CRC32C (Castagnoli) table, built at compile time so
+    //threads hashing concurrently never race to fill it
+    struct Crc32cTable{
+        uint32_t entries[256];
+    };
+    constexpr Crc32cTable makeCrc32cTable()
+    {
+        Crc32cTable table = {};
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t entry = i;
+            for(int bit = 0; bit < 8; bit++)
+                entry = (entry >> 1) ^ (0x82F63B78 & (0 - (entry & 1)));
+            table.entries[i] = entry;
+        }
+        return table;
+    }
+    constexpr Crc32cTable CRC32C_TABLE = makeCrc32cTable();
+
+    //software CRC32C, used when SSE4.2 isn't available
+    uint32_t crc32cSoftware(uint32_t crc, const uint8_t *p, size_t length)
+    {
+        for(size_t i = 0; i < length; i++)
+            crc = CRC32C_TABLE.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+#if defined(__x86_64__) && defined(__GNUC__)
+    //CRC32C with the SSE4.2 crc32 instruction, eight bytes at a time
+    __attribute__((target("sse4.2")))
+    uint32_t crc32cHardware(uint32_t crc, const uint8_t *p, size_t length)
+    {
+        uint64_t crc64 = crc;
+        for(; length >= 8; p += 8, length -= 8)
+            crc64 = _mm_crc32_u64(crc64, read64(p));
+        crc = (uint32_t)crc64;
+        for(; length > 0; p++, length--)
+            crc = _mm_crc32_u8(crc, *p);
+        return crc;
+    }
+#endif
+}
+
+/**
+ * multiplicativeHash(const void* key, size_t length)
+ * ----------------------------------------------------------------------------
+ * The original HashMap hash: one multiply per byte. Its low bits are poorly
+ * mixed, so it should only be used with bucket counts that aren't a power of
+ * two. Kept for comparison.
+ */
+uint64_t multiplicativeHash(const void *key, size_t length)
+{
+    const uint64_t MULTIPLIER = 2630849305L; // magic number
+    const char *s = (const char*)key;
+    uint64_t hashcode = 0;
+    for(size_t i = 0; i < length; i++)
+        hashcode = hashcode * MULTIPLIER + s[i];
+    return hashcode;
+}
+/**
+ * wyHash(const void* key, size_t length)
+ * ----------------------------------------------------------------------------
+ * A word-at-a-time hash following the structure of wyhash: 16 bytes (48 for
+ * long keys) are folded per 128-bit multiply. This is the default hash.
+ */
+uint64_t wyHash(const void *key, size_t length)
+{
+    const uint8_t *p = (const uint8_t*)key;
+    uint64_t seed = multiplyFold(WY_SECRET[0], WY_SECRET[1]);
+    uint64_t a, b;
+
+    if(length <= 16)
+    {
+        readShort(p, length, &a, &b);
+    }else{
+        size_t i = length;
+        if(i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do{
+                seed = multiplyFold(read64(p) ^ WY_SECRET[1], read64(p + 8) ^ seed);
+                see1 = multiplyFold(read64(p + 16) ^ WY_SECRET[2], read64(p + 24) ^ see1);
+                see2 = multiplyFold(read64(p + 32) ^ WY_SECRET[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16)
+        {
+            seed = multiplyFold(read64(p) ^ WY_SECRET[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= WY_SECRET[1];
+    b ^= seed;
+    multiply128(&a, &b);
+    return multiplyFold(a ^ WY_SECRET[0] ^ length, b ^ WY_SECRET[1]);
+}
+/**
+ * xxh3Hash(const void* key, size_t length)
+ * ----------------------------------------------------------------------------
+ * A word-at-a-time hash following the structure of XXH3's short-input paths:
+ * each 16-byte stripe is keyed with a secret, folded with one 128-bit
+ * multiply and the accumulator is finished with the XXH3 avalanche. Not
+ * bit-compatible with the reference XXH3.
+ */
+uint64_t xxh3Hash(const void *key, size_t length)
+{
+    const uint8_t *p = (const uint8_t*)key;
+    uint64_t accumulator = length * XXH_PRIME64_1;
+    uint64_t a, b;
+
+    size_t i = length;
+    for(int stripe = 0; i > 16; stripe ^= 2, p += 16, i -= 16)
+        accumulator += multiplyFold(read64(p) ^ XXH_SECRET[stripe], read64(p + 8) ^ XXH_SECRET[stripe + 1]);
+    if(length > 16)
+    {
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }else{
+        readShort(p, i, &a, &b);
+    }
+    accumulator += multiplyFold(a ^ XXH_SECRET[1], b ^ XXH_SECRET[2]);
+
+    accumulator ^= accumulator >> 37;
+    accumulator *= 0x165667919E3779F9ULL;
+    accumulator ^= accumulator >> 32;
+    return accumulator;
+}
+/**
+ * crc32cHash(const void* key, size_t length)
+ * ----------------------------------------------------------------------------
+ * CRC32C of the key, computed with the SSE4.2 crc32 instruction when the CPU
+ * has it and with a lookup table otherwise. The 32-bit CRC is spread over 64
+ * bits with a multiply so that the high bits are usable as well.
+ */
+uint64_t crc32cHash(const void *key, size_t length)
+{
+    const uint8_t *p = (const uint8_t*)key;
+    uint32_t crc;
+#if defined(__x86_64__) && defined(__GNUC__)
+    static const bool hasSSE42 = __builtin_cpu_supports("sse4.2");
+    if(hasSSE42)
+        crc = crc32cHardware(0xFFFFFFFF, p, length);
+    else
+#endif
+        crc = crc32cSoftware(0xFFFFFFFF, p, length);
+    return (crc ^ ((uint64_t)length << 32)) * XXH_PRIME64_2;
+}
+
+#endif
@@ -1,7 +1,7 @@
 /* -------------------------------------------------------------------------- *
  *                                HashMap                                     *
  * -------------------------------------------------------------------------- *
- * This project is a fixed-size hash map implementation that associates       *
+ * This project is a self-resizing hash map implementation that associates    *
  * string keys with data object references (void*). This implementation uses  *
  * open hashing (seperate chaining) which is probabilistically gives a better *
  * runtime than open addressing. To use HashMap, simply include "hashmap.h"   *
@@ -29,62 +29,333 @@
 #include <signal.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "hashfn.h"
+#include "nodearena.h"
+#include "writeaheadlog.h"
+#ifdef HASHMAP_INSTRUMENT
+#include "instrument.h"
+#endif
 
 namespace{ //local namespace variables
     int DEFAULT_SIZE = 100;
+    float DEFAULT_MAX_LOAD_FACTOR = 1.0; //load factor that triggers a resize
+    int REHASH_BUCKETS_PER_OP = 4; //buckets migrated by each set/get/remove
+    const int GET_MANY_BATCH = 16; //lookups getMany() keeps in flight at once
+    const int CACHE_LINE_SIZE = 64; //padding between data written by different threads
+    const int STATS_HISTOGRAM_SIZE = 17; //bins of the stats() histograms: 0 to 16 keys fill a swiss group
+    const int STATS_SAMPLE_BUCKETS = 1024; //buckets stats() walks by default
+
+    const uint64_t SNAPSHOT_MAGIC = 0x50414d484243504bULL; //"KPCBHMAP" read little-endian
+    const uint32_t SNAPSHOT_VERSION = 1;
+    const char SNAPSHOT_HASH_PROBE[] = "kpcb-hashmap snapshot"; //hashed into every snapshot header
+    const char SNAPSHOT_TEMP_SUFFIX[] = ".tmp"; //saveSnapshot() writes here, then renames
+
+    //the strictest alignment a value of elementSize bytes can need: the
+    //lowest set bit of its size (a type's size is a multiple of its
+    //alignment), capped at alignof(max_align_t)
+    inline size_t getDefaultValueAlignment(int elementSize)
+    {
+        size_t alignment = (size_t)elementSize & (0 - (size_t)elementSize);
+        if(alignment == 0 || alignment > alignof(max_align_t))
+            alignment = alignof(max_align_t);
+        return alignment;
+    }
+    //rounds offset up to a multiple of alignment, a power of two
+    inline size_t alignOffset(size_t offset, size_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+    //the stats() histogram bin that counts x; the last bin also takes the tail
+    inline int getStatsBin(int x)
+    {
+        return (x < STATS_HISTOGRAM_SIZE) ? x : STATS_HISTOGRAM_SIZE - 1;
+    }
 }
 
 typedef void (*CleanupValueFn)(void *addr);
 //empty clean up function to assign to the function pointer if we are passed NULL for our CleanupValueFn
 
+//initializes the zero-filled value of a key inserted by getOrInsert()
+typedef void (*InitValueFn)(void *addr);
+//folds the value at addr into the existing value of a key passed to upsert()
+typedef void (*MergeValueFn)(void *existing, void *addr);
+
+//position of an iteration over a map, filled in by firstEntry()/nextEntry().
+//key, value and keyLength describe the current entry (key and value are NULL
+//once the iteration is done); node and bucket are private to the map. The
+//layout must match CMapCursor in cmap.h.
+struct HashMapCursor{
+    char* key;
+    void* value;
+    size_t keyLength; //bytes in key, which may contain '\0' bytes
+    void* node;
+    int bucket;
+};
+
+//health of a map's table, filled in by stats(). A bucket is a chain for
+//HashMap and a group of 16 slots for SwissHashMap, and a probe visits one
+//node or one group. The histograms, maxima and averages describe the
+//sampledBuckets buckets stats() walked, spread evenly over the table.
+struct HashMapStats{
+    int numberOfElements;
+    int numberOfBuckets; //buckets a lookup can land in
+    int sampledBuckets; //buckets walked, all of them unless stats() sampled
+    int chainLengths[STATS_HISTOGRAM_SIZE]; //sampled buckets holding x keys
+    int probeDistances[STATS_HISTOGRAM_SIZE]; //sampled keys found x probes after the first
+    int maxChainLength;
+    int maxProbeDistance;
+    double emptyBucketFraction;
+    double successfulProbes; //average probes of a lookup that finds its key
+    double unsuccessfulProbes; //average probes of a lookup that misses
+    size_t keyBytes; //bytes of every key, not counting the '\0' terminators; estimated from the sample
+    size_t valueBytes;
+    size_t overheadBytes; //everything else: headers, padding, buckets, free space
+    size_t allocations; //blocks currently held from malloc
+};
+
+class HashMapView;
+
 class HashMap{
+    friend class ConcurrentHashMap; //shards call the *Hashed methods directly
+    friend class HashMapView;
 public:
     ///////////////////////////////////
     // CONSTRUCTORS AND DESTRUCTORS
     ///////////////////////////////////
     HashMap(int mapSize, int elementSize);
     HashMap(int mapSize, int elementSize, CleanupValueFn fn);
+    HashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad);
+    HashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn);
+    HashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment);
     ~HashMap();
 
     ///////////////////////////////////
     // DATA STRUCTURE ACCESS METHODS
     ///////////////////////////////////
     bool set(char *key, void *addr);
+    bool set(const void *key, size_t keyLength, void *addr);
     void* get(char *key);
+    void* get(const void *key, size_t keyLength);
+    int getMany(char **keys, int n, void **outPtrs);
+    void* getOrInsert(char *key, InitValueFn initFn);
+    void* getOrInsert(const void *key, size_t keyLength, InitValueFn initFn);
+    bool upsert(char *key, void *addr, MergeValueFn mergeFn);
+    bool upsert(const void *key, size_t keyLength, void *addr, MergeValueFn mergeFn);
     void* remove(char *key);
+    void* remove(const void *key, size_t keyLength);
+    void clear();
+
+    ///////////////////////////////////
+    // PERSISTENCE METHODS
+    ///////////////////////////////////
+    bool saveSnapshot(const char *path);
+    bool openSnapshot(const char *path);
+    bool loadSnapshot(const char *path);
+    void setLog(WriteAheadLog *log);
+    HashMapView* openView();
 
     ///////////////////////////////////
     // DATA STRUCTURE PROPERTIES
     ///////////////////////////////////
     int getSize();
+    int getElementSize();
     float getLoadFactor();
+    float getMaxLoadFactor();
+    void setMaxLoadFactor(float maxLoad);
+    bool isRehashing();
+    bool isSnapshot();
+    uint64_t getModificationCount();
+    HashMapStats stats(int sampleBuckets = STATS_SAMPLE_BUCKETS);
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation* getInstrumentation();
+#endif
 
     ///////////////////////////////////
     // ITERATOR METHODS
     ///////////////////////////////////
     char *firstNode();
     char *nextNode(char *prevkey);
+    bool firstEntry(HashMapCursor *cursor);
+    bool nextEntry(HashMapCursor *cursor);
+    void endIteration(HashMapCursor *cursor);
+
+    //C++ iteration: for(HashMapCursor& entry : map) visits every key/value
+    class iterator{
+    public:
+        iterator(HashMap* map, bool atEnd);
+        HashMapCursor& operator*();
+        HashMapCursor* operator->();
+        iterator& operator++();
+        bool operator==(const iterator& other) const;
+        bool operator!=(const iterator& other) const;
+    private:
+        HashMap* map;
+        HashMapCursor cursor;
+    };
+    iterator begin();
+    iterator end();
 
 private:
+    //every node starts with this header, followed by the key + '\0', padding
+    //up to the value alignment and then the value
+    struct NodeHeader{
+        void* next; //the next node in the bucket, must stay the first field
+        uint64_t hashCode; //full hash of the key
+        uint32_t keyLength; //strlen of the key
+        uint32_t valueOffset; //from the start of the node to the aligned value
+    };
+
+    //first bytes of a snapshot file. It is followed by numberOfBuckets bucket
+    //offsets and then the nodes, laid out as in memory except that next (and
+    //every bucket) holds the offset of the node from the start of the file,
+    //or 0 at the end of a chain.
+    struct SnapshotHeader{
+        uint64_t magic; //SNAPSHOT_MAGIC; also rejects files of the other byte order
+        uint32_t version;
+        uint32_t nodeHeaderSize; //sizeof(NodeHeader) of the writer
+        uint64_t hashCheck; //hash of SNAPSHOT_HASH_PROBE under the writer's hash function
+        uint32_t elementSize;
+        uint32_t valueAlignment;
+        uint64_t numberOfElements;
+        uint64_t numberOfBuckets;
+        uint64_t bucketsOffset;
+        uint64_t fileSize;
+    };
+
+    //a node or value kept alive for the open view until it's released
+    struct RetiredBlock{
+        void* block;
+        bool isValue; //a copy of a value whose cleanup was deferred, not a node
+    };
+
     ///////////////////////////////////
     // PRIVATE HELPER METHODS
     ///////////////////////////////////
+    void initialize(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment);
     void** getBucketAtIndex(int index);
-    static int hash(char *s, int nbuckets);
+    void** getBucketForHash(uint64_t hashCode);
+    static int getBucketIndex(uint64_t hashCode, int nbuckets);
+    uint64_t hash(char *s, size_t* length);
+    static NodeHeader* getHeaderFromNode(void* node);
+    static NodeHeader* getHeaderFromKey(char* key);
     static void* getKeyFromNode(void* node);
     static void* getValueFromNode(void* node);
-    void* createNode(char* key, void* addr);
-    void** findKey(char *key, int returnPrevFind, int* foundKey);
+    size_t getNodeSize(size_t keyLength);
+    void* createNode(char* key, size_t keyLength, uint64_t keyHash, void* addr);
+    void* insertNode(void** link, char* key, size_t keyLength, uint64_t keyHash, void* addr);
+    void** findKey(char *key, size_t keyLength, uint64_t keyHash, int* foundKey);
+    bool setHashed(char* key, size_t keyLength, uint64_t keyHash, void* addr);
+    bool upsertHashed(char *key, size_t keyLength, uint64_t keyHash, void *addr, MergeValueFn mergeFn);
+    void* removeHashed(char *key, size_t keyLength, uint64_t keyHash);
+    void startRehash();
+    void rehashStep(int bucketsToMove);
+    bool seekFrom(HashMapCursor* cursor, int position);
+    void setCursor(HashMapCursor* cursor, void* node, int position);
+    void clearEntries();
+    void cleanupAllValues();
     static void emptyCleanUpFunction(void *addr);
+    void* getBucketHead(int index);
+    void* getNextNode(void* node);
+    void* getMappedNode(uint64_t offset, uint64_t limit, int bucket);
+    int addChainStats(HashMapStats* result, void* node);
+    void* findSnapshotValue(char *key, size_t keyLength, uint64_t keyHash);
+    bool isValidSnapshot(SnapshotHeader* header, size_t fileSize);
+    void closeSnapshot();
+    template<class Source> bool writeSnapshot(const char *path, Source* source, int bucketCount);
+    bool hasOpenView();
+    bool unshareBucket(uint64_t keyHash);
+    bool copyChain(void** bucket);
+    void cleanupValue(void* value);
+    void retire(void* block, bool isValue);
+    void retireAllNodes();
+    void reclaimView();
 
     ///////////////////////////////////
     // PRIVATE MEMBER VARIABLES
     ///////////////////////////////////
     int sizeOfElements; //the size of each value element
+    size_t valueAlignment; //alignment of every value, a power of two
     int numberOfBuckets; //the number of buckets currently in the HashMap
     int numberOfElements; //the number of elements current in the HashMap
     void** buckets; //array to store the pointers to each LinkedList of buffers
+    NodeArena nodeArena; //allocator that every node is drawn from
     CleanupValueFn cleanupFunction;
+    HashKeyFn hashFunction;
+    float maxLoadFactor; //load factor past which set() grows the map, <= 0 to disable
+
+    //incremental rehash state: while oldBuckets != NULL, buckets below
+    //rehashIndex have been moved into buckets and the rest still live in
+    //oldBuckets
+    void** oldBuckets;
+    int numberOfOldBuckets;
+    int rehashIndex;
+    int openIterations; //unfinished firstNode/firstEntry iterations; get() doesn't rehash while there are any
+    uint64_t modifications; //counts changes, so an iteration can tell the map changed under it
+
+    //read-only snapshot state: while mappedFile != NULL the map is served from
+    //the mapping of a snapshot file and buckets is NULL
+    char* mappedFile;
+    size_t mappedSize;
+    uint64_t* mappedBuckets;
+
+    WriteAheadLog* log; //receives a record for every mutation, or NULL
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation instrumentation; //counters and latency samples of set/get/remove
+#endif
+
+    //copy-on-write state: while view != NULL, a bucket whose shared flag is
+    //set still holds the chain the view sees, so the chain is copied before
+    //it is first changed. The nodes and values it replaces are retired until
+    //the view is released.
+    HashMapView* view;
+    uint8_t* sharedBuckets;
+    uint8_t* sharedOldBuckets;
+    RetiredBlock* retired;
+    int numberOfRetired;
+    int retiredCapacity;
+};
+
+//read-only, point-in-time view of a HashMap returned by HashMap::openView().
+//Its methods may be called from another thread while the map is modified.
+class HashMapView{
+    friend class HashMap;
+public:
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    void* get(char *key);
+    void* get(const void *key, size_t keyLength);
+    int getSize();
+    bool saveSnapshot(const char *path);
+    void release();
+
+    ///////////////////////////////////
+    // ITERATOR METHODS
+    ///////////////////////////////////
+    bool firstEntry(HashMapCursor *cursor);
+    bool nextEntry(HashMapCursor *cursor);
+
+private:
+    HashMapView(HashMap* map);
+    ~HashMapView();
+    bool seekFrom(HashMapCursor* cursor, int position);
+
+    HashMap* map; //only its hash function and value layout are used
+    void** buckets; //copies of the map's bucket arrays when the view was taken
+    int numberOfBuckets;
+    void** oldBuckets;
+    int numberOfOldBuckets;
+    int rehashIndex;
+    int numberOfElements;
+    std::atomic<bool> released; //set by release(), polled by the map's writer
 };
 
 ///////////////////////////////////
@@ -93,143 +364,318 @@ private:
 /**
  * HashMap()
  * ----------------------------------------------------------------------------
- * Creates a fixed-size HashMap of size. All buckets are initialized to point
- * to NULL.
+ * Creates a HashMap with mapSize buckets. All buckets are initialized to
+ * point to NULL. The map grows once its load factor passes maxLoad (1.0 if
+ * not specified); passing a maxLoad <= 0 keeps the bucket count fixed. A NULL
+ * fn means that values don't require any cleanup. Keys are hashed with hashFn
+ * (wyHash if not specified or NULL, see hashfn.h for the built-in family).
+ * Values are aligned to valueAlignment, a power of two; if it isn't specified
+ * or is 0 they get the strictest alignment any type of elementSize bytes can
+ * have (the lowest set bit of elementSize, at most alignof(max_align_t)), so
+ * doubles, int64s and SIMD structs are never misaligned. Pass 1 to pack the
+ * value right after its key.
+ * A power-of-two mapSize selects buckets by masking the hash code; any other
+ * size uses a multiply-shift (fastrange) reduction.
  * ----------------------------------------------------------------------------
  * Runtime: O(k); k = size of HashMap
  */
 HashMap::HashMap(int mapSize, int elementSize){
-    //make sure that we're given valid parameters
-    assert(mapSize > 0);
-
-    //if we're given 0 for our size, use the DEFAULT_SIZE
-    if(mapSize == 0) 
-        mapSize = DEFAULT_SIZE;
-
-    numberOfBuckets = mapSize;
-    numberOfElements = 0;
-    sizeOfElements = elementSize;
-    buckets = (void**)new char[sizeof(void**)*numberOfBuckets];
-
-    //init all of the buckets to NULL
-    for(int x = 0; x < numberOfBuckets; x++)
-        *getBucketAtIndex(x) = NULL;
-
-    cleanupFunction = emptyCleanUpFunction;
+    initialize(mapSize, elementSize, NULL, DEFAULT_MAX_LOAD_FACTOR, NULL, 0);
 }
-/**
- * HashMap()
- * ----------------------------------------------------------------------------
- * Creates a fixed-size HashMap of size. All buckets are initialized to point
- * to NULL.
- * ----------------------------------------------------------------------------
- * Runtime: O(k); k = size of HashMap
- */
 HashMap::HashMap(int mapSize, int elementSize, CleanupValueFn fn){
-    //make sure that we're given valid parameters
-    assert(mapSize > 0);
-
-    //if we're given 0 for our size, use the DEFAULT_SIZE
-    if(mapSize == 0) 
-        mapSize = DEFAULT_SIZE;
-
-    numberOfBuckets = mapSize;
-    numberOfElements = 0;
-    sizeOfElements = elementSize;
-    buckets = (void**)new char[sizeof(void**)*numberOfBuckets];
-
-    //init all of the buckets to NULL
-    for(int x = 0; x < numberOfBuckets; x++)
-        *getBucketAtIndex(x) = NULL;
-
-    cleanupFunction = fn;
+    initialize(mapSize, elementSize, fn, DEFAULT_MAX_LOAD_FACTOR, NULL, 0);
+}
+HashMap::HashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad){
+    initialize(mapSize, elementSize, fn, maxLoad, NULL, 0);
+}
+HashMap::HashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn){
+    initialize(mapSize, elementSize, fn, maxLoad, hashFn, 0);
+}
+HashMap::HashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment){
+    initialize(mapSize, elementSize, fn, maxLoad, hashFn, valueAlignment);
 }
 /**
  * ~HashMap()
  * ----------------------------------------------------------------------------
  * Destructor for HashMap -- called when HashMap is explicitly deleted or goes
- * out of scope. The destructor uses the previously specified class T to delete
- * the T* pointers in each node of the HashMap to avoid memory leaks.
+ * out of scope. The cleanup function is called on every remaining value.
+ * Every node lives in the HashMap's NodeArena, so the nodes are released a
+ * chunk at a time when the arena is destroyed rather than being freed one by
+ * one; without a cleanup function the nodes aren't visited at all.
  * ----------------------------------------------------------------------------
- * Runtime: O(k); k = number of nodes (keys and values)
+ * Runtime: O(c) without a cleanup function, c = number of arena chunks;
+ *          O(k) otherwise, k = number of nodes
  */
 HashMap::~HashMap()
 {
-    void** tempArray[numberOfElements];
-    int elemCount = 0;
-
-    // loop through all the buckets and store the pointers in an array so that
-    // we don't have to deal with freeing in place
-    for(int x = 0; x < numberOfBuckets; x++)
-    {
-        void** tempBucket = buckets + x; //our current xth bucket
-        while(*tempBucket != NULL)
-        {
-            tempArray[elemCount] = (void**)*tempBucket;
-            tempBucket = (void**)*tempBucket;
-            elemCount++;
-        }
-    }
-
-    for(int x = 0; x < elemCount; x++)
-    {
-        free(tempArray[x]);
-    }
-
-    free(buckets);
+    //a view still in use would be left pointing at freed nodes
+    assert(view == NULL || view->released.load(std::memory_order_acquire));
+    if(view != NULL)
+        reclaimView();
+    cleanupAllValues();
+    closeSnapshot();
+    delete[] (char*)buckets;
+    delete[] (char*)oldBuckets;
 }
 ///////////////////////////////////
 // DATA STRUCTURE ACCESS METHODS
 ///////////////////////////////////
 /**
- * set(char* key, void* addr)
+ * set(char* key, void* addr), set(const void* key, size_t keyLength, void* addr)
  * ----------------------------------------------------------------------------
  * Associates a char* key to a void* pointer to an outside data element. If the
  * key already exists in the HashMap, it is replaced with the new pointer value
- * provided.
+ * provided. Once the load factor passes the maximum load factor, the bucket
+ * array is doubled; the nodes are then moved over a few buckets at a time by
+ * the following set/get/remove calls so that no single call pays for the
+ * whole rehash.
+ *
+ * Every key method also comes in a (key, keyLength) form that takes the key
+ * as keyLength raw bytes instead of a '\0' terminated string. The bytes may
+ * contain '\0', and no strlen() is needed since the length is known; keys of
+ * either form are compared with memcmp() once hash and length agree, so
+ * set("abc", ...) and set("abc", 3, ...) name the same entry.
  * ----------------------------------------------------------------------------
  * Runtime: O(1) (amortized)
  */
 bool HashMap::set(char* key, void* addr)
 {   
+    return set(key, strlen(key), addr);
+}
+bool HashMap::set(const void* key, size_t keyLength, void* addr)
+{
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_SET);
+    int size = numberOfElements;
+    bool result = setHashed((char*)key, keyLength, hashFunction(key, keyLength), addr);
+    if(result)
+        operation.setEvent((numberOfElements > size) ? INSTRUMENT_INSERTS : INSTRUMENT_UPDATES);
+    return result;
+#else
+    return setHashed((char*)key, keyLength, hashFunction(key, keyLength), addr);
+#endif
+}
+bool HashMap::setHashed(char* key, size_t keyLength, uint64_t keyHash, void* addr)
+{
+    if(mappedFile != NULL) //snapshots are read-only
+        return false;
+    openIterations = 0; //modifying the map ends any iteration
+    modifications++;
+    rehashStep(REHASH_BUCKETS_PER_OP);
+    if(!unshareBucket(keyHash))
+        return false;
+
     int foundKey = 0;
-    void** nodePointer = findKey(key, 0,&foundKey);
+    void** nodePointer = findKey(key, keyLength, keyHash, &foundKey);
+    void* node = *nodePointer;
 
-    if(*nodePointer != NULL) //if the key already exists in the map, copy over
+    if(node != NULL) //if the key already exists in the map, copy over
     {
-        cleanupFunction(getValueFromNode(*nodePointer));
-        memcpy(getValueFromNode(*nodePointer),addr,sizeOfElements);
+        cleanupValue(getValueFromNode(node));
+        memcpy(getValueFromNode(node),addr,sizeOfElements);
     }
     else //the key doesn't exist in the map so we create a new node
     {
-        void* node = createNode(key, addr);
+        node = insertNode(nodePointer, key, keyLength, keyHash, addr);
         if(node == NULL) //on allocation failure, return false
             return false;
-        *nodePointer = node;
-        numberOfElements++;
     }
+    if(log != NULL)
+        log->logSet(key, keyLength, getValueFromNode(node), sizeOfElements);
     return true;
 }
 /**
- * get(char* key)
+ * get(char* key), get(const void* key, size_t keyLength)
  * ----------------------------------------------------------------------------
  * Searches the HashMap for the given key and if found, returns a pointer to
  * the appropriate value. If the key is not found, NULL is returned. To look
- * for the correct key value, get() uses the hash() function that is specified
- * by the HashMap.
+ * for the correct key value, get() uses the hash function that the HashMap
+ * was constructed with.
  * ----------------------------------------------------------------------------
  * Runtime: O(1) (amortized)
  */
 void* HashMap::get(char *key)
 {
+    return get(key, strlen(key));
+}
+void* HashMap::get(const void *key, size_t keyLength)
+{
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_GET);
+    operation.setEvent(INSTRUMENT_MISSES);
+    if(mappedFile != NULL)
+    {
+        void* value = findSnapshotValue((char*)key, keyLength, hashFunction(key, keyLength));
+        if(value != NULL)
+            operation.setEvent(INSTRUMENT_HITS);
+        return value;
+    }
+#else
+    if(mappedFile != NULL)
+        return findSnapshotValue((char*)key, keyLength, hashFunction(key, keyLength));
+#endif
+    if(openIterations == 0) //moving nodes would break a firstNode/nextNode iteration
+        rehashStep(REHASH_BUCKETS_PER_OP);
+
+    uint64_t keyHash = hashFunction(key, keyLength);
     int foundKey = 0;
-    void** nodePointer = findKey(key, 0,&foundKey);
+    void** nodePointer = findKey((char*)key, keyLength, keyHash, &foundKey);
     if(foundKey)
+    {
+#ifdef HASHMAP_INSTRUMENT
+        operation.setEvent(INSTRUMENT_HITS);
+#endif
         return getValueFromNode(*nodePointer);
+    }
     return NULL;
 }
 /**
- * remove(char* key)
+ * getMany(char** keys, int n, void** outPtrs)
+ * ----------------------------------------------------------------------------
+ * Looks up n keys at once, storing a pointer to the value of keys[i] (or NULL
+ * if it isn't in the map) in outPtrs[i], and returns the number of keys that
+ * were found. The keys are processed in batches: every key in a batch is
+ * hashed and its bucket prefetched, then every chain head is prefetched, and
+ * only then are the chains walked, so the cache misses of independent
+ * lookups overlap instead of being paid one after another.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n) (amortized)
+ */
+int HashMap::getMany(char **keys, int n, void **outPtrs)
+{
+    if(mappedFile != NULL) //a snapshot's chains are linked by offsets
+    {
+        int found = 0;
+        for(int x = 0; x < n; x++)
+            found += (outPtrs[x] = get(keys[x])) != NULL;
+        return found;
+    }
+    if(openIterations == 0) //moving nodes would break a firstNode/nextNode iteration
+        rehashStep(REHASH_BUCKETS_PER_OP);
+
+    int found = 0;
+    size_t keyLengths[GET_MANY_BATCH];
+    uint64_t keyHashes[GET_MANY_BATCH];
+    void** links[GET_MANY_BATCH];
+    for(int start = 0; start < n; start += GET_MANY_BATCH)
+    {
+        int batch = (n - start < GET_MANY_BATCH) ? n - start : GET_MANY_BATCH;
+
+        //hash every key and prefetch its bucket
+        for(int x = 0; x < batch; x++)
+        {
+            keyHashes[x] = hash(keys[start+x], &keyLengths[x]);
+            links[x] = getBucketForHash(keyHashes[x]);
+            __builtin_prefetch(links[x]);
+        }
+        //prefetch the first node of every chain
+        for(int x = 0; x < batch; x++)
+            if(*links[x] != NULL)
+                __builtin_prefetch(*links[x]);
+        //walk the chains
+        for(int x = 0; x < batch; x++)
+        {
+            void** keyBucket = links[x];
+            outPtrs[start+x] = NULL;
+            while(*keyBucket != NULL)
+            {
+                NodeHeader* header = getHeaderFromNode(*keyBucket);
+                if(header->hashCode == keyHashes[x] && header->keyLength == keyLengths[x] &&
+                   memcmp(getKeyFromNode(*keyBucket),keys[start+x],keyLengths[x]) == 0)
+                {
+                    outPtrs[start+x] = getValueFromNode(*keyBucket);
+                    found++;
+                    break;
+                }
+                keyBucket = (void**)*keyBucket;
+            }
+        }
+    }
+    return found;
+}
+/**
+ * getOrInsert(char* key, InitValueFn initFn),
+ * getOrInsert(const void* key, size_t keyLength, InitValueFn initFn)
+ * ----------------------------------------------------------------------------
+ * Returns a pointer to the value of key, inserting the key first if it isn't
+ * in the HashMap yet. A newly inserted value is zero-filled and then passed
+ * to initFn (if not NULL). The pointer stays valid until the key is removed,
+ * so callers can update the value in place; this costs one hash and one
+ * chain walk instead of a get() followed by a set(). Returns NULL on
+ * allocation failure.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* HashMap::getOrInsert(char *key, InitValueFn initFn)
+{
+    return getOrInsert(key, strlen(key), initFn);
+}
+void* HashMap::getOrInsert(const void *key, size_t keyLength, InitValueFn initFn)
+{
+    if(mappedFile != NULL) //snapshots are read-only
+        return NULL;
+    openIterations = 0; //modifying the map ends any iteration
+    modifications++;
+    rehashStep(REHASH_BUCKETS_PER_OP);
+
+    uint64_t keyHash = hashFunction(key, keyLength);
+    if(!unshareBucket(keyHash)) //the caller may write through the pointer
+        return NULL;
+    int foundKey = 0;
+    void** nodePointer = findKey((char*)key, keyLength, keyHash, &foundKey);
+    if(foundKey)
+        return getValueFromNode(*nodePointer);
+
+    void* node = insertNode(nodePointer, (char*)key, keyLength, keyHash, NULL);
+    if(node == NULL)
+        return NULL;
+    if(initFn != NULL)
+        initFn(getValueFromNode(node));
+    if(log != NULL) //later updates through the returned pointer aren't logged
+        log->logSet(key, keyLength, getValueFromNode(node), sizeOfElements);
+    return getValueFromNode(node);
+}
+/**
+ * upsert(char* key, void* addr, MergeValueFn mergeFn),
+ * upsert(const void* key, size_t keyLength, void* addr, MergeValueFn mergeFn)
+ * ----------------------------------------------------------------------------
+ * Inserts a copy of the value at addr if key isn't in the HashMap; otherwise
+ * calls mergeFn(existing, addr) to fold addr into the existing value in place
+ * (the cleanup function isn't called). Returns false on allocation failure.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool HashMap::upsert(char *key, void *addr, MergeValueFn mergeFn)
+{
+    return upsert(key, strlen(key), addr, mergeFn);
+}
+bool HashMap::upsert(const void *key, size_t keyLength, void *addr, MergeValueFn mergeFn)
+{
+    return upsertHashed((char*)key, keyLength, hashFunction(key, keyLength), addr, mergeFn);
+}
+bool HashMap::upsertHashed(char *key, size_t keyLength, uint64_t keyHash, void *addr, MergeValueFn mergeFn)
+{
+    if(mappedFile != NULL) //snapshots are read-only
+        return false;
+    openIterations = 0; //modifying the map ends any iteration
+    modifications++;
+    rehashStep(REHASH_BUCKETS_PER_OP);
+    if(!unshareBucket(keyHash))
+        return false;
+
+    int foundKey = 0;
+    void** nodePointer = findKey(key, keyLength, keyHash, &foundKey);
+    void* node = *nodePointer;
+    if(foundKey)
+        mergeFn(getValueFromNode(node), addr);
+    else if((node = insertNode(nodePointer, key, keyLength, keyHash, addr)) == NULL)
+        return false;
+    if(log != NULL) //the merged value is logged, so replay needs no mergeFn
+        log->logSet(key, keyLength, getValueFromNode(node), sizeOfElements);
+    return true;
+}
+/**
+ * remove(char* key), remove(const void* key, size_t keyLength)
  * ----------------------------------------------------------------------------
  * Searches the HashMap for the given key and if found, removes the associated
  * key and value from the HashMap; returning the value associated with the
@@ -239,35 +685,230 @@ void* HashMap::get(char *key)
  */
 void* HashMap::remove(char *key)
 {
+    return remove(key, strlen(key));
+}
+void* HashMap::remove(const void *key, size_t keyLength)
+{
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_REMOVE);
+    void* value = removeHashed((char*)key, keyLength, hashFunction(key, keyLength));
+    operation.setEvent((value != NULL) ? INSTRUMENT_REMOVES : INSTRUMENT_MISSES);
+    return value;
+#else
+    return removeHashed((char*)key, keyLength, hashFunction(key, keyLength));
+#endif
+}
+void* HashMap::removeHashed(char *key, size_t keyLength, uint64_t keyHash)
+{
+    if(mappedFile != NULL) //snapshots are read-only
+        return NULL;
+    openIterations = 0; //modifying the map ends any iteration
+    modifications++;
+    rehashStep(REHASH_BUCKETS_PER_OP);
+    if(!unshareBucket(keyHash))
+        return NULL;
+
     int foundKey = 0;
-    void** prevNodePointer = findKey(key, 1, &foundKey);
+    void** nodePointer = findKey(key, keyLength, keyHash, &foundKey);
     void* value = NULL;
     if(foundKey)//if we find the key in the map
     {
-        if(prevNodePointer == NULL) //the element is at index 0 of the bucket
-        {
-            int keyHash = hash(key, numberOfBuckets);
-            void** bucketPointer = getBucketAtIndex(keyHash);
-            value = getValueFromNode(*bucketPointer);
-            void* toReplacePointer = *(void**)(*bucketPointer); //temp pointer so that we can set our bucket to the next index
-
-            free(*bucketPointer);
-
-            //set the node to the next node
-            cleanupFunction(getValueFromNode(*bucketPointer));
-            *bucketPointer = toReplacePointer;
-        }else{ //the element is not at index 0
-            void** toRemovePointer = (void**)*prevNodePointer; //pointer to the node that we need to remove
-            value = getValueFromNode(*toRemovePointer);
-            *prevNodePointer = *(void**)(*toRemovePointer); //set the next element of the previous node to the next element of the to remove node
-
-            cleanupFunction(getValueFromNode(*toRemovePointer));
-            free(*toRemovePointer);
-        }
+        void* toRemove = *nodePointer; //the node that we need to remove
+        value = getValueFromNode(toRemove);
+        *nodePointer = *(void**)toRemove; //point the previous link at the next node
+
+        cleanupValue(value);
+        nodeArena.release(toRemove, getNodeSize(getHeaderFromNode(toRemove)->keyLength));
         numberOfElements--;
+        if(log != NULL)
+            log->logRemove(key, keyLength);
     }
     return value;
 }
+/**
+ * clear()
+ * ----------------------------------------------------------------------------
+ * Removes every key and value from the HashMap, calling the cleanup function
+ * on each value. The nodes are released all at once through the NodeArena
+ * and the HashMap keeps its current number of buckets, so refilling it to a
+ * similar size won't need to resize again. A map opened with openSnapshot()
+ * is unmapped and becomes an empty, writable map.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(b + c) without a cleanup function, b = number of buckets;
+ *          O(b + k) otherwise, k = number of nodes
+ */
+void HashMap::clear()
+{
+    if(log != NULL)
+        log->logClear();
+    clearEntries();
+}
+///////////////////////////////////
+// PERSISTENCE METHODS
+///////////////////////////////////
+/**
+ * saveSnapshot(const char* path)
+ * ----------------------------------------------------------------------------
+ * Writes every key and value of the HashMap to the file at path as an image
+ * that openSnapshot() can map and use as it is: a header, then one offset
+ * per bucket and then the nodes, with every link stored as an offset from
+ * the start of the file. The header records the value size and alignment and
+ * a hash of a fixed probe string, so a map with a different layout or hash
+ * function (or seed) refuses the file. Values are copied byte for byte, so
+ * any pointers inside them are meaningless once the process exits. The file
+ * is written next to path and renamed over it once it is complete and
+ * synced, so a crash never leaves a torn snapshot behind. Returns false on
+ * I/O failure.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(b + k); b = number of buckets, k = number of nodes
+ */
+bool HashMap::saveSnapshot(const char* path)
+{
+    int wasOpen = openIterations; //writing walks the map with firstEntry()
+    bool saved = writeSnapshot(path, this, numberOfBuckets);
+    openIterations = wasOpen;
+    return saved;
+}
+/**
+ * openSnapshot(const char* path)
+ * ----------------------------------------------------------------------------
+ * Replaces the contents of the HashMap with the snapshot at path, which is
+ * mapped read-only and used in place: get(), getMany() and iteration walk
+ * the mapped buckets and nodes directly, so opening costs one mmap() and
+ * pages are faulted in as lookups touch them. The cleanup function is called
+ * on the values being replaced, but never on snapshot values. While the
+ * snapshot is open, set(), getOrInsert(), upsert() and remove() fail without
+ * changing anything; clear() unmaps it and makes the map writable again.
+ * Returns false, leaving the HashMap as it was, if the file can't be mapped
+ * or was written by a map with a different value size, value alignment or
+ * hash function, or while a view returned by openView() is still in use.
+ * Every link is checked against the file as it is followed: a link that
+ * leaves the file, points at a node that doesn't fit in it or at a node of
+ * another bucket ends its chain, so a corrupt file loses entries instead of
+ * making the map read outside the mapping.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) plus one page fault per page touched;
+ *          O(k) with a cleanup function, k = number of replaced nodes
+ */
+bool HashMap::openSnapshot(const char* path)
+{
+    if(hasOpenView())
+        return false;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //the mapping keeps the file open
+    if(mapping == MAP_FAILED)
+        return false;
+    SnapshotHeader* header = (SnapshotHeader*)mapping;
+    if(!isValidSnapshot(header, info.st_size))
+    {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+
+    //drop the current contents
+    cleanupAllValues();
+    nodeArena.releaseAll();
+    closeSnapshot();
+    delete[] (char*)buckets;
+    delete[] (char*)oldBuckets;
+    buckets = NULL;
+    oldBuckets = NULL;
+    numberOfOldBuckets = 0;
+    rehashIndex = 0;
+    openIterations = 0;
+    modifications++;
+
+    mappedFile = (char*)mapping;
+    mappedSize = info.st_size;
+    mappedBuckets = (uint64_t*)(mappedFile + header->bucketsOffset);
+    numberOfBuckets = (int)header->numberOfBuckets;
+    numberOfElements = (int)header->numberOfElements;
+    return true;
+}
+/**
+ * loadSnapshot(const char* path)
+ * ----------------------------------------------------------------------------
+ * Replaces the contents of the HashMap with a writable copy of the snapshot
+ * at path, for recovery: load the last snapshot, then replay the log written
+ * since (see WriteAheadLog::replay). The copy isn't logged. Returns false,
+ * leaving the HashMap as it was, if openSnapshot() would refuse the file.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k); k = number of keys in the snapshot
+ */
+bool HashMap::loadSnapshot(const char* path)
+{
+    HashMap mapped(1, sizeOfElements, NULL, maxLoadFactor, hashFunction, (int)valueAlignment);
+    if(!mapped.openSnapshot(path))
+        return false;
+
+    WriteAheadLog* attachedLog = log;
+    log = NULL;
+    clearEntries();
+    bool loaded = true;
+    for(HashMapCursor& entry : mapped)
+        loaded = loaded && setHashed(entry.key, entry.keyLength, getHeaderFromKey(entry.key)->hashCode, entry.value);
+    log = attachedLog;
+    return loaded;
+}
+/**
+ * setLog(WriteAheadLog* log)
+ * ----------------------------------------------------------------------------
+ * Attaches a write-ahead log (or detaches it, if log is NULL). From then on
+ * every set(), getOrInsert() insertion, upsert(), remove() and clear()
+ * appends a record of its result to the log, so replaying the log
+ * reproduces the map. Values updated in place through a pointer returned
+ * by get() or getOrInsert() aren't logged; set() them instead. The log must
+ * outlive the HashMap or be detached first.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+void HashMap::setLog(WriteAheadLog* log)
+{
+    this->log = log;
+}
+/**
+ * openView()
+ * ----------------------------------------------------------------------------
+ * Returns a read-only view of the HashMap as it is now, which another thread
+ * can iterate or save with saveSnapshot() while this one keeps modifying the
+ * map. Taking the view copies only the bucket arrays; the nodes are shared,
+ * and a bucket's chain is copied the first time set(), getOrInsert(),
+ * upsert(), remove() or the rehash touches it afterwards, so writers pay for
+ * each chain at most once. The nodes and values replaced in the meantime
+ * (and the cleanup function calls on them) are held back until the reader
+ * calls release() on the view; the map frees the view on its next mutation.
+ * Values must not be modified in place through get() while the view is
+ * open. Only one view may be open at a time: returns NULL while another is
+ * in use, or if the map was opened with openSnapshot() (it can't change).
+ * The view must be released before the HashMap is destroyed; destroying the
+ * map with a view still in use is an error caught by an assert.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(b); b = number of buckets
+ */
+HashMapView* HashMap::openView()
+{
+    if(hasOpenView() || mappedFile != NULL)
+        return NULL;
+    view = new HashMapView(this);
+
+    sharedBuckets = new uint8_t[numberOfBuckets];
+    memset(sharedBuckets, 1, numberOfBuckets);
+    if(oldBuckets != NULL)
+    {
+        sharedOldBuckets = new uint8_t[numberOfOldBuckets];
+        memset(sharedOldBuckets, 1, numberOfOldBuckets);
+    }
+    return view;
+}
 ///////////////////////////////////
 // DATA STRUCTURE PROPERTIES
 ///////////////////////////////////
@@ -282,6 +923,15 @@ int HashMap::getSize()
 {
     return numberOfElements;
 }
+/**
+ * getElementSize()
+ * ----------------------------------------------------------------------------
+ * Returns the size in bytes of every value, as passed to the constructor.
+ */
+int HashMap::getElementSize()
+{
+    return sizeOfElements;
+}
 /**
  * getLoadFactor()
  * ----------------------------------------------------------------------------
@@ -292,117 +942,1064 @@ float HashMap::getLoadFactor()
 {
     return (double)numberOfElements/numberOfBuckets;
 }
-///////////////////////////////////
-// ITERATOR METHODS
-///////////////////////////////////
 /**
- * firstNode(), nextNode(char* prevKey)
+ * getMaxLoadFactor(), setMaxLoadFactor(float maxLoad)
  * ----------------------------------------------------------------------------
- * These functions allow iteration over the nodes (key/value pairs) in the
- * HashMap. firstNode() returns the first key found in the map. nextNode(prev)
- * returns the next key found in the map after the specified key, prev.
+ * Gets/sets the load factor past which set() grows the HashMap. A maxLoad
+ * <= 0 disables resizing and keeps the current number of buckets.
  */
-char* HashMap::firstNode()
+float HashMap::getMaxLoadFactor()
 {
-    //loop over all of the buckets and return the first node we find
-    for(int x = 0; x < numberOfBuckets; x ++) //look in all the buckets
-        if(*getBucketAtIndex(x) != NULL)
-            return (char*)getKeyFromNode(*getBucketAtIndex(x));
-    return NULL;
+    return maxLoadFactor;
 }
-char* HashMap::nextNode(char* prevKey)
+void HashMap::setMaxLoadFactor(float maxLoad)
 {
-    void** currentNodePointer = (void**)(prevKey-sizeof(void**)); //go backwards to get the pointer to the next node
-    if((*currentNodePointer)==NULL) //if we're at the last element of the linked list
-    {
-        int bucketNumber = hash(prevKey, numberOfBuckets);
-        if(bucketNumber >= numberOfBuckets-1) //if there are no more elements left to iterate over
-            return NULL;
-
-        for(int x = bucketNumber+1; x < numberOfBuckets; x ++) //continue searching in the buckets ahead of us
-            if(*getBucketAtIndex(x) != NULL)
-                return (char*)getKeyFromNode(*getBucketAtIndex(x));
-
-        return NULL;
-    }
-    //else just get the next key in the linked list
-    return (char*)getKeyFromNode(*currentNodePointer);
+    maxLoadFactor = maxLoad;
 }
-///////////////////////////////////
-// PRIVATE HELPER METHODS
-///////////////////////////////////
-//returns a void** pointing to map's index-th bucket
-void** HashMap::getBucketAtIndex(int index)
+/**
+ * isRehashing()
+ * ----------------------------------------------------------------------------
+ * Returns true while nodes are still being moved from the previous bucket
+ * array into the current one.
+ */
+bool HashMap::isRehashing()
 {
-    return (void**)(buckets+index);
+    return oldBuckets != NULL;
 }
-int HashMap::hash(char *s, int nbuckets)
+/**
+ * isSnapshot()
+ * ----------------------------------------------------------------------------
+ * Returns true while the HashMap is served read-only from a snapshot opened
+ * with openSnapshot().
+ */
+bool HashMap::isSnapshot()
 {
-   const unsigned long MULTIPLIER = 2630849305L; // magic number
-   unsigned long hashcode = 0;
-   for (int i = 0; s[i] != '\0'; i++)
-      hashcode = hashcode * MULTIPLIER + s[i];
-    return hashcode % nbuckets;
+    return mappedFile != NULL;
 }
-// given a void* node, perform pointer arthemetic to return a pointer to the
-// start of the key in the node
-void* HashMap::getKeyFromNode(void* node)
+/**
+ * getModificationCount()
+ * ----------------------------------------------------------------------------
+ * Returns a count that every set(), upsert(), getOrInsert(), remove(), clear()
+ * and openSnapshot() moves forward, so code holding a cursor across calls it
+ * doesn't control can check that the map wasn't changed under it.
+ */
+uint64_t HashMap::getModificationCount()
 {
-    return (char*)node + sizeof(void*);
+    return modifications;
+}
+#ifdef HASHMAP_INSTRUMENT
+/**
+ * getInstrumentation()
+ * ----------------------------------------------------------------------------
+ * Returns the counters and sampled latencies of set(), get() and remove()
+ * (see instrument.h). Only built with HASHMAP_INSTRUMENT defined.
+ */
+MapInstrumentation* HashMap::getInstrumentation()
+{
+    return &instrumentation;
+}
+#endif
+/**
+ * stats(int sampleBuckets)
+ * ----------------------------------------------------------------------------
+ * Returns the shape of the table: how long the chains are, how far into its
+ * chain each key sits, the average number of nodes a hit and a miss visit,
+ * where the memory goes and how many blocks are held from malloc. Only about
+ * sampleBuckets evenly spaced buckets are walked, so the cost doesn't grow
+ * with the map; 0 walks every bucket. While a rehash is in progress the old
+ * buckets it hasn't reached are walked along with the new ones. A miss
+ * visits the whole chain its hash leads to, and an unmoved old bucket takes
+ * the hashes of two new ones, so each chain counts towards the miss average
+ * by its share of the hashes; outside a rehash that average is the load
+ * factor. The walk reads only the node headers and changes nothing, but
+ * HashMap isn't thread-safe: a scraper on another thread must hold the lock
+ * that guards the map's writers.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s * (1 + k/n)); s = sampleBuckets, n = number of buckets,
+ * k = size of HashMap
+ */
+HashMapStats HashMap::stats(int sampleBuckets)
+{
+    HashMapStats result;
+    memset(&result, 0, sizeof(result));
+    result.numberOfElements = numberOfElements;
+    int unmovedBuckets = numberOfOldBuckets - rehashIndex; //old buckets the rehash hasn't reached
+    result.numberOfBuckets = unmovedBuckets + numberOfBuckets;
+
+    int stride = 1;
+    if(sampleBuckets > 0 && result.numberOfBuckets > sampleBuckets)
+        stride = (result.numberOfBuckets + sampleBuckets - 1)/sampleBuckets;
+    int sampledKeys = 0;
+    double sampledShare = 0; //of the hash space, which the buckets walked cover
+    for(int x = 0; x < result.numberOfBuckets; x += stride)
+    {
+        bool unmoved = x < unmovedBuckets;
+        int length = addChainStats(&result, unmoved ? oldBuckets[rehashIndex + x] : getBucketHead(x - unmovedBuckets));
+        double share = 1.0/(unmoved ? numberOfOldBuckets : numberOfBuckets);
+        sampledKeys += length;
+        sampledShare += share;
+        result.unsuccessfulProbes += share * length;
+    }
+    //the new buckets of hashes that still go to old buckets are empty, but
+    //count towards the total share so the sample is scaled evenly
+    double totalShare = 1.0 + (unmovedBuckets > 0 ? (double)unmovedBuckets/numberOfOldBuckets : 0);
+    result.unsuccessfulProbes *= totalShare/sampledShare;
+
+    result.emptyBucketFraction = (double)result.chainLengths[0]/result.sampledBuckets;
+    if(sampledKeys > 0)
+        result.successfulProbes /= sampledKeys; //summed by addChainStats()
+    if(sampledKeys > 0 && sampledKeys != numberOfElements) //scale the sample's key bytes up to the whole map
+        result.keyBytes = (size_t)((double)result.keyBytes * numberOfElements / sampledKeys);
+
+    size_t totalBytes;
+    result.valueBytes = (size_t)numberOfElements * sizeOfElements;
+    if(mappedFile != NULL)
+    {
+        totalBytes = mappedSize; //mapped, not malloced
+    }
+    else
+    {
+        totalBytes = nodeArena.getBytesReserved() + sizeof(void*) * (numberOfBuckets + numberOfOldBuckets);
+        result.allocations = nodeArena.getBlocksReserved() + 1 + (oldBuckets != NULL);
+        if(sharedBuckets != NULL)
+        {
+            totalBytes += numberOfBuckets;
+            result.allocations++;
+        }
+        if(sharedOldBuckets != NULL)
+        {
+            totalBytes += numberOfOldBuckets;
+            result.allocations++;
+        }
+        if(retired != NULL)
+        {
+            totalBytes += sizeof(RetiredBlock) * retiredCapacity;
+            result.allocations++;
+        }
+        for(int x = 0; x < numberOfRetired; x++) //the nodes are already in the arena
+        {
+            if(retired[x].isValue)
+            {
+                totalBytes += sizeOfElements;
+                result.allocations++;
+            }
+        }
+    }
+    //the key bytes are an estimate, which mustn't push the overhead below 0
+    result.overheadBytes = (totalBytes > result.keyBytes + result.valueBytes) ? totalBytes - result.keyBytes - result.valueBytes : 0;
+    return result;
+}
+///////////////////////////////////
+// ITERATOR METHODS
+///////////////////////////////////
+/**
+ * firstNode(), nextNode(char* prevKey)
+ * ----------------------------------------------------------------------------
+ * These functions allow iteration over the nodes (key/value pairs) in the
+ * HashMap. firstNode() returns the first key found in the map. nextNode(prev)
+ * returns the next key found in the map after the specified key, prev. The
+ * bucket to continue from is found through the hash code cached in prev's
+ * node, so the key isn't rehashed.
+ */
+char* HashMap::firstNode()
+{
+    HashMapCursor cursor;
+    firstEntry(&cursor);
+    return cursor.key;
+}
+char* HashMap::nextNode(char* prevKey)
+{
+    NodeHeader* header = getHeaderFromKey(prevKey); //go backwards to get the node's header
+    void* next = getNextNode(header);
+    if(next == NULL) //if we're at the last element of the linked list
+    {
+        //continue searching in the buckets ahead of the one holding prevKey
+        HashMapCursor cursor;
+        if(oldBuckets != NULL)
+        {
+            int oldBucketNumber = getBucketIndex(header->hashCode, numberOfOldBuckets);
+            if(oldBucketNumber >= rehashIndex) //prevKey hasn't been migrated yet
+            {
+                seekFrom(&cursor, oldBucketNumber+1);
+                return cursor.key;
+            }
+        }
+        seekFrom(&cursor, numberOfOldBuckets + getBucketIndex(header->hashCode, numberOfBuckets) + 1);
+        return cursor.key;
+    }
+    //else just get the next key in the linked list
+    return (char*)getKeyFromNode(next);
+}
+/**
+ * firstEntry(HashMapCursor* cursor), nextEntry(HashMapCursor* cursor)
+ * ----------------------------------------------------------------------------
+ * Cursor based iteration: firstEntry() points cursor at the first key/value in
+ * the HashMap and nextEntry() advances it, both returning false (and setting
+ * cursor->key to NULL) once there are no entries left, and nextEntry() keeps
+ * returning false if it is called again. The cursor remembers its node and
+ * bucket, so a full iteration is a sequential walk over the buckets. As with
+ * firstNode/nextNode, the HashMap shouldn't be modified in the midst of
+ * iterating, and get() holds back an in-progress rehash until every
+ * iteration has run to its end or been stopped with endIteration().
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool HashMap::firstEntry(HashMapCursor* cursor)
+{
+    openIterations++;
+    return seekFrom(cursor, rehashIndex);
+}
+bool HashMap::nextEntry(HashMapCursor* cursor)
+{
+    if(cursor->node == NULL) //the iteration is already over
+        return false;
+    void* next = getNextNode(cursor->node);
+    if(next != NULL)
+    {
+        setCursor(cursor, next, cursor->bucket);
+        return true;
+    }
+    return seekFrom(cursor, cursor->bucket + 1);
+}
+/**
+ * endIteration(HashMapCursor* cursor)
+ * ----------------------------------------------------------------------------
+ * Stops the iteration under cursor before its end, so get() can go back to
+ * moving buckets for a rehash, and leaves cursor finished. Does nothing to an
+ * iteration that already ran out. Changing the map ends every iteration, so
+ * this mustn't be called for one that started before the last change.
+ */
+void HashMap::endIteration(HashMapCursor* cursor)
+{
+    if(cursor->node != NULL && openIterations > 0)
+        openIterations--;
+    setCursor(cursor, NULL, numberOfOldBuckets + numberOfBuckets);
+}
+/**
+ * begin(), end()
+ * ----------------------------------------------------------------------------
+ * Standard C++ iterators over the HashMap's entries, wrapping a HashMapCursor.
+ */
+HashMap::iterator HashMap::begin()
+{
+    return iterator(this, false);
+}
+HashMap::iterator HashMap::end()
+{
+    return iterator(this, true);
+}
+HashMap::iterator::iterator(HashMap* map, bool atEnd)
+{
+    this->map = map;
+    if(atEnd)
+    {
+        cursor.key = NULL;
+        cursor.value = NULL;
+        cursor.node = NULL;
+        cursor.bucket = 0;
+    }else{
+        map->firstEntry(&cursor);
+    }
+}
+HashMapCursor& HashMap::iterator::operator*()
+{
+    return cursor;
+}
+HashMapCursor* HashMap::iterator::operator->()
+{
+    return &cursor;
+}
+HashMap::iterator& HashMap::iterator::operator++()
+{
+    map->nextEntry(&cursor);
+    return *this;
+}
+bool HashMap::iterator::operator==(const iterator& other) const
+{
+    return cursor.node == other.cursor.node;
+}
+bool HashMap::iterator::operator!=(const iterator& other) const
+{
+    return cursor.node != other.cursor.node;
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void HashMap::initialize(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment)
+{
+    //make sure that we're given valid parameters
+    assert(mapSize >= 0);
+    assert(valueAlignment >= 0 && (valueAlignment & (valueAlignment-1)) == 0);
+
+    //if we're given 0 for our size, use the DEFAULT_SIZE
+    if(mapSize == 0) 
+        mapSize = DEFAULT_SIZE;
+
+    numberOfBuckets = mapSize;
+    numberOfElements = 0;
+    sizeOfElements = elementSize;
+    this->valueAlignment = (valueAlignment > 0) ? valueAlignment : getDefaultValueAlignment(elementSize);
+    buckets = (void**)new char[sizeof(void**)*numberOfBuckets];
+
+    //init all of the buckets to NULL
+    for(int x = 0; x < numberOfBuckets; x++)
+        *getBucketAtIndex(x) = NULL;
+
+    cleanupFunction = (fn != NULL) ? fn : emptyCleanUpFunction;
+    hashFunction = (hashFn != NULL) ? hashFn : wyHash;
+    maxLoadFactor = maxLoad;
+
+    oldBuckets = NULL;
+    numberOfOldBuckets = 0;
+    rehashIndex = 0;
+    openIterations = 0;
+    modifications = 0;
+
+    mappedFile = NULL;
+    mappedSize = 0;
+    mappedBuckets = NULL;
+    log = NULL;
+
+    view = NULL;
+    sharedBuckets = NULL;
+    sharedOldBuckets = NULL;
+    retired = NULL;
+    numberOfRetired = 0;
+    retiredCapacity = 0;
+}
+//returns a void** pointing to map's index-th bucket
+void** HashMap::getBucketAtIndex(int index)
+{
+    return (void**)(buckets+index);
+}
+//returns a void** pointing to the bucket that currently holds keys with
+//hashCode, which is in oldBuckets if the rehash hasn't reached it yet
+void** HashMap::getBucketForHash(uint64_t hashCode)
+{
+    if(oldBuckets != NULL)
+    {
+        int oldBucketNumber = getBucketIndex(hashCode, numberOfOldBuckets);
+        if(oldBucketNumber >= rehashIndex)
+            return oldBuckets + oldBucketNumber;
+    }
+    return getBucketAtIndex(getBucketIndex(hashCode, numberOfBuckets));
+}
+//reduces a hash code to a bucket index: a mask for power-of-two bucket counts
+//(which doubling preserves), multiply-shift by the high bits otherwise
+int HashMap::getBucketIndex(uint64_t hashCode, int nbuckets)
+{
+    if((nbuckets & (nbuckets-1)) == 0)
+        return (int)(hashCode & (nbuckets-1));
+    return (int)(((__uint128_t)hashCode * (uint64_t)nbuckets) >> 64);
+}
+//returns the full hash code of s, storing strlen(s) in length
+uint64_t HashMap::hash(char *s, size_t* length)
+{
+    *length = strlen(s);
+    return hashFunction(s, *length);
+}
+// given a void* node or a key returned by getKeyFromNode, returns a pointer to
+// the node's header
+HashMap::NodeHeader* HashMap::getHeaderFromNode(void* node)
+{
+    return (NodeHeader*)node;
+}
+HashMap::NodeHeader* HashMap::getHeaderFromKey(char* key)
+{
+    return (NodeHeader*)(key - sizeof(NodeHeader));
 }
 // given a void* node, perform pointer arthemetic to return a pointer to the
-// start of the value in the node
+// start of the key in the node
+void* HashMap::getKeyFromNode(void* node)
+{
+    return (char*)node + sizeof(NodeHeader);
+}
+// given a void* node, return a pointer to the start of its aligned value;
+// the padding after the key is worked out once, in createNode()
 void* HashMap::getValueFromNode(void* node)
 {
-    return (char*)node + sizeof(void**) + strlen((char*)getKeyFromNode(node)) + 1;
+    return (char*)node + getHeaderFromNode(node)->valueOffset;
 }
-// returns the address to a newly created node with key and addr, pointing to
-// NULL as the next node
-void* HashMap::createNode(char* key, void* addr)
+// returns the number of bytes allocated for a node with a key of keyLength.
+// Arena blocks are only ARENA_ALIGNMENT aligned, so stricter value alignments
+// reserve room to slide the value up to its boundary.
+size_t HashMap::getNodeSize(size_t keyLength)
 {
-    void* node = new char[sizeof(void**)+(strlen(key)+1)+sizeOfElements]; //malloc the size that we need for the void** pointer, the key + '\0', and the value
+    size_t slack = (valueAlignment > ARENA_ALIGNMENT) ? valueAlignment - ARENA_ALIGNMENT : 0;
+    return alignOffset(sizeof(NodeHeader) + keyLength + 1, valueAlignment) + slack + sizeOfElements;
+}
+// returns the address to a newly created node with key and a copy of addr (or
+// a zero-filled value if addr is NULL), pointing to NULL as the next node, or
+// NULL if the node couldn't be allocated or the key is 4GB or longer
+void* HashMap::createNode(char* key, size_t keyLength, uint64_t keyHash, void* addr)
+{
+    if(keyLength >= UINT32_MAX)
+        return NULL;
+    void* node = nodeArena.allocate(getNodeSize(keyLength)); //the header, the key + '\0', the padding and the value
+    if(node == NULL)
+        return NULL;
 
-    void** nextNodeToPointTo = (void**)new char[sizeof(void**)]; //malloc our pointer to the next element in the array
-    *nextNodeToPointTo = NULL;
+    NodeHeader* header = getHeaderFromNode(node);
+    header->next = NULL;
+    header->hashCode = keyHash;
+    header->keyLength = (uint32_t)keyLength;
+    uintptr_t keyEnd = (uintptr_t)getKeyFromNode(node) + keyLength + 1;
+    header->valueOffset = (uint32_t)(alignOffset(keyEnd, valueAlignment) - (uintptr_t)node);
 
-    //copy over our values into the memory allocated to the node
-    memcpy(node,nextNodeToPointTo,sizeof(void**));
-    strcpy((char*)getKeyFromNode(node),key);
-    memcpy(getValueFromNode(node),addr,sizeOfElements);
-    free(nextNodeToPointTo);
+    //copy over our values into the memory allocated to the node; the key is
+    //terminated here since a binary key needn't be
+    memcpy(getKeyFromNode(node),key,keyLength);
+    ((char*)getKeyFromNode(node))[keyLength] = '\0';
+    if(addr != NULL)
+        memcpy(getValueFromNode(node),addr,sizeOfElements);
+    else
+        memset(getValueFromNode(node),0,sizeOfElements);
 
     return node;
 }
-// returns a void** pointer to the node with key in CMap if the key is found in
-// the map, changes foundKey to 1 if we find a key, returns the previous node
-// if returnPrevFind is set to 1
-void** HashMap::findKey(char *key, int returnPrevFind, int* foundKey)
+// creates a node for key and links it in at link, the NULL link at the end of
+// key's bucket found by findKey(); starts growing the map if the load factor
+// is now too high. Returns the node, or NULL on allocation failure.
+void* HashMap::insertNode(void** link, char* key, size_t keyLength, uint64_t keyHash, void* addr)
 {
-    int keyHash = hash(key, numberOfBuckets);
+    void* node = createNode(key, keyLength, keyHash, addr);
+    if(node == NULL)
+        return NULL;
+    *link = node;
+    numberOfElements++;
 
-    //keep track of two nodes at a time so that remove also works
-    void** prevKeyBucket = NULL;
-    void** keyBucket = getBucketAtIndex(keyHash);
+    if(oldBuckets == NULL && maxLoadFactor > 0 && getLoadFactor() > maxLoadFactor)
+        startRehash();
+    return node;
+}
+// returns a void** pointer to the link (bucket or next pointer) that points
+// to the node with key, or to the NULL link at the end of key's bucket if the
+// key isn't in the map; changes foundKey to 1 if we find the key. Nodes whose
+// cached hash or length differ are skipped without touching their key bytes.
+void** HashMap::findKey(char *key, size_t keyLength, uint64_t keyHash, int* foundKey)
+{
+    void** keyBucket = getBucketForHash(keyHash);
 
     //iterate through the linked list in the bucket until we reach the end
     while(*keyBucket != NULL)
     {
-        if(strcmp((char*)getKeyFromNode(*keyBucket),key) == 0) //if we find a match
+        NodeHeader* header = getHeaderFromNode(*keyBucket);
+        if(header->hashCode == keyHash && header->keyLength == keyLength &&
+           memcmp(getKeyFromNode(*keyBucket),key,keyLength) == 0) //if we find a match
         {
             *foundKey = 1;
             break;
         }
-        //increment both of our nodes
-        prevKeyBucket = keyBucket;
         keyBucket = (void**)*keyBucket;
     }
+    return keyBucket;
+}
+// swaps in a bucket array twice the size of the current one; the nodes are
+// moved over incrementally by rehashStep()
+void HashMap::startRehash()
+{
+#ifdef HASHMAP_INSTRUMENT
+    instrumentation.count(INSTRUMENT_RESIZES);
+#endif
+    oldBuckets = buckets;
+    numberOfOldBuckets = numberOfBuckets;
+    rehashIndex = 0;
 
-    if(returnPrevFind)
+    numberOfBuckets *= 2;
+    buckets = (void**)new char[sizeof(void**)*numberOfBuckets];
+    for(int x = 0; x < numberOfBuckets; x++)
+        *getBucketAtIndex(x) = NULL;
+
+    if(sharedBuckets != NULL) //the open view shares the old chains, not the new ones
     {
-        return prevKeyBucket;
+        sharedOldBuckets = sharedBuckets;
+        sharedBuckets = new uint8_t[numberOfBuckets];
+        memset(sharedBuckets, 0, numberOfBuckets);
     }
-    return keyBucket;
+}
+// moves the nodes of up to bucketsToMove old buckets into the current bucket
+// array, releasing the old array once it has been drained
+void HashMap::rehashStep(int bucketsToMove)
+{
+    if(oldBuckets == NULL)
+        return;
+
+    for(int x = 0; x < bucketsToMove && rehashIndex < numberOfOldBuckets; x++)
+    {
+        if(hasOpenView() && sharedOldBuckets[rehashIndex]) //moving relinks the nodes
+        {
+            if(!copyChain(oldBuckets + rehashIndex)) //try again on a later step
+                return;
+            sharedOldBuckets[rehashIndex] = 0;
+        }
+        void* node = oldBuckets[rehashIndex];
+        while(node != NULL)
+        {
+            void* nextNode = *(void**)node;
+            void** newBucket = getBucketAtIndex(getBucketIndex(getHeaderFromNode(node)->hashCode, numberOfBuckets));
+            *(void**)node = *newBucket; //push the node onto the front of its new bucket
+            *newBucket = node;
+            node = nextNode;
+        }
+        oldBuckets[rehashIndex] = NULL;
+        rehashIndex++;
+    }
+
+    if(rehashIndex == numberOfOldBuckets)
+    {
+        delete[] (char*)oldBuckets;
+        delete[] sharedOldBuckets;
+        oldBuckets = NULL;
+        sharedOldBuckets = NULL;
+        numberOfOldBuckets = 0;
+        rehashIndex = 0;
+    }
+}
+// points cursor at the first node at or after position in iteration order,
+// where positions count the old buckets first and then the current buckets
+// (only old buckets the rehash hasn't reached yet hold nodes). Returns false
+// and ends the iteration if there are no nodes left.
+bool HashMap::seekFrom(HashMapCursor* cursor, int position)
+{
+    for(; position < numberOfOldBuckets; position++)
+        if(oldBuckets[position] != NULL)
+        {
+            setCursor(cursor, oldBuckets[position], position);
+            return true;
+        }
+
+    for(int x = position - numberOfOldBuckets; x < numberOfBuckets; x++)
+        if(getBucketHead(x) != NULL)
+        {
+            setCursor(cursor, getBucketHead(x), numberOfOldBuckets + x);
+            return true;
+        }
+
+    setCursor(cursor, NULL, numberOfOldBuckets + numberOfBuckets);
+    if(openIterations > 0) //we've reached the end of the iteration
+        openIterations--;
+    return false;
+}
+// fills in cursor for node, which sits in the bucket at position
+void HashMap::setCursor(HashMapCursor* cursor, void* node, int position)
+{
+    cursor->node = node;
+    cursor->bucket = position;
+    cursor->key = (node != NULL) ? (char*)getKeyFromNode(node) : NULL;
+    cursor->value = (node != NULL) ? getValueFromNode(node) : NULL;
+    cursor->keyLength = (node != NULL) ? getHeaderFromNode(node)->keyLength : 0;
+}
+// body of clear() without the log record; also used by ConcurrentHashMap,
+// which logs a single clear for all of its shards
+void HashMap::clearEntries()
+{
+    if(hasOpenView()) //the view may still be reading the nodes
+        retireAllNodes();
+    else
+    {
+        cleanupAllValues();
+        nodeArena.releaseAll();
+    }
+    if(mappedFile != NULL)
+    {
+        closeSnapshot();
+        buckets = (void**)new char[sizeof(void**)*numberOfBuckets];
+    }
+
+    delete[] (char*)oldBuckets;
+    delete[] sharedOldBuckets;
+    oldBuckets = NULL;
+    sharedOldBuckets = NULL;
+    numberOfOldBuckets = 0;
+    rehashIndex = 0;
+
+    memset(buckets, 0, sizeof(void**)*numberOfBuckets);
+    if(sharedBuckets != NULL) //empty chains have nothing left to share
+        memset(sharedBuckets, 0, numberOfBuckets);
+    numberOfElements = 0;
+    openIterations = 0;
+    modifications++;
+}
+// calls the cleanup function on every value in the map by streaming over the
+// buckets; does nothing if there is no cleanup function
+void HashMap::cleanupAllValues()
+{
+    if(cleanupFunction == emptyCleanUpFunction || mappedFile != NULL)
+        return;
+
+    for(int x = rehashIndex; oldBuckets != NULL && x < numberOfOldBuckets; x++)
+        for(void* node = oldBuckets[x]; node != NULL; node = *(void**)node)
+            cleanupFunction(getValueFromNode(node));
+
+    for(int x = 0; x < numberOfBuckets; x++)
+        for(void* node = *getBucketAtIndex(x); node != NULL; node = *(void**)node)
+            cleanupFunction(getValueFromNode(node));
 }
 void HashMap::emptyCleanUpFunction(void *addr) {};
+// returns the first node of the index-th current bucket, or NULL if it's empty
+void* HashMap::getBucketHead(int index)
+{
+    if(mappedFile != NULL)
+        return getMappedNode(mappedBuckets[index], mappedSize, index);
+    return *getBucketAtIndex(index);
+}
+// returns the node after node in its bucket, or NULL if it's the last one;
+// snapshot nodes link to each other by file offset
+void* HashMap::getNextNode(void* node)
+{
+    NodeHeader* header = getHeaderFromNode(node);
+    if(mappedFile != NULL)
+        return getMappedNode((uint64_t)(uintptr_t)header->next, (char*)node - mappedFile,
+                             getBucketIndex(header->hashCode, numberOfBuckets));
+    return header->next;
+}
+// returns the snapshot node at offset, or NULL at the end of a chain or if
+// the node isn't one of bucket's that lies wholly inside the file. The writer
+// pushes nodes onto the front of their bucket, so each link points below
+// limit, the offset of the node it was read from; a corrupt file can't make
+// a chain loop.
+void* HashMap::getMappedNode(uint64_t offset, uint64_t limit, int bucket)
+{
+    uint64_t nodesOffset = (char*)(mappedBuckets + numberOfBuckets) - mappedFile;
+    if(offset < nodesOffset || offset >= limit || offset % ARENA_ALIGNMENT != 0
+       || mappedSize - offset < sizeof(NodeHeader))
+        return NULL;
+    void* node = mappedFile + offset;
+    NodeHeader* header = getHeaderFromNode(node);
+    if((uint64_t)header->valueOffset < sizeof(NodeHeader) + (uint64_t)header->keyLength + 1
+       || (uint64_t)header->valueOffset + (uint64_t)sizeOfElements > mappedSize - offset
+       || (offset + header->valueOffset) % valueAlignment != 0
+       || ((char*)getKeyFromNode(node))[header->keyLength] != '\0'
+       || getBucketIndex(header->hashCode, numberOfBuckets) != bucket)
+        return NULL;
+    return node;
+}
+// adds the chain starting at node to the bucket, key and probe totals of
+// result and returns its length; successfulProbes collects the sum of the
+// probes, not the average
+int HashMap::addChainStats(HashMapStats* result, void* node)
+{
+    int length = 0;
+    for(; node != NULL; node = getNextNode(node))
+    {
+        result->probeDistances[getStatsBin(length)]++;
+        result->keyBytes += getHeaderFromNode(node)->keyLength;
+        length++;
+        result->successfulProbes += length;
+    }
+    if(length > 0 && length - 1 > result->maxProbeDistance)
+        result->maxProbeDistance = length - 1;
+    if(length > result->maxChainLength)
+        result->maxChainLength = length;
+    result->chainLengths[getStatsBin(length)]++;
+    result->sampledBuckets++;
+    return length;
+}
+// returns a pointer to the value of key in the open snapshot, or NULL if the
+// key isn't in it
+void* HashMap::findSnapshotValue(char *key, size_t keyLength, uint64_t keyHash)
+{
+    for(void* node = getBucketHead(getBucketIndex(keyHash, numberOfBuckets)); node != NULL; node = getNextNode(node))
+    {
+        NodeHeader* header = getHeaderFromNode(node);
+        if(header->hashCode == keyHash && header->keyLength == keyLength &&
+           memcmp(getKeyFromNode(node),key,keyLength) == 0)
+            return getValueFromNode(node);
+    }
+    return NULL;
+}
+// returns whether header describes a complete snapshot of fileSize bytes
+// that this map can read: same format, node layout, value layout and hash
+// function, and a bucket array that lies inside the file
+bool HashMap::isValidSnapshot(SnapshotHeader* header, size_t fileSize)
+{
+    return header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION
+           && header->nodeHeaderSize == sizeof(NodeHeader)
+           && header->hashCheck == hashFunction(SNAPSHOT_HASH_PROBE, strlen(SNAPSHOT_HASH_PROBE))
+           && header->elementSize == (uint32_t)sizeOfElements
+           && header->valueAlignment == valueAlignment
+           && header->fileSize == fileSize
+           && header->numberOfBuckets > 0 && header->numberOfBuckets <= INT_MAX
+           && header->numberOfElements <= INT_MAX
+           && header->bucketsOffset >= sizeof(SnapshotHeader) && header->bucketsOffset <= fileSize
+           && header->bucketsOffset % sizeof(uint64_t) == 0
+           && header->numberOfBuckets*sizeof(uint64_t) <= fileSize - header->bucketsOffset;
+}
+// unmaps the open snapshot, if there is one
+void HashMap::closeSnapshot()
+{
+    if(mappedFile == NULL)
+        return;
+    munmap(mappedFile, mappedSize);
+    mappedFile = NULL;
+    mappedSize = 0;
+    mappedBuckets = NULL;
+}
+// returns whether a view returned by openView() is still in use, first
+// reclaiming it if its reader has released it
+bool HashMap::hasOpenView()
+{
+    if(view != NULL && view->released.load(std::memory_order_acquire))
+        reclaimView();
+    return view != NULL;
+}
+// makes the chain that holds keys with keyHash private before it's changed,
+// if the open view still shares it. Returns false on allocation failure.
+bool HashMap::unshareBucket(uint64_t keyHash)
+{
+    if(!hasOpenView())
+        return true;
+
+    uint8_t* shared = sharedBuckets + getBucketIndex(keyHash, numberOfBuckets);
+    if(oldBuckets != NULL)
+    {
+        int oldBucketNumber = getBucketIndex(keyHash, numberOfOldBuckets);
+        if(oldBucketNumber >= rehashIndex)
+            shared = sharedOldBuckets + oldBucketNumber;
+    }
+    if(*shared && !copyChain(getBucketForHash(keyHash)))
+        return false;
+    *shared = 0;
+    return true;
+}
+// replaces the chain at bucket with copies of its nodes, retiring the nodes
+// the view shares. Returns false, leaving the chain as it was, on allocation
+// failure.
+bool HashMap::copyChain(void** bucket)
+{
+    void* copies = NULL;
+    void** tail = &copies;
+    for(void* node = *bucket; node != NULL; node = *(void**)node)
+    {
+        NodeHeader* header = getHeaderFromNode(node);
+        void* copy = createNode((char*)getKeyFromNode(node), header->keyLength, header->hashCode, getValueFromNode(node));
+        if(copy == NULL)
+        {
+            while(copies != NULL)
+            {
+                void* next = *(void**)copies;
+                nodeArena.release(copies, getNodeSize(getHeaderFromNode(copies)->keyLength));
+                copies = next;
+            }
+            return false;
+        }
+        *tail = copy;
+        tail = (void**)copy;
+    }
+
+    for(void* node = *bucket; node != NULL; node = *(void**)node)
+        retire(node, false);
+    *bucket = copies;
+    return true;
+}
+// calls the cleanup function on a value leaving the map; while a view is open
+// the value's bytes are copied and cleaned up once it's released instead,
+// since the view may still hold the same bytes
+void HashMap::cleanupValue(void* value)
+{
+    if(view == NULL || cleanupFunction == emptyCleanUpFunction)
+    {
+        cleanupFunction(value);
+        return;
+    }
+    void* copy = NULL;
+    size_t alignment = (valueAlignment > sizeof(void*)) ? valueAlignment : sizeof(void*);
+    int failed = posix_memalign(&copy, alignment, (sizeOfElements > 0) ? sizeOfElements : 1);
+    assert(failed == 0); //like new, treat running out of memory as fatal
+    memcpy(copy, value, sizeOfElements);
+    retire(copy, true);
+}
+// keeps block (a node, or a value copied by cleanupValue()) until the open
+// view is released
+void HashMap::retire(void* block, bool isValue)
+{
+    if(numberOfRetired == retiredCapacity)
+    {
+        retiredCapacity = (retiredCapacity > 0) ? retiredCapacity*2 : 16;
+        retired = (RetiredBlock*)realloc(retired, sizeof(RetiredBlock)*retiredCapacity);
+        assert(retired != NULL);
+    }
+    retired[numberOfRetired].block = block;
+    retired[numberOfRetired].isValue = isValue;
+    numberOfRetired++;
+}
+// clear() while a view is open: every node and value is retired rather than
+// released
+void HashMap::retireAllNodes()
+{
+    for(int x = rehashIndex; oldBuckets != NULL && x < numberOfOldBuckets; x++)
+        for(void* node = oldBuckets[x]; node != NULL; node = *(void**)node)
+        {
+            cleanupValue(getValueFromNode(node));
+            retire(node, false);
+        }
+
+    for(int x = 0; x < numberOfBuckets; x++)
+        for(void* node = *getBucketAtIndex(x); node != NULL; node = *(void**)node)
+        {
+            cleanupValue(getValueFromNode(node));
+            retire(node, false);
+        }
+}
+// frees the view along with everything retired for it: nodes go back to the
+// arena and deferred values get their cleanup function call
+void HashMap::reclaimView()
+{
+    for(int x = 0; x < numberOfRetired; x++)
+    {
+        void* block = retired[x].block;
+        if(retired[x].isValue)
+        {
+            cleanupFunction(block);
+            free(block);
+        }
+        else
+            nodeArena.release(block, getNodeSize(getHeaderFromNode(block)->keyLength));
+    }
+    free(retired);
+    retired = NULL;
+    numberOfRetired = 0;
+    retiredCapacity = 0;
+
+    delete[] sharedBuckets;
+    delete[] sharedOldBuckets;
+    sharedBuckets = NULL;
+    sharedOldBuckets = NULL;
+    delete view;
+    view = NULL;
+}
+// body of saveSnapshot(), shared with HashMapView: writes the entries that
+// source's firstEntry()/nextEntry() visit as a snapshot of bucketCount buckets
+template<class Source> bool HashMap::writeSnapshot(const char* path, Source* source, int bucketCount)
+{
+    char* tempPath = new char[strlen(path) + sizeof(SNAPSHOT_TEMP_SUFFIX)];
+    strcpy(tempPath, path);
+    strcat(tempPath, SNAPSHOT_TEMP_SUFFIX);
+    FILE* file = fopen(tempPath, "wb");
+    if(file == NULL)
+    {
+        delete[] tempPath;
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.nodeHeaderSize = sizeof(NodeHeader);
+    header.hashCheck = hashFunction(SNAPSHOT_HASH_PROBE, strlen(SNAPSHOT_HASH_PROBE));
+    header.elementSize = sizeOfElements;
+    header.valueAlignment = valueAlignment;
+    header.numberOfBuckets = bucketCount;
+    header.bucketsOffset = sizeof(SnapshotHeader);
+
+    //nodes start on a multiple of the value alignment, so values that are
+    //aligned within their node stay aligned in the page aligned mapping
+    size_t nodeAlignment = (valueAlignment > ARENA_ALIGNMENT) ? valueAlignment : ARENA_ALIGNMENT;
+    uint64_t offset = alignOffset(header.bucketsOffset + sizeof(uint64_t)*bucketCount, nodeAlignment);
+    uint64_t* heads = new uint64_t[bucketCount]();
+    char* node = NULL;
+    size_t nodeCapacity = 0;
+    bool written = fseek(file, offset, SEEK_SET) == 0;
+
+    //each node is pushed onto the front of its bucket, as set() would
+    HashMapCursor cursor;
+    for(bool more = source->firstEntry(&cursor); more && written; more = source->nextEntry(&cursor))
+    {
+        size_t valueOffset = alignOffset(sizeof(NodeHeader) + cursor.keyLength + 1, valueAlignment);
+        size_t nodeSize = alignOffset(valueOffset + sizeOfElements, nodeAlignment);
+        if(nodeSize > nodeCapacity)
+        {
+            delete[] node;
+            nodeCapacity = nodeSize * 2;
+            node = new char[nodeCapacity];
+        }
+        memset(node, 0, nodeSize);
+
+        NodeHeader* nodeHeader = getHeaderFromNode(node);
+        uint64_t hashCode = getHeaderFromKey(cursor.key)->hashCode;
+        uint64_t* head = heads + getBucketIndex(hashCode, bucketCount);
+        nodeHeader->next = (void*)(uintptr_t)*head;
+        nodeHeader->hashCode = hashCode;
+        nodeHeader->keyLength = (uint32_t)cursor.keyLength;
+        nodeHeader->valueOffset = (uint32_t)valueOffset;
+        memcpy(getKeyFromNode(node), cursor.key, cursor.keyLength);
+        memcpy(node + valueOffset, cursor.value, sizeOfElements);
+        *head = offset;
+
+        written = fwrite(node, nodeSize, 1, file) == 1;
+        offset += nodeSize;
+        header.numberOfElements++;
+    }
+    header.fileSize = offset;
+
+    written = written && fseek(file, 0, SEEK_SET) == 0
+              && fwrite(&header, sizeof(SnapshotHeader), 1, file) == 1
+              && fwrite(heads, sizeof(uint64_t), bucketCount, file) == (size_t)bucketCount
+              && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = (fclose(file) == 0) && written;
+    written = written && rename(tempPath, path) == 0;
+    if(!written)
+        unlink(tempPath);
+
+    delete[] node;
+    delete[] heads;
+    delete[] tempPath;
+    return written;
+}
+
+///////////////////////////////////
+// HASHMAPVIEW
+///////////////////////////////////
+// copies the bucket arrays of map; the nodes they point to stay shared
+HashMapView::HashMapView(HashMap* map) : released(false)
+{
+    this->map = map;
+    numberOfBuckets = map->numberOfBuckets;
+    buckets = (void**)new char[sizeof(void**)*numberOfBuckets];
+    memcpy(buckets, map->buckets, sizeof(void**)*numberOfBuckets);
+
+    numberOfOldBuckets = map->numberOfOldBuckets;
+    rehashIndex = map->rehashIndex;
+    oldBuckets = NULL;
+    if(map->oldBuckets != NULL)
+    {
+        oldBuckets = (void**)new char[sizeof(void**)*numberOfOldBuckets];
+        memcpy(oldBuckets, map->oldBuckets, sizeof(void**)*numberOfOldBuckets);
+    }
+    numberOfElements = map->numberOfElements;
+}
+HashMapView::~HashMapView()
+{
+    delete[] (char*)buckets;
+    delete[] (char*)oldBuckets;
+}
+/**
+ * get(char* key), get(const void* key, size_t keyLength)
+ * ----------------------------------------------------------------------------
+ * Returns a pointer to the value key had when the view was taken, or NULL if
+ * it wasn't in the map then. The value must not be modified.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* HashMapView::get(char *key)
+{
+    return get(key, strlen(key));
+}
+void* HashMapView::get(const void *key, size_t keyLength)
+{
+    uint64_t keyHash = map->hashFunction(key, keyLength);
+    void* node = buckets[HashMap::getBucketIndex(keyHash, numberOfBuckets)];
+    if(oldBuckets != NULL)
+    {
+        int oldBucketNumber = HashMap::getBucketIndex(keyHash, numberOfOldBuckets);
+        if(oldBucketNumber >= rehashIndex)
+            node = oldBuckets[oldBucketNumber];
+    }
+
+    for(; node != NULL; node = *(void**)node)
+    {
+        HashMap::NodeHeader* header = HashMap::getHeaderFromNode(node);
+        if(header->hashCode == keyHash && header->keyLength == keyLength &&
+           memcmp(HashMap::getKeyFromNode(node),key,keyLength) == 0)
+            return HashMap::getValueFromNode(node);
+    }
+    return NULL;
+}
+/**
+ * getSize()
+ * ----------------------------------------------------------------------------
+ * Returns the number of elements the map had when the view was taken.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+int HashMapView::getSize()
+{
+    return numberOfElements;
+}
+/**
+ * saveSnapshot(const char* path)
+ * ----------------------------------------------------------------------------
+ * Writes the view to the file at path in the format of
+ * HashMap::saveSnapshot(), so it can be reopened with openSnapshot() or
+ * loadSnapshot(). Returns false on I/O failure.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(b + k); b = number of buckets, k = number of nodes
+ */
+bool HashMapView::saveSnapshot(const char* path)
+{
+    return map->writeSnapshot(path, this, numberOfBuckets);
+}
+/**
+ * release()
+ * ----------------------------------------------------------------------------
+ * Tells the map that the view is no longer used. The view (and any pointer
+ * it returned) must not be touched afterwards; the map frees it, and the
+ * nodes and values retired for it, on its next mutation or openView().
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+void HashMapView::release()
+{
+    released.store(true, std::memory_order_release);
+}
+/**
+ * firstEntry(HashMapCursor* cursor), nextEntry(HashMapCursor* cursor)
+ * ----------------------------------------------------------------------------
+ * Cursor based iteration over the view, as with HashMap::firstEntry() and
+ * HashMap::nextEntry(), including nextEntry() returning false again once the
+ * iteration is over. Unlike the map's own iteration, the map may be
+ * modified while the view is being iterated.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool HashMapView::firstEntry(HashMapCursor* cursor)
+{
+    return seekFrom(cursor, rehashIndex);
+}
+bool HashMapView::nextEntry(HashMapCursor* cursor)
+{
+    if(cursor->node == NULL) //the iteration is already over
+        return false;
+    void* next = *(void**)cursor->node;
+    if(next != NULL)
+    {
+        map->setCursor(cursor, next, cursor->bucket);
+        return true;
+    }
+    return seekFrom(cursor, cursor->bucket + 1);
+}
+// points cursor at the first node at or after position, counting the old
+// buckets first as HashMap::seekFrom() does; returns false at the end
+bool HashMapView::seekFrom(HashMapCursor* cursor, int position)
+{
+    for(; position < numberOfOldBuckets; position++)
+        if(oldBuckets[position] != NULL)
+        {
+            map->setCursor(cursor, oldBuckets[position], position);
+            return true;
+        }
+
+    for(int x = position - numberOfOldBuckets; x < numberOfBuckets; x++)
+        if(buckets[x] != NULL)
+        {
+            map->setCursor(cursor, buckets[x], numberOfOldBuckets + x);
+            return true;
+        }
+
+    map->setCursor(cursor, NULL, numberOfOldBuckets + numberOfBuckets);
+    return false;
+}
+
+//the separate chaining engine, even when "HashMap" names another engine
+typedef HashMap ChainedHashMap;
+
+//build with HASHMAP_SWISS_ENGINE to run HashMap clients on the open addressing
+//engine in swisstable.h
+#ifdef HASHMAP_SWISS_ENGINE
+#include "swisstable.h"
+#define HashMap SwissHashMap
+#endif
 
 #endif
@@ -1,7 +1,535 @@
 %module hashmap
 
+// uint64_t results such as getModificationCount() come back as Python ints
+%include "stdint.i"
+
+// what hashmap_entries() collects for each entry; wrapped as well, so the
+// Python iteration code passes the same constants
+%inline %{
+enum { HASHMAP_KEYS, HASHMAP_VALUES, HASHMAP_ITEMS };
+%}
+
+// this block is copied into the wrapper verbatim, so it uses plain #if; the
+// %#if form is only for directives SWIG itself should pass through
 %{
 #include "hashmap.h"
+#include "concurrenthashmap.h"
+
+// returns the UTF-8 contents of a Python str, borrowed from the object
+static char *hashmap_key_from_object(PyObject *obj)
+{
+#if PY_VERSION_HEX >= 0x03000000
+    return PyUnicode_Check(obj) ? (char *)PyUnicode_AsUTF8(obj) : NULL;
+#else
+    return PyString_Check(obj) ? PyString_AsString(obj) : NULL;
+#endif
+}
+
+// points key and keyLength at the bytes of a str (UTF-8) or bytes key,
+// borrowed from obj; returns false with a Python exception set otherwise
+static bool hashmap_parse_key(PyObject *obj, const char **key, size_t *keyLength)
+{
+    char *bytes = NULL;
+    Py_ssize_t length = 0;
+    if (PyBytes_Check(obj)) {
+        PyBytes_AsStringAndSize(obj, &bytes, &length);
+#if PY_VERSION_HEX >= 0x03000000
+    } else if (PyUnicode_Check(obj)) {
+        bytes = (char *)PyUnicode_AsUTF8AndSize(obj, &length);
+        if (bytes == NULL)
+            return false;
+#endif
+    } else {
+        PyErr_SetString(PyExc_TypeError, "keys must be str or bytes");
+        return false;
+    }
+    *key = bytes;
+    *keyLength = (size_t)length;
+    return true;
+}
+
+// returns a key read back from the map as str, or as bytes if it isn't UTF-8
+static PyObject *hashmap_key_to_object(const char *key, size_t keyLength)
+{
+#if PY_VERSION_HEX >= 0x03000000
+    PyObject *obj = PyUnicode_DecodeUTF8(key, (Py_ssize_t)keyLength, NULL);
+    if (obj != NULL)
+        return obj;
+    PyErr_Clear();
+#endif
+    return PyBytes_FromStringAndSize(key, (Py_ssize_t)keyLength);
+}
+
+// the keys of a bulk call: either a list or tuple of str or bytes keys, or a
+// bytes-like buffer of keys keyWidth bytes wide. data and lengths borrow from
+// the Python objects, which stay referenced until hashmap_release_keys().
+struct hashmap_keys {
+    Py_ssize_t count;
+    const char **data;
+    size_t *lengths;
+    PyObject *sequence;
+    Py_buffer buffer;
+    bool hasBuffer;
+};
+
+static void hashmap_release_keys(hashmap_keys *keys)
+{
+    free(keys->data);
+    free(keys->lengths);
+    Py_XDECREF(keys->sequence);
+    if (keys->hasBuffer)
+        PyBuffer_Release(&keys->buffer);
+}
+
+// fills in keys from obj; returns false with a Python exception set on error.
+// A str, which would be split into one key per character, or a bytes without
+// a keyWidth is taken to be a single key passed by mistake
+static bool hashmap_parse_keys(PyObject *obj, long keyWidth, hashmap_keys *keys)
+{
+    memset(keys, 0, sizeof(hashmap_keys));
+    if (PyUnicode_Check(obj) || (PyBytes_Check(obj) && keyWidth <= 0)) {
+        PyErr_SetString(PyExc_TypeError, "keys must be a list or tuple of keys, or a buffer of keys with a keyWidth, not a single key");
+        return false;
+    }
+    if (PyObject_CheckBuffer(obj)) {
+        if (keyWidth <= 0) {
+            PyErr_SetString(PyExc_ValueError, "a buffer of keys needs a positive keyWidth");
+            return false;
+        }
+        if (PyObject_GetBuffer(obj, &keys->buffer, PyBUF_SIMPLE) < 0)
+            return false;
+        keys->hasBuffer = true;
+        if (keys->buffer.len % keyWidth != 0) {
+            PyErr_SetString(PyExc_ValueError, "the key buffer isn't a whole number of keys");
+            return false;
+        }
+        keys->count = keys->buffer.len / keyWidth;
+    } else {
+        keys->sequence = PySequence_Fast(obj, "keys must be a list, tuple or bytes-like buffer");
+        if (keys->sequence == NULL)
+            return false;
+        keys->count = PySequence_Fast_GET_SIZE(keys->sequence);
+    }
+
+    keys->data = (const char **)malloc(sizeof(char *) * (keys->count + 1));
+    keys->lengths = (size_t *)malloc(sizeof(size_t) * (keys->count + 1));
+    if (keys->data == NULL || keys->lengths == NULL) {
+        PyErr_NoMemory();
+        return false;
+    }
+    for (Py_ssize_t i = 0; i < keys->count; i++) {
+        if (keys->hasBuffer) {
+            keys->data[i] = (const char *)keys->buffer.buf + i * keyWidth;
+            keys->lengths[i] = (size_t)keyWidth;
+            continue;
+        }
+        if (!hashmap_parse_key(PySequence_Fast_GET_ITEM(keys->sequence, i), &keys->data[i], &keys->lengths[i]))
+            return false;
+    }
+    return true;
+}
+
+// the values of a setMany(): count values of elementSize bytes, packed back
+// to back. data points into a bytes-like buffer, or into a copy of a list or
+// tuple of bytes values.
+struct hashmap_values {
+    char *data;
+    char *copy;
+    Py_buffer buffer;
+    bool hasBuffer;
+};
+
+static void hashmap_release_values(hashmap_values *values)
+{
+    free(values->copy);
+    if (values->hasBuffer)
+        PyBuffer_Release(&values->buffer);
+}
+
+// fills in values from obj; returns false with a Python exception set on error
+static bool hashmap_parse_values(PyObject *obj, Py_ssize_t count, int elementSize, hashmap_values *values)
+{
+    memset(values, 0, sizeof(hashmap_values));
+    if (PyObject_CheckBuffer(obj)) {
+        if (PyObject_GetBuffer(obj, &values->buffer, PyBUF_SIMPLE) < 0)
+            return false;
+        values->hasBuffer = true;
+        if (values->buffer.len != count * elementSize) {
+            PyErr_SetString(PyExc_ValueError, "the value buffer must hold one value per key");
+            return false;
+        }
+        values->data = (char *)values->buffer.buf;
+        return true;
+    }
+
+    PyObject *sequence = PySequence_Fast(obj, "values must be a list, tuple or bytes-like buffer");
+    if (sequence == NULL)
+        return false;
+    bool parsed = PySequence_Fast_GET_SIZE(sequence) == count;
+    if (!parsed) {
+        PyErr_SetString(PyExc_ValueError, "there must be one value per key");
+    } else if ((values->copy = (char *)malloc(count * elementSize + 1)) == NULL) {
+        PyErr_NoMemory();
+        parsed = false;
+    }
+    for (Py_ssize_t i = 0; parsed && i < count; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(sequence, i);
+        if (!PyBytes_Check(item) || PyBytes_GET_SIZE(item) != elementSize) {
+            PyErr_SetString(PyExc_ValueError, "values must be bytes of the map's element size");
+            parsed = false;
+        } else {
+            memcpy(values->copy + i * elementSize, PyBytes_AS_STRING(item), elementSize);
+        }
+    }
+    Py_DECREF(sequence);
+    values->data = values->copy;
+    return parsed;
+}
+
+// copies the value of key into out; ConcurrentHashMap::get() already copies
+// under the shard lock
+static bool hashmap_copy_value(HashMap *map, const char *key, size_t keyLength, void *out)
+{
+    void *value = map->get(key, keyLength);
+    if (value != NULL)
+        memcpy(out, value, map->getElementSize());
+    return value != NULL;
+}
+static bool hashmap_copy_value(ConcurrentHashMap *map, const char *key, size_t keyLength, void *out)
+{
+    return map->get(key, keyLength, out);
+}
+
+// the bulk methods below convert their arguments while holding the GIL and
+// release it for the loop over the map, so other Python threads run while
+// the keys are hashed and probed
+
+// stores every key/value pair, returning the number stored
+template<class Map> static PyObject *hashmap_set_many(Map *map, PyObject *keyObject, PyObject *valueObject, long keyWidth)
+{
+    hashmap_keys keys;
+    hashmap_values values;
+    int elementSize = map->getElementSize();
+    memset(&values, 0, sizeof(hashmap_values));
+    bool parsed = hashmap_parse_keys(keyObject, keyWidth, &keys);
+    parsed = parsed && hashmap_parse_values(valueObject, keys.count, elementSize, &values);
+    if (!parsed) {
+        hashmap_release_keys(&keys);
+        hashmap_release_values(&values);
+        return NULL;
+    }
+
+    Py_ssize_t stored = 0;
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < keys.count; i++)
+        stored += map->set(keys.data[i], keys.lengths[i], values.data + i * elementSize) ? 1 : 0;
+    Py_END_ALLOW_THREADS
+
+    hashmap_release_keys(&keys);
+    hashmap_release_values(&values);
+    return PyLong_FromSsize_t(stored);
+}
+
+// returns a list holding a bytes copy of each key's value, or None for keys
+// that aren't in the map
+template<class Map> static PyObject *hashmap_get_many_bytes(Map *map, PyObject *keyObject, long keyWidth)
+{
+    hashmap_keys keys;
+    if (!hashmap_parse_keys(keyObject, keyWidth, &keys)) {
+        hashmap_release_keys(&keys);
+        return NULL;
+    }
+    int elementSize = map->getElementSize();
+    char *out = (char *)malloc(keys.count * (elementSize + 1) + 1);
+    if (out == NULL) {
+        hashmap_release_keys(&keys);
+        return PyErr_NoMemory();
+    }
+    char *found = out + keys.count * elementSize;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < keys.count; i++)
+        found[i] = hashmap_copy_value(map, keys.data[i], keys.lengths[i], out + i * elementSize);
+    Py_END_ALLOW_THREADS
+
+    PyObject *list = PyList_New(keys.count);
+    for (Py_ssize_t i = 0; list != NULL && i < keys.count; i++) {
+        PyObject *value = Py_None;
+        if (found[i])
+            value = PyBytes_FromStringAndSize(out + i * elementSize, elementSize);
+        else
+            Py_INCREF(Py_None);
+        if (value == NULL)
+            Py_CLEAR(list);
+        else
+            PyList_SET_ITEM(list, i, value);
+    }
+    free(out);
+    hashmap_release_keys(&keys);
+    return list;
+}
+
+// returns the value of key as bytes, raising KeyError if it isn't in the map
+static PyObject *hashmap_get_item(HashMap *map, PyObject *keyObject)
+{
+    const char *key;
+    size_t keyLength;
+    if (!hashmap_parse_key(keyObject, &key, &keyLength))
+        return NULL;
+    void *value = map->get(key, keyLength);
+    if (value == NULL) {
+        PyErr_SetObject(PyExc_KeyError, keyObject);
+        return NULL;
+    }
+    return PyBytes_FromStringAndSize((char *)value, map->getElementSize());
+}
+
+// stores a copy of a bytes-like value of the map's element size under key
+static PyObject *hashmap_set_item(HashMap *map, PyObject *keyObject, PyObject *valueObject)
+{
+    const char *key;
+    size_t keyLength;
+    Py_buffer value;
+    if (!hashmap_parse_key(keyObject, &key, &keyLength))
+        return NULL;
+    if (PyObject_GetBuffer(valueObject, &value, PyBUF_SIMPLE) < 0)
+        return NULL;
+    bool stored = false;
+    if (value.len != map->getElementSize())
+        PyErr_SetString(PyExc_ValueError, "values must be bytes of the map's element size");
+    else if (!(stored = map->set(key, keyLength, value.buf)))
+        PyErr_NoMemory();
+    PyBuffer_Release(&value);
+    if (!stored)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+// removes key, raising KeyError if it isn't in the map
+static PyObject *hashmap_del_item(HashMap *map, PyObject *keyObject)
+{
+    const char *key;
+    size_t keyLength;
+    if (!hashmap_parse_key(keyObject, &key, &keyLength))
+        return NULL;
+    if (map->remove(key, keyLength) == NULL) {
+        PyErr_SetObject(PyExc_KeyError, keyObject);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// returns a list of up to batchSize keys, values or (key, value) tuples,
+// starting at the first entry of the map if first is set and at the entry
+// under cursor otherwise, and leaves cursor on the entry after the last one
+// returned. The cursor walks the buckets directly, so no key is rehashed; an
+// empty list means the iteration is over.
+static PyObject *hashmap_entries(HashMap *map, HashMapCursor *cursor, bool first, int kind, int batchSize)
+{
+    PyObject *list = PyList_New(0);
+    bool more = first ? map->firstEntry(cursor) : cursor->key != NULL;
+    for (int count = 0; list != NULL && more && count < batchSize; count++) {
+        PyObject *entry = NULL;
+        if (kind == HASHMAP_KEYS) {
+            entry = hashmap_key_to_object(cursor->key, cursor->keyLength);
+        } else if (kind == HASHMAP_VALUES) {
+            entry = PyBytes_FromStringAndSize((char *)cursor->value, map->getElementSize());
+        } else {
+            PyObject *key = hashmap_key_to_object(cursor->key, cursor->keyLength);
+            PyObject *value = PyBytes_FromStringAndSize((char *)cursor->value, map->getElementSize());
+            if (key != NULL && value != NULL)
+                entry = PyTuple_Pack(2, key, value);
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+        }
+
+        if (entry == NULL || PyList_Append(list, entry) < 0)
+            Py_CLEAR(list);
+        Py_XDECREF(entry);
+        more = map->nextEntry(cursor);
+    }
+    return list;
+}
+
+// removes every key, returning the number that were in the map
+template<class Map> static PyObject *hashmap_remove_many(Map *map, PyObject *keyObject, long keyWidth)
+{
+    hashmap_keys keys;
+    if (!hashmap_parse_keys(keyObject, keyWidth, &keys)) {
+        hashmap_release_keys(&keys);
+        return NULL;
+    }
+    Py_ssize_t removed = 0;
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < keys.count; i++)
+        removed += map->remove(keys.data[i], keys.lengths[i]) ? 1 : 0;
+    Py_END_ALLOW_THREADS
+    hashmap_release_keys(&keys);
+    return PyLong_FromSsize_t(removed);
+}
 %}
 
-%include "hashmap.h"
\ No newline at end of file
+// nested classes aren't wrapped; Python code iterates with a HashMapCursor
+// and firstEntry/nextEntry instead
+%ignore HashMap::iterator;
+%ignore HashMap::begin;
+%ignore HashMap::end;
+
+// getMany takes a sequence of str keys and returns a list holding each value
+// pointer, or None for keys that aren't in the map, in a single call
+%typemap(in) (char **keys, int n, void **outPtrs) (PyObject *sequence = NULL) {
+    sequence = PySequence_Fast($input, "getMany expects a sequence of str keys");
+    if (sequence == NULL)
+        SWIG_fail;
+    $2 = (int)PySequence_Fast_GET_SIZE(sequence);
+    $1 = (char **)malloc(sizeof(char *) * ($2 + 1));
+    $3 = (void **)malloc(sizeof(void *) * ($2 + 1));
+    for (int i = 0; i < $2; i++) {
+        $1[i] = hashmap_key_from_object(PySequence_Fast_GET_ITEM(sequence, i));
+        if ($1[i] == NULL) {
+            PyErr_SetString(PyExc_TypeError, "getMany keys must be str");
+            SWIG_fail;
+        }
+    }
+}
+%typemap(argout) (char **keys, int n, void **outPtrs) {
+    PyObject *values = PyList_New($2);
+    for (int i = 0; i < $2; i++) {
+        if ($3[i] != NULL) {
+            PyList_SET_ITEM(values, i, SWIG_NewPointerObj($3[i], SWIGTYPE_p_void, 0));
+        } else {
+            Py_INCREF(Py_None);
+            PyList_SET_ITEM(values, i, Py_None);
+        }
+    }
+    Py_DECREF($result);
+    $result = values;
+}
+%typemap(freearg) (char **keys, int n, void **outPtrs) {
+    free($1);
+    free($3);
+    Py_XDECREF(sequence$argnum);
+}
+
+// the (const void *key, size_t keyLength) overloads take a Python bytes key
+// and pass its internal buffer and size straight through, so binary keys
+// reach the map without being copied or re-encoded; str keys still select
+// the char * overloads
+%typemap(in) (const void *key, size_t keyLength) (char *buffer = NULL, Py_ssize_t size = 0) {
+    if (PyBytes_AsStringAndSize($input, &buffer, &size) < 0)
+        SWIG_fail;
+    $1 = (const void *)buffer;
+    $2 = (size_t)size;
+}
+%typemap(typecheck, precedence=SWIG_TYPECHECK_STRING) (const void *key, size_t keyLength) {
+    $1 = PyBytes_Check($input) ? 1 : 0;
+}
+
+// the current key of a cursor as bytes, keeping any zero bytes in it
+%extend HashMapCursor {
+    PyObject *keyBytes() {
+        if ($self->key == NULL)
+            Py_RETURN_NONE;
+        return PyBytes_FromStringAndSize($self->key, (Py_ssize_t)$self->keyLength);
+    }
+}
+
+// setMany(keys, values[, keyWidth]), getManyBytes(keys[, keyWidth]) and
+// removeMany(keys[, keyWidth]) apply one operation to many keys in a single
+// call. keys is a list or tuple of str/bytes keys, or a bytes-like buffer of
+// keys that are all keyWidth bytes long (a lone str or bytes key raises
+// TypeError rather than being split up); values is a bytes-like buffer of
+// one value per key back to back, or a list or tuple of bytes values, each
+// of the map's element size. The GIL is released while the map is searched,
+// so Python threads can work in parallel on a ConcurrentHashMap, or on
+// separate HashMaps (a HashMap must never be used by two threads at once).
+%define HASHMAP_BULK_METHODS(MAP)
+%extend MAP {
+    PyObject *setMany(PyObject *keys, PyObject *values, long keyWidth = 0) {
+        return hashmap_set_many($self, keys, values, keyWidth);
+    }
+    PyObject *getManyBytes(PyObject *keys, long keyWidth = 0) {
+        return hashmap_get_many_bytes($self, keys, keyWidth);
+    }
+    PyObject *removeMany(PyObject *keys, long keyWidth = 0) {
+        return hashmap_remove_many($self, keys, keyWidth);
+    }
+}
+%enddef
+HASHMAP_BULK_METHODS(HashMap)
+HASHMAP_BULK_METHODS(ConcurrentHashMap)
+
+// the Python mapping protocol: map[key] returns a bytes copy of the value,
+// map[key] = value stores a bytes-like value of the element size, and del,
+// len() and "in" work as they do on a dict. Keys may be str or bytes;
+// iteration yields str keys, or bytes for keys that aren't valid UTF-8.
+// Iterating walks a HashMapCursor in C and hands entries to Python a batch at
+// a time. The entries are copies, so changing the map can't corrupt them, but
+// as with a dict the iteration then raises RuntimeError (at the start of the
+// next batch). An iteration that stops early ends its cursor, so get() goes
+// back to moving buckets for an in-progress rehash.
+%extend HashMap {
+    PyObject *__getitem__(PyObject *key) {
+        return hashmap_get_item($self, key);
+    }
+    PyObject *__setitem__(PyObject *key, PyObject *value) {
+        return hashmap_set_item($self, key, value);
+    }
+    PyObject *__delitem__(PyObject *key) {
+        return hashmap_del_item($self, key);
+    }
+    int __len__() {
+        return $self->getSize();
+    }
+    PyObject *__contains__(PyObject *key) {
+        const char *bytes;
+        size_t length;
+        if (!hashmap_parse_key(key, &bytes, &length))
+            return NULL;
+        return PyBool_FromLong($self->get(bytes, length) != NULL);
+    }
+    PyObject *_entries(HashMapCursor *cursor, bool first, int kind, int batchSize) {
+        return hashmap_entries($self, cursor, first, kind, batchSize);
+    }
+%pythoncode %{
+    _ITERATION_BATCH = 256
+
+    def _batches(self, kind):
+        cursor = HashMapCursor()
+        modifications = self.getModificationCount()
+        try:
+            batch = self._entries(cursor, True, kind, self._ITERATION_BATCH)
+            while batch:
+                yield batch
+                if self.getModificationCount() != modifications:
+                    raise RuntimeError("HashMap changed during iteration")
+                batch = self._entries(cursor, False, kind, self._ITERATION_BATCH)
+        finally:
+            # a change has already ended every iteration, this one included
+            if self.getModificationCount() == modifications:
+                self.endIteration(cursor)
+
+    def __iter__(self):
+        return itertools.chain.from_iterable(self._batches(HASHMAP_KEYS))
+
+    def keys(self):
+        return list(self.__iter__())
+
+    def values(self):
+        return list(itertools.chain.from_iterable(self._batches(HASHMAP_VALUES)))
+
+    def items(self):
+        return list(itertools.chain.from_iterable(self._batches(HASHMAP_ITEMS)))
+%}
+}
+
+%pythoncode %{
+import itertools
+%}
+
+// the wrappers only need the declarations; the alignment of the private
+// Shard struct is the compiler's business, so SWIG's parser never sees it
+#define alignas(x)
+
+%include "hashmap.h"
+%include "concurrenthashmap.h"
@@ -0,0 +1,890 @@
+/* -------------------------------------------------------------------------- *
+ *                               HashMapBench                                 *
+ * -------------------------------------------------------------------------- *
+ * Benchmarks HashMap, SwissHashMap, ConcurrentHashMap and                    *
+ * std::unordered_map (as a baseline) on set, get-hit, get-miss, remove,      *
+ * iteration and mixed workloads while sweeping key length, value size,       *
+ * maximum load factor and the number of keys, from tables that fit in L1 to  *
+ * tables far larger than the last level cache. Every run is reported as      *
+ * ns/op, throughput and latency percentiles in JSON (the default) or CSV, so *
+ * results can be diffed between releases:                                    *
+ *                                                                            *
+ *     hashmap_bench [--format json|csv] [--output path] [--quick]            *
+ *                   [--max-keys n] [--engines chained,swiss,...]             *
+ *                                                                            *
+ * With --ycsb the engines run YCSB style workloads instead (see workload.h), *
+ * reporting a latency histogram per operation type:                          *
+ *                                                                            *
+ *     hashmap_bench --ycsb a,b,c,d,e,f [--records n] [--operations n]        *
+ *                   [--distribution uniform|zipfian|latest|hotspot]          *
+ *                   [--theta t] [--hot-fraction f] [--hot-operations f]      *
+ *                   [--mix read=r,update=u,insert=i,scan=s,rmw=m]            *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "hashmap.h"
+#include "swisstable.h"
+#include "concurrenthashmap.h"
+#include "workload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+namespace{ //local namespace variables
+    const int TIMING_BATCH = 32; //ops timed together; percentiles are of per-batch ns/op
+    const int MIN_LOOKUPS = 1 << 20; //get workloads run at least this many lookups
+    const uint32_t RANDOM_SEED = 0x6b706362; //fixed, so every run sees the same keys and order
+
+    //the sweep: every dimension is varied on its own around the baseline
+    const int BASE_KEY_LENGTH = 16;
+    const int BASE_VALUE_SIZE = 8;
+    const float BASE_MAX_LOAD = 1.0;
+    const int BASE_KEYS = 1 << 16;
+    const int KEY_LENGTHS[] = {8, 16, 32, 64, 128};
+    const int VALUE_SIZES[] = {8, 32, 128, 512};
+    const float MAX_LOADS[] = {0.5, 0.75, 1.0, 2.0};
+    const int KEY_COUNTS[] = {1 << 8, 1 << 12, 1 << 16, 1 << 20, 1 << 22};
+    const int QUICK_KEY_COUNTS[] = {1 << 8, 1 << 12, 1 << 16};
+
+    //YCSB mode defaults: 24 byte keys like YCSB's "user..." keys
+    const long YCSB_RECORDS = 1 << 20;
+    const long YCSB_OPERATIONS = 1 << 20;
+    const long QUICK_YCSB_RECORDS = 1 << 16;
+    const long QUICK_YCSB_OPERATIONS = 1 << 16;
+    const int YCSB_KEY_LENGTH = 24;
+    const int YCSB_VALUE_SIZE = 100;
+    const int YCSB_SAMPLE_PERIOD = 16; //one operation in this many is timed into the histograms
+
+    volatile uint64_t sink; //keeps lookups from being optimized away
+}
+
+///////////////////////////////////
+// ENGINES
+///////////////////////////////////
+// Every engine is wrapped in the same small interface so the workloads can
+// be written once. Keys are raw bytes of a fixed length; values are
+// valueSize bytes. getMaxLoadFactor() reports the maximum load factor the
+// engine actually uses, which may not be the one it was given.
+
+//the separate chaining HashMap
+class ChainedEngine{
+public:
+    ChainedEngine(int valueSize, float maxLoad) : map(0, valueSize, NULL, maxLoad) {}
+    static const char* name() { return "chained"; }
+    static bool canIterate() { return true; }
+    bool set(const char* key, size_t keyLength, const char* value) { return map.set(key, keyLength, (void*)value); }
+    const char* get(const char* key, size_t keyLength) { return (const char*)map.get(key, keyLength); }
+    bool remove(const char* key, size_t keyLength) { return map.remove(key, keyLength) != NULL; }
+    float getMaxLoadFactor() { return map.getMaxLoadFactor(); }
+    uint64_t iterate()
+    {
+        uint64_t checksum = 0;
+        for(HashMapCursor& entry : map)
+            checksum += *(unsigned char*)entry.value;
+        return checksum;
+    }
+private:
+    ChainedHashMap map;
+};
+
+//the open addressing SwissHashMap
+class SwissEngine{
+public:
+    SwissEngine(int valueSize, float maxLoad) : map(0, valueSize, NULL, maxLoad) {}
+    static const char* name() { return "swiss"; }
+    static bool canIterate() { return true; }
+    bool set(const char* key, size_t keyLength, const char* value) { return map.set(key, keyLength, (void*)value); }
+    const char* get(const char* key, size_t keyLength) { return (const char*)map.get(key, keyLength); }
+    bool remove(const char* key, size_t keyLength) { return map.remove(key, keyLength) != NULL; }
+    float getMaxLoadFactor() { return map.getMaxLoadFactor(); }
+    uint64_t iterate()
+    {
+        uint64_t checksum = 0;
+        for(HashMapCursor& entry : map)
+            checksum += *(unsigned char*)entry.value;
+        return checksum;
+    }
+private:
+    SwissHashMap map;
+};
+
+//ConcurrentHashMap, paying for its shard locks on a single thread; get()
+//copies the value out, as ConcurrentHashMap::get() does
+class ConcurrentEngine{
+public:
+    ConcurrentEngine(int valueSize, float) : map(0, valueSize), value(valueSize) {} //shards always grow at the default load
+    static const char* name() { return "concurrent"; }
+    static bool canIterate() { return false; } //ConcurrentHashMap has no iteration
+    bool set(const char* key, size_t keyLength, const char* value) { return map.set(key, keyLength, (void*)value); }
+    const char* get(const char* key, size_t keyLength) { return map.get(key, keyLength, value.data()) ? value.data() : NULL; }
+    bool remove(const char* key, size_t keyLength) { return map.remove(key, keyLength); }
+    float getMaxLoadFactor() { return DEFAULT_MAX_LOAD_FACTOR; } //every shard grows at the default
+    uint64_t iterate() { return 0; }
+private:
+    ConcurrentHashMap map;
+    vector<char> value;
+};
+
+//std::unordered_map<std::string, std::string>, the baseline
+class UnorderedEngine{
+public:
+    UnorderedEngine(int valueSize, float maxLoad) : valueSize(valueSize) { map.max_load_factor(maxLoad); }
+    static const char* name() { return "unordered_map"; }
+    static bool canIterate() { return true; }
+    bool set(const char* key, size_t keyLength, const char* value)
+    {
+        map[string(key, keyLength)].assign(value, valueSize);
+        return true;
+    }
+    const char* get(const char* key, size_t keyLength)
+    {
+        unordered_map<string, string>::iterator found = map.find(string(key, keyLength));
+        return (found != map.end()) ? found->second.data() : NULL;
+    }
+    bool remove(const char* key, size_t keyLength) { return map.erase(string(key, keyLength)) > 0; }
+    float getMaxLoadFactor() { return map.max_load_factor(); }
+    uint64_t iterate()
+    {
+        uint64_t checksum = 0;
+        for(unordered_map<string, string>::iterator entry = map.begin(); entry != map.end(); ++entry)
+            checksum += (unsigned char)entry->second[0];
+        return checksum;
+    }
+private:
+    unordered_map<string, string> map;
+    int valueSize;
+};
+
+///////////////////////////////////
+// MEASUREMENT
+///////////////////////////////////
+//one benchmark configuration
+struct BenchConfig{
+    int keyLength;
+    int valueSize;
+    float maxLoad;
+    int keys;
+};
+
+//the result of one workload on one engine
+struct BenchResult{
+    string engine;
+    string workload;
+    BenchConfig config;
+    long ops;
+    double nsPerOp;
+    double opsPerSecond;
+    double p50, p90, p99, p999; //ns/op of the TIMING_BATCH op batches
+};
+
+//the keys and values every workload of a configuration draws from: keys[i]
+//is present in the map, misses[i] never is, and order is a random
+//permutation of the keys
+struct BenchData{
+    int keyLength;
+    int count;
+    vector<char> keys;
+    vector<char> misses;
+    vector<char> value;
+    vector<int> order;
+    const char* key(int i) const { return &keys[(size_t)i * keyLength]; }
+    const char* miss(int i) const { return &misses[(size_t)i * keyLength]; }
+};
+
+/**
+ * makeKey(char* out, int keyLength, uint64_t id, char prefix)
+ * ----------------------------------------------------------------------------
+ * Writes a key of exactly keyLength bytes for id: prefix, the decimal id and
+ * then filler bytes derived from id, so long keys still differ throughout.
+ */
+void makeKey(char* out, int keyLength, uint64_t id, char prefix)
+{
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%c%llu", prefix, (unsigned long long)id);
+    for(int x = 0; x < keyLength; x++)
+        out[x] = (x < length) ? digits[x] : (char)('a' + (id * 31 + x * 7) % 26);
+}
+/**
+ * makeData(int keyLength, int valueSize, int count)
+ * ----------------------------------------------------------------------------
+ * Builds the keys, missing keys, value and random access order of a
+ * configuration.
+ */
+BenchData makeData(int keyLength, int valueSize, int count)
+{
+    BenchData data;
+    data.keyLength = keyLength;
+    data.count = count;
+    data.keys.resize((size_t)count * keyLength);
+    data.misses.resize((size_t)count * keyLength);
+    for(int x = 0; x < count; x++)
+    {
+        makeKey(&data.keys[(size_t)x * keyLength], keyLength, x, 'k');
+        makeKey(&data.misses[(size_t)x * keyLength], keyLength, x, 'm');
+    }
+    data.value.assign(valueSize, 'v');
+    data.order.resize(count);
+    for(int x = 0; x < count; x++)
+        data.order[x] = x;
+    shuffle(data.order.begin(), data.order.end(), mt19937(RANDOM_SEED));
+    return data;
+}
+/**
+ * OpTimer
+ * ----------------------------------------------------------------------------
+ * Times a workload in batches of TIMING_BATCH ops: reading the clock around
+ * every op would cost as much as the op itself, so the percentiles describe
+ * the ns/op of each batch rather than of single ops.
+ */
+class OpTimer{
+public:
+    OpTimer(long expectedOps) : ops(0), totalNs(0) { batches.reserve(expectedOps / TIMING_BATCH + 1); }
+    void start() { batchStart = chrono::steady_clock::now(); }
+    void stop(int opsInBatch)
+    {
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - batchStart).count();
+        totalNs += ns;
+        ops += opsInBatch;
+        batches.push_back(ns / opsInBatch);
+    }
+    BenchResult result(const char* engine, const char* workload, const BenchConfig& config)
+    {
+        BenchResult result;
+        result.engine = engine;
+        result.workload = workload;
+        result.config = config;
+        result.ops = ops;
+        result.nsPerOp = (ops > 0) ? totalNs / ops : 0;
+        result.opsPerSecond = (totalNs > 0) ? ops * 1e9 / totalNs : 0;
+        sort(batches.begin(), batches.end());
+        result.p50 = percentile(0.50);
+        result.p90 = percentile(0.90);
+        result.p99 = percentile(0.99);
+        result.p999 = percentile(0.999);
+        return result;
+    }
+private:
+    double percentile(double fraction)
+    {
+        if(batches.empty())
+            return 0;
+        size_t index = (size_t)(fraction * (batches.size() - 1) + 0.5);
+        return batches[index];
+    }
+    chrono::steady_clock::time_point batchStart;
+    vector<double> batches;
+    long ops;
+    double totalNs;
+};
+
+///////////////////////////////////
+// WORKLOADS
+///////////////////////////////////
+/**
+ * runWorkloads(BenchConfig config, const BenchData& data, vector<BenchResult>* results)
+ * ----------------------------------------------------------------------------
+ * Runs every workload against a fresh Engine:
+ *   set      inserts every key into an empty map (growing it as it goes)
+ *   get-hit  looks up present keys in random order
+ *   get-miss looks up keys that were never inserted
+ *   iterate  visits every entry; ops are entries (skipped by engines that
+ *            can't iterate)
+ *   mixed    80% get-hit, 10% update, 10% remove or re-insert of a key
+ *   remove   removes every key in random order
+ */
+template<class Engine> void runWorkloads(const BenchConfig& config, const BenchData& data, vector<BenchResult>* results)
+{
+    const char* value = data.value.data();
+    size_t keyLength = config.keyLength;
+    int keys = config.keys;
+    long lookups = (keys > MIN_LOOKUPS) ? keys : MIN_LOOKUPS;
+    Engine engine(config.valueSize, config.maxLoad);
+    BenchConfig used = config; //reported with the load factor the engine settled on
+    used.maxLoad = engine.getMaxLoadFactor();
+    uint64_t checksum = 0;
+
+    OpTimer setTimer(keys);
+    for(int start = 0; start < keys; start += TIMING_BATCH)
+    {
+        int end = min(start + TIMING_BATCH, keys);
+        setTimer.start();
+        for(int x = start; x < end; x++)
+            engine.set(data.key(x), keyLength, value);
+        setTimer.stop(end - start);
+    }
+    results->push_back(setTimer.result(Engine::name(), "set", used));
+
+    OpTimer hitTimer(lookups);
+    for(long start = 0; start < lookups; start += TIMING_BATCH)
+    {
+        long end = min(start + TIMING_BATCH, lookups);
+        hitTimer.start();
+        for(long x = start; x < end; x++)
+            checksum += *(const unsigned char*)engine.get(data.key(data.order[x % keys]), keyLength);
+        hitTimer.stop(end - start);
+    }
+    results->push_back(hitTimer.result(Engine::name(), "get-hit", used));
+
+    OpTimer missTimer(lookups);
+    for(long start = 0; start < lookups; start += TIMING_BATCH)
+    {
+        long end = min(start + TIMING_BATCH, lookups);
+        missTimer.start();
+        for(long x = start; x < end; x++)
+            checksum += engine.get(data.miss(data.order[x % keys]), keyLength) == NULL;
+        missTimer.stop(end - start);
+    }
+    results->push_back(missTimer.result(Engine::name(), "get-miss", used));
+
+    if(Engine::canIterate())
+    {
+        OpTimer iterateTimer(1);
+        iterateTimer.start();
+        checksum += engine.iterate();
+        iterateTimer.stop(keys);
+        results->push_back(iterateTimer.result(Engine::name(), "iterate", used));
+    }
+
+    //a key is removed and re-inserted in turn, so the map stays near full size
+    vector<char> present(keys, 1);
+    mt19937 generator(RANDOM_SEED);
+    OpTimer mixedTimer(lookups);
+    for(long start = 0; start < lookups; start += TIMING_BATCH)
+    {
+        long end = min(start + TIMING_BATCH, lookups);
+        mixedTimer.start();
+        for(long x = start; x < end; x++)
+        {
+            int index = data.order[x % keys];
+            uint32_t dice = generator() % 10;
+            if(dice < 8)
+                checksum += engine.get(data.key(index), keyLength) != NULL;
+            else if(dice == 8 || !present[index])
+            {
+                engine.set(data.key(index), keyLength, value);
+                present[index] = 1;
+            }
+            else
+            {
+                engine.remove(data.key(index), keyLength);
+                present[index] = 0;
+            }
+        }
+        mixedTimer.stop(end - start);
+    }
+    results->push_back(mixedTimer.result(Engine::name(), "mixed", used));
+
+    for(int x = 0; x < keys; x++) //put back the keys the mixed workload removed
+        if(!present[x])
+            engine.set(data.key(x), keyLength, value);
+    OpTimer removeTimer(keys);
+    for(int start = 0; start < keys; start += TIMING_BATCH)
+    {
+        int end = min(start + TIMING_BATCH, keys);
+        removeTimer.start();
+        for(int x = start; x < end; x++)
+            checksum += engine.remove(data.key(data.order[x]), keyLength);
+        removeTimer.stop(end - start);
+    }
+    results->push_back(removeTimer.result(Engine::name(), "remove", used));
+    sink = checksum;
+}
+
+///////////////////////////////////
+// YCSB WORKLOADS
+///////////////////////////////////
+//options of the YCSB mode
+struct YcsbConfig{
+    long records;
+    long operations;
+    int keyLength;
+    int valueSize;
+    int distribution; //a KeyDistribution, or -1 for the workload's own
+    double theta;
+    double hotFraction;
+    double hotOperationFraction;
+};
+
+//the latencies of one workload on one engine
+struct YcsbResult{
+    string engine;
+    string workload;
+    KeyDistribution distribution;
+    long records;
+    long operations;
+    double seconds;
+    LatencyHistogram histograms[NUMBER_OF_OPERATION_TYPES];
+};
+
+/**
+ * runYcsb(const WorkloadSpec& spec, const YcsbConfig& config, vector<YcsbResult>* results)
+ * ----------------------------------------------------------------------------
+ * Loads config.records records into a fresh Engine, then runs
+ * config.operations operations drawn from spec, timing one in every
+ * YCSB_SAMPLE_PERIOD into the histogram of its type; reading the clock
+ * around every operation would cost as much as the operations themselves.
+ * Operations per second are measured over the whole run. Reads and updates pick existing records through the
+ * workload's KeyChooser and inserts add the next record id. A hash map keeps
+ * no key order, so a scan of n records reads the n records with the ids
+ * following the chosen one. A read-modify-write reads a value, changes a
+ * byte of it and writes it back.
+ */
+template<class Engine> void runYcsb(const WorkloadSpec& spec, const YcsbConfig& config, vector<YcsbResult>* results)
+{
+    results->push_back(YcsbResult());
+    YcsbResult& result = results->back();
+    result.engine = Engine::name();
+    result.workload = spec.name;
+    result.distribution = (config.distribution >= 0) ? (KeyDistribution)config.distribution : spec.distribution;
+    result.records = config.records;
+    result.operations = config.operations;
+
+    size_t keyLength = config.keyLength;
+    vector<char> key(keyLength);
+    vector<char> value(config.valueSize, 'v');
+    Engine engine(config.valueSize, BASE_MAX_LOAD);
+    for(long x = 0; x < config.records; x++)
+    {
+        makeKey(key.data(), keyLength, x, 'u');
+        engine.set(key.data(), keyLength, value.data());
+    }
+
+    KeyChooser keys(result.distribution, config.records, RANDOM_SEED, config.theta, config.hotFraction, config.hotOperationFraction);
+    OperationChooser operations(spec, RANDOM_SEED + 1);
+    uint64_t inserted = config.records;
+    uint64_t checksum = 0;
+    chrono::steady_clock::time_point runStart = chrono::steady_clock::now();
+    for(long x = 0; x < config.operations; x++)
+    {
+        OperationType type = operations.next();
+        uint64_t id = (type == OPERATION_INSERT) ? inserted : keys.next(inserted);
+        uint64_t scanLength = (type == OPERATION_SCAN) ? 1 + keys.nextUniform(spec.maxScanLength) : 0;
+        makeKey(key.data(), keyLength, id, 'u');
+
+        bool timed = (x % YCSB_SAMPLE_PERIOD) == 0;
+        chrono::steady_clock::time_point start;
+        if(timed)
+            start = chrono::steady_clock::now();
+        switch(type)
+        {
+        case OPERATION_READ:
+            checksum += engine.get(key.data(), keyLength) != NULL;
+            break;
+        case OPERATION_UPDATE:
+        case OPERATION_INSERT:
+            engine.set(key.data(), keyLength, value.data());
+            break;
+        case OPERATION_SCAN:
+            for(uint64_t record = id; record < id + scanLength && record < inserted; record++)
+            {
+                makeKey(key.data(), keyLength, record, 'u');
+                checksum += engine.get(key.data(), keyLength) != NULL;
+            }
+            break;
+        default: //OPERATION_READ_MODIFY_WRITE
+        {
+            const char* current = engine.get(key.data(), keyLength);
+            if(current != NULL)
+                memcpy(value.data(), current, config.valueSize);
+            value[0]++;
+            engine.set(key.data(), keyLength, value.data());
+        }
+        }
+        if(timed)
+        {
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            result.histograms[type].record(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+        }
+        if(type == OPERATION_INSERT)
+            inserted++;
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - runStart).count();
+    sink = checksum;
+}
+
+/**
+ * parseMix(const char* mix, WorkloadSpec* spec)
+ * ----------------------------------------------------------------------------
+ * Reads a custom operation mix such as "read=0.9,update=0.05,insert=0.05"
+ * into spec (rmw is read-modify-write); returns false if it's malformed.
+ */
+bool parseMix(const char* mix, WorkloadSpec* spec)
+{
+    const char* names[] = {"read", "update", "insert", "scan", "rmw"};
+    memset(spec->proportions, 0, sizeof(spec->proportions));
+    string remaining = mix;
+    while(!remaining.empty())
+    {
+        size_t comma = remaining.find(',');
+        string part = remaining.substr(0, comma);
+        remaining = (comma == string::npos) ? "" : remaining.substr(comma + 1);
+        size_t equals = part.find('=');
+        if(equals == string::npos)
+            return false;
+        int type = -1;
+        for(int x = 0; x < NUMBER_OF_OPERATION_TYPES; x++)
+            if(part.compare(0, equals, names[x]) == 0)
+                type = x;
+        if(type < 0)
+            return false;
+        spec->proportions[type] = atof(part.c_str() + equals + 1);
+    }
+    double total = 0;
+    for(int x = 0; x < NUMBER_OF_OPERATION_TYPES; x++)
+        total += spec->proportions[x];
+    return total > 0;
+}
+
+///////////////////////////////////
+// OUTPUT
+///////////////////////////////////
+/**
+ * writeJson(FILE* out, const vector<BenchResult>& results),
+ * writeCsv(FILE* out, const vector<BenchResult>& results)
+ * ----------------------------------------------------------------------------
+ * Writes one record per result. Both formats carry the same fields; times
+ * are in nanoseconds, and max_load is the maximum load factor the engine
+ * actually used.
+ */
+void writeJson(FILE* out, const vector<BenchResult>& results)
+{
+    fprintf(out, "{\n  \"benchmark\": \"hashmap_bench\",\n  \"timing_batch\": %d,\n  \"results\": [\n", TIMING_BATCH);
+    for(size_t x = 0; x < results.size(); x++)
+    {
+        const BenchResult& r = results[x];
+        fprintf(out, "    {\"engine\": \"%s\", \"workload\": \"%s\", \"key_length\": %d, \"value_size\": %d, "
+                "\"max_load\": %g, \"keys\": %d, \"ops\": %ld, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, "
+                "\"p50_ns\": %.2f, \"p90_ns\": %.2f, \"p99_ns\": %.2f, \"p999_ns\": %.2f}%s\n",
+                r.engine.c_str(), r.workload.c_str(), r.config.keyLength, r.config.valueSize,
+                r.config.maxLoad, r.config.keys, r.ops, r.nsPerOp, r.opsPerSecond,
+                r.p50, r.p90, r.p99, r.p999, (x + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+void writeCsv(FILE* out, const vector<BenchResult>& results)
+{
+    fprintf(out, "engine,workload,key_length,value_size,max_load,keys,ops,ns_per_op,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns\n");
+    for(size_t x = 0; x < results.size(); x++)
+    {
+        const BenchResult& r = results[x];
+        fprintf(out, "%s,%s,%d,%d,%g,%d,%ld,%.2f,%.0f,%.2f,%.2f,%.2f,%.2f\n",
+                r.engine.c_str(), r.workload.c_str(), r.config.keyLength, r.config.valueSize,
+                r.config.maxLoad, r.config.keys, r.ops, r.nsPerOp, r.opsPerSecond,
+                r.p50, r.p90, r.p99, r.p999);
+    }
+}
+
+/**
+ * writeYcsbJson(FILE* out, vector<YcsbResult>& results),
+ * writeYcsbCsv(FILE* out, vector<YcsbResult>& results)
+ * ----------------------------------------------------------------------------
+ * Writes the latencies of every operation type each run performed: count,
+ * mean, percentiles and maximum in nanoseconds, and the non-empty histogram
+ * buckets as [lower bound ns, count] pairs (lower:count;... in CSV). Only
+ * one operation in every sample_period is timed, so the counts are of the
+ * timed operations; each latency includes one read of the clock.
+ */
+void writeYcsbJson(FILE* out, vector<YcsbResult>& results)
+{
+    fprintf(out, "{\n  \"benchmark\": \"hashmap_bench\",\n  \"mode\": \"ycsb\",\n  \"sample_period\": %d,\n  \"results\": [\n",
+            YCSB_SAMPLE_PERIOD);
+    for(size_t x = 0; x < results.size(); x++)
+    {
+        YcsbResult& r = results[x];
+        fprintf(out, "    {\"engine\": \"%s\", \"workload\": \"%s\", \"distribution\": \"%s\", "
+                "\"records\": %ld, \"operations\": %ld, \"ops_per_sec\": %.0f, \"latency\": {",
+                r.engine.c_str(), r.workload.c_str(), DISTRIBUTION_NAMES[r.distribution],
+                r.records, r.operations, (r.seconds > 0) ? r.operations / r.seconds : 0);
+        bool firstType = true;
+        for(int type = 0; type < NUMBER_OF_OPERATION_TYPES; type++)
+        {
+            LatencyHistogram& h = r.histograms[type];
+            if(h.getCount() == 0)
+                continue;
+            fprintf(out, "%s\n      \"%s\": {\"count\": %llu, \"mean_ns\": %.2f, \"p50_ns\": %llu, "
+                    "\"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu, \"histogram\": [",
+                    firstType ? "" : ",", OPERATION_NAMES[type], (unsigned long long)h.getCount(), h.getMean(),
+                    (unsigned long long)h.getPercentile(0.50), (unsigned long long)h.getPercentile(0.90),
+                    (unsigned long long)h.getPercentile(0.99), (unsigned long long)h.getPercentile(0.999),
+                    (unsigned long long)h.getMax());
+            bool firstBucket = true;
+            for(int bucket = 0; bucket < h.getNumberOfBuckets(); bucket++)
+                if(h.getBucketCount(bucket) > 0)
+                {
+                    fprintf(out, "%s[%llu, %llu]", firstBucket ? "" : ", ",
+                            (unsigned long long)h.getBucketLowerBound(bucket), (unsigned long long)h.getBucketCount(bucket));
+                    firstBucket = false;
+                }
+            fprintf(out, "]}");
+            firstType = false;
+        }
+        fprintf(out, "\n    }}%s\n", (x + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+void writeYcsbCsv(FILE* out, vector<YcsbResult>& results)
+{
+    fprintf(out, "engine,workload,distribution,records,operations,ops_per_sec,sample_period,operation,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,histogram\n");
+    for(size_t x = 0; x < results.size(); x++)
+    {
+        YcsbResult& r = results[x];
+        for(int type = 0; type < NUMBER_OF_OPERATION_TYPES; type++)
+        {
+            LatencyHistogram& h = r.histograms[type];
+            if(h.getCount() == 0)
+                continue;
+            fprintf(out, "%s,%s,%s,%ld,%ld,%.0f,%d,%s,%llu,%.2f,%llu,%llu,%llu,%llu,%llu,",
+                    r.engine.c_str(), r.workload.c_str(), DISTRIBUTION_NAMES[r.distribution],
+                    r.records, r.operations, (r.seconds > 0) ? r.operations / r.seconds : 0,
+                    YCSB_SAMPLE_PERIOD, OPERATION_NAMES[type], (unsigned long long)h.getCount(), h.getMean(),
+                    (unsigned long long)h.getPercentile(0.50), (unsigned long long)h.getPercentile(0.90),
+                    (unsigned long long)h.getPercentile(0.99), (unsigned long long)h.getPercentile(0.999),
+                    (unsigned long long)h.getMax());
+            bool firstBucket = true;
+            for(int bucket = 0; bucket < h.getNumberOfBuckets(); bucket++)
+                if(h.getBucketCount(bucket) > 0)
+                {
+                    fprintf(out, "%s%llu:%llu", firstBucket ? "" : ";",
+                            (unsigned long long)h.getBucketLowerBound(bucket), (unsigned long long)h.getBucketCount(bucket));
+                    firstBucket = false;
+                }
+            fprintf(out, "\n");
+        }
+    }
+}
+
+///////////////////////////////////
+// DRIVER
+///////////////////////////////////
+//runs the selected engines on one configuration
+void runConfig(const BenchConfig& config, const string& engines, vector<BenchResult>* results)
+{
+    BenchData data = makeData(config.keyLength, config.valueSize, config.keys);
+    fprintf(stderr, "keys=%d key_length=%d value_size=%d max_load=%g\n",
+            config.keys, config.keyLength, config.valueSize, config.maxLoad);
+    if(engines.find(ChainedEngine::name()) != string::npos)
+        runWorkloads<ChainedEngine>(config, data, results);
+    if(engines.find(SwissEngine::name()) != string::npos)
+        runWorkloads<SwissEngine>(config, data, results);
+    if(engines.find(ConcurrentEngine::name()) != string::npos)
+        runWorkloads<ConcurrentEngine>(config, data, results);
+    if(engines.find(UnorderedEngine::name()) != string::npos)
+        runWorkloads<UnorderedEngine>(config, data, results);
+}
+//returns whether Engine runs with another maximum load factor when given
+//maxLoad than when given the baseline's
+template<class Engine> bool usesMaxLoad(float maxLoad)
+{
+    return Engine(BASE_VALUE_SIZE, maxLoad).getMaxLoadFactor() != Engine(BASE_VALUE_SIZE, BASE_MAX_LOAD).getMaxLoadFactor();
+}
+//returns the selected engines that can use maxLoad. The others cap it (the
+//Swiss table never goes past 7/8 full) or ignore it, so their rows in the
+//load factor sweep would only repeat the baseline.
+string getMaxLoadEngines(float maxLoad, const string& engines)
+{
+    string used;
+    if(engines.find(ChainedEngine::name()) != string::npos && usesMaxLoad<ChainedEngine>(maxLoad))
+        used += string(ChainedEngine::name()) + ",";
+    if(engines.find(SwissEngine::name()) != string::npos && usesMaxLoad<SwissEngine>(maxLoad))
+        used += string(SwissEngine::name()) + ",";
+    if(engines.find(ConcurrentEngine::name()) != string::npos && usesMaxLoad<ConcurrentEngine>(maxLoad))
+        used += string(ConcurrentEngine::name()) + ",";
+    if(engines.find(UnorderedEngine::name()) != string::npos && usesMaxLoad<UnorderedEngine>(maxLoad))
+        used += string(UnorderedEngine::name()) + ",";
+    return used;
+}
+//runs the selected engines on one YCSB workload
+void runYcsbWorkload(const WorkloadSpec& spec, const YcsbConfig& config, const string& engines, vector<YcsbResult>* results)
+{
+    fprintf(stderr, "ycsb workload=%s records=%ld operations=%ld\n", spec.name, config.records, config.operations);
+    if(engines.find(ChainedEngine::name()) != string::npos)
+        runYcsb<ChainedEngine>(spec, config, results);
+    if(engines.find(SwissEngine::name()) != string::npos)
+        runYcsb<SwissEngine>(spec, config, results);
+    if(engines.find(ConcurrentEngine::name()) != string::npos)
+        runYcsb<ConcurrentEngine>(spec, config, results);
+    if(engines.find(UnorderedEngine::name()) != string::npos)
+        runYcsb<UnorderedEngine>(spec, config, results);
+}
+
+//prints the options and returns the exit status for bad ones
+int usage(const char* program)
+{
+    fprintf(stderr, "usage: %s [--format json|csv] [--output path] [--quick] [--max-keys n]\n"
+            "       [--engines chained,swiss,concurrent,unordered_map]\n"
+            "       [--ycsb a,b,c,d,e,f] [--records n] [--operations n] [--theta t]\n"
+            "       [--distribution uniform|zipfian|latest|hotspot] [--hot-fraction f]\n"
+            "       [--hot-operations f] [--mix read=r,update=u,insert=i,scan=s,rmw=m]\n", program);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    string format = "json";
+    string engines = "chained,swiss,concurrent,unordered_map";
+    const char* outputPath = NULL;
+    bool quick = false;
+    long maxKeys = 1L << 30;
+    string ycsb; //workload letters, or empty for the micro-benchmark sweep
+    const char* mix = NULL;
+    YcsbConfig ycsbConfig = {0, 0, YCSB_KEY_LENGTH, YCSB_VALUE_SIZE, -1,
+                             DEFAULT_ZIPFIAN_THETA, DEFAULT_HOT_FRACTION, DEFAULT_HOT_OPERATION_FRACTION};
+    for(int x = 1; x < argc; x++)
+    {
+        string arg = argv[x];
+        bool hasValue = x + 1 < argc;
+        if(arg == "--format" && hasValue)
+            format = argv[++x];
+        else if(arg == "--output" && hasValue)
+            outputPath = argv[++x];
+        else if(arg == "--engines" && hasValue)
+            engines = argv[++x];
+        else if(arg == "--max-keys" && hasValue)
+            maxKeys = atol(argv[++x]);
+        else if(arg == "--quick")
+            quick = true;
+        else if(arg == "--ycsb" && hasValue)
+            ycsb = argv[++x];
+        else if(arg == "--mix" && hasValue)
+            mix = argv[++x];
+        else if(arg == "--records" && hasValue)
+            ycsbConfig.records = atol(argv[++x]);
+        else if(arg == "--operations" && hasValue)
+            ycsbConfig.operations = atol(argv[++x]);
+        else if(arg == "--theta" && hasValue)
+            ycsbConfig.theta = atof(argv[++x]);
+        else if(arg == "--hot-fraction" && hasValue)
+            ycsbConfig.hotFraction = atof(argv[++x]);
+        else if(arg == "--hot-operations" && hasValue)
+            ycsbConfig.hotOperationFraction = atof(argv[++x]);
+        else if(arg == "--distribution" && hasValue)
+        {
+            string name = argv[++x];
+            for(int d = 0; d < (int)(sizeof(DISTRIBUTION_NAMES)/sizeof(char*)); d++)
+                if(name == DISTRIBUTION_NAMES[d])
+                    ycsbConfig.distribution = d;
+            if(ycsbConfig.distribution < 0)
+                return usage(argv[0]);
+        }
+        else
+            return usage(argv[0]);
+    }
+    if(format != "json" && format != "csv")
+    {
+        fprintf(stderr, "unknown format %s\n", format.c_str());
+        return 1;
+    }
+    if(ycsbConfig.theta <= 0 || ycsbConfig.theta >= 1)
+    {
+        fprintf(stderr, "theta must be between 0 and 1\n");
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if(!ycsb.empty() || mix != NULL)
+    {
+        if(ycsbConfig.records <= 0)
+            ycsbConfig.records = quick ? QUICK_YCSB_RECORDS : YCSB_RECORDS;
+        if(ycsbConfig.operations <= 0)
+            ycsbConfig.operations = quick ? QUICK_YCSB_OPERATIONS : YCSB_OPERATIONS;
+
+        vector<WorkloadSpec> specs;
+        for(size_t x = 0; x < ycsb.size(); x++)
+        {
+            WorkloadSpec spec;
+            if(ycsb[x] == ',')
+                continue;
+            if(!getYcsbWorkload(ycsb[x], &spec))
+                return usage(argv[0]);
+            specs.push_back(spec);
+        }
+        if(mix != NULL)
+        {
+            WorkloadSpec spec = {"custom", {0, 0, 0, 0, 0}, DISTRIBUTION_UNIFORM, DEFAULT_MAX_SCAN_LENGTH};
+            if(!parseMix(mix, &spec))
+                return usage(argv[0]);
+            specs.push_back(spec);
+        }
+
+        vector<YcsbResult> results;
+        for(size_t x = 0; x < specs.size(); x++)
+            runYcsbWorkload(specs[x], ycsbConfig, engines, &results);
+        if(outputPath != NULL && (out = fopen(outputPath, "w")) == NULL)
+        {
+            perror(outputPath);
+            return 1;
+        }
+        if(format == "json")
+            writeYcsbJson(out, results);
+        else
+            writeYcsbCsv(out, results);
+    }
+    else
+    {
+        vector<BenchResult> results;
+        BenchConfig base = {BASE_KEY_LENGTH, BASE_VALUE_SIZE, BASE_MAX_LOAD, (int)min((long)BASE_KEYS, maxKeys)};
+        const int* keyCounts = quick ? QUICK_KEY_COUNTS : KEY_COUNTS;
+        int numberOfKeyCounts = quick ? sizeof(QUICK_KEY_COUNTS)/sizeof(int) : sizeof(KEY_COUNTS)/sizeof(int);
+        for(int x = 0; x < numberOfKeyCounts; x++)
+        {
+            BenchConfig config = base;
+            config.keys = keyCounts[x];
+            if(config.keys <= maxKeys)
+                runConfig(config, engines, &results);
+        }
+        for(size_t x = 0; x < sizeof(KEY_LENGTHS)/sizeof(int); x++)
+        {
+            BenchConfig config = base;
+            config.keyLength = KEY_LENGTHS[x];
+            if(config.keyLength != base.keyLength)
+                runConfig(config, engines, &results);
+        }
+        for(size_t x = 0; x < sizeof(VALUE_SIZES)/sizeof(int); x++)
+        {
+            BenchConfig config = base;
+            config.valueSize = VALUE_SIZES[x];
+            if(config.valueSize != base.valueSize)
+                runConfig(config, engines, &results);
+        }
+        for(size_t x = 0; x < sizeof(MAX_LOADS)/sizeof(float); x++)
+        {
+            BenchConfig config = base;
+            config.maxLoad = MAX_LOADS[x];
+            string sweepEngines = getMaxLoadEngines(config.maxLoad, engines);
+            if(config.maxLoad != base.maxLoad && !sweepEngines.empty())
+                runConfig(config, sweepEngines, &results);
+        }
+        if(outputPath != NULL && (out = fopen(outputPath, "w")) == NULL)
+        {
+            perror(outputPath);
+            return 1;
+        }
+        if(format == "json")
+            writeJson(out, results);
+        else
+            writeCsv(out, results);
+    }
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
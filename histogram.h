@@ -0,0 +1,72 @@
+/* -------------------------------------------------------------------------- *
+ *                           Log-linear Histograms                            *
+ * -------------------------------------------------------------------------- *
+ * The bucket layout shared by LatencyHistogram (workload.h) and the latency  *
+ * histograms of MapInstrumentation (instrument.h), in the style of           *
+ * HdrHistogram. With 2^subBucketBits sub-buckets, values below twice that    *
+ * get a bucket each; above it every power of two is split into that many     *
+ * equal buckets, so a bucket is never wider than 2^-subBucketBits of the     *
+ * values in it and finding one is a couple of shifts.                        *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _histogram_h
+#define _histogram_h
+
+#include <stdint.h>
+#include <math.h>
+
+namespace{ //local helpers for the histograms
+    //returns the bucket of value among buckets; values past the last bucket
+    //share it
+    inline int getHistogramBucket(uint64_t value, int subBucketBits, int buckets)
+    {
+        int subBuckets = 1 << subBucketBits;
+        if(value < 2 * (uint64_t)subBuckets)
+            return (int)value;
+        int shift = (63 - __builtin_clzll(value)) - subBucketBits;
+        int bucket = (shift + 1) * subBuckets + (int)(value >> shift) - subBuckets;
+        return (bucket < buckets) ? bucket : buckets - 1;
+    }
+    //returns the smallest value that falls in bucket
+    inline uint64_t getHistogramLowerBound(int bucket, int subBucketBits)
+    {
+        int subBuckets = 1 << subBucketBits;
+        if(bucket < 2 * subBuckets)
+            return bucket;
+        int shift = bucket / subBuckets - 1;
+        return (uint64_t)(subBuckets + bucket % subBuckets) << shift;
+    }
+    //returns the value at fraction (0.99 for p99) of the total values counted
+    //in counts, as the largest value in its bucket (HdrHistogram's highest
+    //equivalent value) capped at max, the largest value recorded
+    inline uint64_t getHistogramPercentile(const uint64_t* counts, int subBucketBits, int buckets,
+                                           uint64_t total, uint64_t max, double fraction)
+    {
+        uint64_t rank = (uint64_t)ceil(fraction * total);
+        uint64_t seen = 0;
+        for(int x = 0; x < buckets; x++)
+        {
+            seen += counts[x];
+            if(seen >= rank && seen > 0)
+            {
+                uint64_t highest = (x + 1 < buckets) ? getHistogramLowerBound(x + 1, subBucketBits) - 1 : max;
+                return (highest < max) ? highest : max;
+            }
+        }
+        return max;
+    }
+}
+
+#endif
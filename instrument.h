@@ -0,0 +1,339 @@
+/* -------------------------------------------------------------------------- *
+ *                            MapInstrumentation                              *
+ * -------------------------------------------------------------------------- *
+ * Operation counters and sampled latencies for the map engines, compiled in  *
+ * only when HASHMAP_INSTRUMENT is defined. Every thread that uses a map gets *
+ * its own record (one per thread, cache line aligned), which only that       *
+ * thread writes: counting an event is a relaxed load and store, no locked    *
+ * instruction. One operation in INSTRUMENT_SAMPLE_PERIOD is timed with the   *
+ * CPU's timestamp counter and recorded into a log-linear (HdrHistogram       *
+ * style) histogram in the record. Nothing is combined until a getter walks  *
+ * the records, so the readers pay for aggregation and the map never does.    *
+ *                                                                            *
+ * Every translation unit must agree on HASHMAP_INSTRUMENT, since it changes  *
+ * the layout of the map classes.                                             *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _instrument_h
+#define _instrument_h
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include "histogram.h"
+#include "threadrecords.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace{ //local namespace variables
+    const uint32_t INSTRUMENT_SAMPLE_PERIOD = 64; //one operation in this many is timed
+    const int INSTRUMENT_SUB_BUCKETS = 8; //linear buckets per power of two, ~12% precision
+    const int INSTRUMENT_SUB_BUCKET_BITS = 3; //log2(INSTRUMENT_SUB_BUCKETS)
+    const int INSTRUMENT_BUCKETS = 40 * INSTRUMENT_SUB_BUCKETS; //covers up to 2^40 ticks
+    const int INSTRUMENT_THREAD_CACHE_SIZE = 16; //maps a thread finds its record for without a search
+
+    //the CPU's timestamp counter where there is one, nanoseconds otherwise
+    inline uint64_t readTimestamp()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+    }
+}
+
+//the operations that are timed
+enum InstrumentedOperation{
+    INSTRUMENT_GET,
+    INSTRUMENT_SET,
+    INSTRUMENT_REMOVE,
+    NUMBER_OF_INSTRUMENTED_OPERATIONS
+};
+
+//the events that are counted. A get() is a hit or a miss, a set() an insert
+//or an update and a remove() a remove or a miss; a resize is counted when the
+//table starts growing.
+enum InstrumentedEvent{
+    INSTRUMENT_HITS,
+    INSTRUMENT_MISSES,
+    INSTRUMENT_INSERTS,
+    INSTRUMENT_UPDATES,
+    INSTRUMENT_REMOVES,
+    INSTRUMENT_RESIZES,
+    NUMBER_OF_INSTRUMENTED_EVENTS
+};
+
+class MapInstrumentation{
+public:
+    //the calling thread's counters and histograms
+    struct alignas(64) ThreadRecord{
+        std::atomic<uint64_t> events[NUMBER_OF_INSTRUMENTED_EVENTS];
+        std::atomic<uint64_t> latencies[NUMBER_OF_INSTRUMENTED_OPERATIONS][INSTRUMENT_BUCKETS];
+        std::atomic<uint64_t> maxLatency[NUMBER_OF_INSTRUMENTED_OPERATIONS];
+        uint32_t untilSample; //operations left until the next timed one; owner only
+        pthread_t owner;
+        ThreadRecord* next;
+        ThreadRecord();
+    };
+
+    //brackets one operation: counts the event it ends with (set with
+    //setEvent(), none by default) and records its latency if it was sampled
+    class Operation{
+    public:
+        Operation(MapInstrumentation* instrumentation, InstrumentedOperation operation);
+        ~Operation();
+        void setEvent(InstrumentedEvent event);
+    private:
+        ThreadRecord* record;
+        InstrumentedOperation operation;
+        int event;
+        uint64_t start; //timestamp when sampled, 0 otherwise
+    };
+
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    MapInstrumentation();
+    ~MapInstrumentation();
+
+    ///////////////////////////////////
+    // RECORDING METHODS
+    ///////////////////////////////////
+    void count(InstrumentedEvent event);
+
+    ///////////////////////////////////
+    // REPORTING METHODS
+    ///////////////////////////////////
+    uint64_t getCount(InstrumentedEvent event);
+    uint64_t getSampleCount(InstrumentedOperation operation);
+    uint64_t getMaxLatency(InstrumentedOperation operation);
+    uint64_t getPercentile(InstrumentedOperation operation, double fraction);
+    static int getNumberOfBuckets();
+    uint64_t getBucketCount(InstrumentedOperation operation, int bucket);
+    static uint64_t getBucketLowerBound(int bucket);
+
+private:
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    static void increment(std::atomic<uint64_t>* counter);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    //one per thread that ever used the map; a thread that works with several
+    //maps in turn (copying from one into another, say) finds its records of
+    //INSTRUMENT_THREAD_CACHE_SIZE of them without a search
+    ThreadRecordList<ThreadRecord, INSTRUMENT_THREAD_CACHE_SIZE> records;
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * MapInstrumentation()
+ * ----------------------------------------------------------------------------
+ * Creates an instrumentation with no thread records; a thread gets one the
+ * first time it counts something.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+MapInstrumentation::MapInstrumentation()
+{
+}
+/**
+ * ~MapInstrumentation()
+ * ----------------------------------------------------------------------------
+ * Frees the thread records, through the record list. No thread may still be
+ * using the map.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t); t = number of threads that ever used the map
+ */
+MapInstrumentation::~MapInstrumentation()
+{
+}
+/**
+ * Operation(MapInstrumentation* instrumentation, InstrumentedOperation operation)
+ * ----------------------------------------------------------------------------
+ * Starts an operation, reading the timestamp counter if it is the calling
+ * thread's INSTRUMENT_SAMPLE_PERIOD-th since the last sample (the first one
+ * of every thread is sampled). The destructor counts its event and records
+ * the elapsed ticks.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) once the calling thread has a record
+ */
+MapInstrumentation::Operation::Operation(MapInstrumentation* instrumentation, InstrumentedOperation operation)
+{
+    record = instrumentation->records.getThreadRecord();
+    this->operation = operation;
+    event = -1;
+    start = 0;
+    if(--record->untilSample == 0)
+    {
+        record->untilSample = INSTRUMENT_SAMPLE_PERIOD;
+        start = readTimestamp();
+    }
+}
+MapInstrumentation::Operation::~Operation()
+{
+    if(event >= 0)
+        increment(&record->events[event]);
+    if(start == 0)
+        return;
+
+    uint64_t ticks = readTimestamp() - start;
+    increment(&record->latencies[operation][getHistogramBucket(ticks, INSTRUMENT_SUB_BUCKET_BITS, INSTRUMENT_BUCKETS)]);
+    if(ticks > record->maxLatency[operation].load(std::memory_order_relaxed))
+        record->maxLatency[operation].store(ticks, std::memory_order_relaxed);
+}
+void MapInstrumentation::Operation::setEvent(InstrumentedEvent event)
+{
+    this->event = event;
+}
+///////////////////////////////////
+// RECORDING METHODS
+///////////////////////////////////
+/**
+ * count(InstrumentedEvent event)
+ * ----------------------------------------------------------------------------
+ * Counts event for the calling thread outside of an Operation.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) once the calling thread has a record
+ */
+void MapInstrumentation::count(InstrumentedEvent event)
+{
+    increment(&records.getThreadRecord()->events[event]);
+}
+///////////////////////////////////
+// REPORTING METHODS
+///////////////////////////////////
+/**
+ * getCount(InstrumentedEvent event), getSampleCount(InstrumentedOperation
+ * operation), getMaxLatency(InstrumentedOperation operation)
+ * ----------------------------------------------------------------------------
+ * Return the number of times event happened, the number of operations that
+ * were timed and the longest of them in ticks, summed (or maxed) over every
+ * thread. They may be called from any thread while the map is in use; the
+ * records are read one at a time, so they aren't a single point in time.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t) for getCount() and getMaxLatency(), t = number of threads
+ *          that ever used the map; O(t * b) for getSampleCount(), b = number
+ *          of buckets
+ */
+uint64_t MapInstrumentation::getCount(InstrumentedEvent event)
+{
+    uint64_t total = 0;
+    for(ThreadRecord* record = records.getFirst(); record != NULL; record = record->next)
+        total += record->events[event].load(std::memory_order_relaxed);
+    return total;
+}
+uint64_t MapInstrumentation::getSampleCount(InstrumentedOperation operation)
+{
+    uint64_t total = 0;
+    for(int x = 0; x < INSTRUMENT_BUCKETS; x++)
+        total += getBucketCount(operation, x);
+    return total;
+}
+uint64_t MapInstrumentation::getMaxLatency(InstrumentedOperation operation)
+{
+    uint64_t max = 0;
+    for(ThreadRecord* record = records.getFirst(); record != NULL; record = record->next)
+    {
+        uint64_t ticks = record->maxLatency[operation].load(std::memory_order_relaxed);
+        if(ticks > max)
+            max = ticks;
+    }
+    return max;
+}
+/**
+ * getPercentile(InstrumentedOperation operation, double fraction)
+ * ----------------------------------------------------------------------------
+ * Returns the latency in ticks at fraction (0.99 for p99) of the sampled
+ * operations, as the largest value in its bucket (HdrHistogram's highest
+ * equivalent value) capped at the longest sample. The histograms of every
+ * thread are summed into a temporary one first. Returns 0 if nothing has
+ * been sampled.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t * b); t = number of threads, b = number of buckets
+ */
+uint64_t MapInstrumentation::getPercentile(InstrumentedOperation operation, double fraction)
+{
+    uint64_t counts[INSTRUMENT_BUCKETS];
+    uint64_t total = 0;
+    for(int x = 0; x < INSTRUMENT_BUCKETS; x++)
+    {
+        counts[x] = getBucketCount(operation, x);
+        total += counts[x];
+    }
+    return getHistogramPercentile(counts, INSTRUMENT_SUB_BUCKET_BITS, INSTRUMENT_BUCKETS,
+                                  total, getMaxLatency(operation), fraction);
+}
+/**
+ * getNumberOfBuckets(), getBucketCount(InstrumentedOperation operation, int
+ * bucket), getBucketLowerBound(int bucket)
+ * ----------------------------------------------------------------------------
+ * Expose the raw histogram for export: bucket holds the samples from its
+ * lower bound up to the lower bound of the next one, summed over threads.
+ */
+int MapInstrumentation::getNumberOfBuckets()
+{
+    return INSTRUMENT_BUCKETS;
+}
+uint64_t MapInstrumentation::getBucketCount(InstrumentedOperation operation, int bucket)
+{
+    uint64_t total = 0;
+    for(ThreadRecord* record = records.getFirst(); record != NULL; record = record->next)
+        total += record->latencies[operation][bucket].load(std::memory_order_relaxed);
+    return total;
+}
+uint64_t MapInstrumentation::getBucketLowerBound(int bucket)
+{
+    return getHistogramLowerBound(bucket, INSTRUMENT_SUB_BUCKET_BITS);
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+// a new thread's record: nothing counted yet and its first operation sampled
+MapInstrumentation::ThreadRecord::ThreadRecord()
+{
+    for(int x = 0; x < NUMBER_OF_INSTRUMENTED_EVENTS; x++)
+        events[x].store(0, std::memory_order_relaxed);
+    for(int x = 0; x < NUMBER_OF_INSTRUMENTED_OPERATIONS; x++)
+    {
+        for(int y = 0; y < INSTRUMENT_BUCKETS; y++)
+            latencies[x][y].store(0, std::memory_order_relaxed);
+        maxLatency[x].store(0, std::memory_order_relaxed);
+    }
+    untilSample = 1;
+}
+// adds one to a counter of the calling thread's record. Only the owner
+// writes it, so a plain load and store is enough and readers never see a
+// torn value.
+void MapInstrumentation::increment(std::atomic<uint64_t>* counter)
+{
+    counter->store(counter->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+#endif
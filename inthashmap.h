@@ -0,0 +1,564 @@
+/* -------------------------------------------------------------------------- *
+ *                               IntHashMap                                   *
+ * -------------------------------------------------------------------------- *
+ * A sibling of HashMap for integer keys (uint64_t, which uint32_t keys       *
+ * widen to without loss). Keys are never turned into strings: they are      *
+ * stored as-is in one flat array and spread over the table with a Fibonacci  *
+ * (multiplicative) hash, so an operation costs a multiply and a linear probe *
+ * over adjacent words instead of an allocation, a string hash and a strcmp.  *
+ * The values live in a second flat array at the same index, aligned as in    *
+ * HashMap. Empty slots hold the reserved key INT_MAP_EMPTY_KEY, which can't  *
+ * be stored. remove() shifts the following entries of the probe run back    *
+ * instead of leaving tombstones, so lookups never slow down as keys churn.   *
+ * The set/get/remove/iteration calls mirror HashMap's with the char* key     *
+ * replaced by a uint64_t.                                                    *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _inthashmap_h
+#define _inthashmap_h
+
+#include "hashmap.h"
+#include <stdint.h>
+#include <new>
+
+namespace{ //local namespace variables
+    const uint64_t INT_MAP_EMPTY_KEY = UINT64_MAX; //marks an empty slot; can't be used as a key
+    const uint64_t FIBONACCI_MULTIPLIER = 0x9E3779B97F4A7C15ULL; //2^64 / golden ratio
+    const float INT_MAP_MAX_LOAD_FACTOR = 0.75; //linear probe runs grow quickly past this
+    const int INT_MAP_MIN_CAPACITY = 8;
+}
+
+//position of an iteration over an IntHashMap, filled in by
+//firstEntry()/nextEntry(); value is NULL once the iteration is done and index
+//is private to the map
+struct IntHashMapCursor{
+    uint64_t key;
+    void* value;
+    int index;
+};
+
+class IntHashMap{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    IntHashMap(int mapSize, int elementSize);
+    IntHashMap(int mapSize, int elementSize, CleanupValueFn fn);
+    IntHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad);
+    IntHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, int valueAlignment);
+    ~IntHashMap();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    bool set(uint64_t key, void *addr);
+    void* get(uint64_t key);
+    void* getOrInsert(uint64_t key, InitValueFn initFn);
+    bool upsert(uint64_t key, void *addr, MergeValueFn mergeFn);
+    void* remove(uint64_t key);
+    void clear();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE PROPERTIES
+    ///////////////////////////////////
+    int getSize();
+    float getLoadFactor();
+    float getMaxLoadFactor();
+    void setMaxLoadFactor(float maxLoad);
+
+    ///////////////////////////////////
+    // ITERATOR METHODS
+    ///////////////////////////////////
+    const uint64_t *firstNode();
+    const uint64_t *nextNode(const uint64_t *prevKey);
+    bool firstEntry(IntHashMapCursor *cursor);
+    bool nextEntry(IntHashMapCursor *cursor);
+
+    //C++ iteration: for(IntHashMapCursor& entry : map) visits every key/value
+    class iterator{
+    public:
+        iterator(IntHashMap* map, bool atEnd);
+        IntHashMapCursor& operator*();
+        IntHashMapCursor* operator->();
+        iterator& operator++();
+        bool operator==(const iterator& other) const;
+        bool operator!=(const iterator& other) const;
+    private:
+        IntHashMap* map;
+        IntHashMapCursor cursor;
+    };
+    iterator begin();
+    iterator end();
+
+private:
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, int valueAlignment);
+    void allocateSlots(int newCapacity);
+    void freeSlots(uint64_t* oldKeys, char* oldValues);
+    int getHomeIndex(uint64_t key);
+    char* getValueAtIndex(int index);
+    int findSlot(uint64_t key);
+    int insertKey(int index, uint64_t key, void *addr);
+    void resize(int newCapacity);
+    int firstFullFrom(int index);
+    bool setCursor(IntHashMapCursor* cursor, int index);
+    void cleanupAllValues();
+    static void emptyCleanUpFunction(void *addr);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    int sizeOfElements; //the size of each value element
+    size_t valueAlignment; //alignment of the value array and of every value
+    size_t valueStride; //sizeOfElements rounded up to valueAlignment
+    int capacity; //number of slots, a power of two
+    int capacityShift; //64 - log2(capacity), turns a product into an index
+    int numberOfElements;
+    uint64_t* keys; //INT_MAP_EMPTY_KEY in empty slots
+    char* values; //capacity values, valueStride bytes apart
+    char* removedValue; //copy of the last removed value, returned by remove()
+    CleanupValueFn cleanupFunction;
+    float maxLoadFactor;
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * IntHashMap()
+ * ----------------------------------------------------------------------------
+ * Creates an IntHashMap with room for at least mapSize keys, rounded up to a
+ * power of two. The table doubles once the load factor passes maxLoad, which
+ * is capped at 0.75; values <= 0 use the cap, since an open addressing table
+ * can't be kept at a fixed size. A NULL fn means that values don't require
+ * any cleanup. Values are aligned as in HashMap: to valueAlignment, or if
+ * that is 0 or not specified to the strictest alignment a type of elementSize
+ * bytes can need.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k); k = size of IntHashMap
+ */
+IntHashMap::IntHashMap(int mapSize, int elementSize){
+    initialize(mapSize, elementSize, NULL, INT_MAP_MAX_LOAD_FACTOR, 0);
+}
+IntHashMap::IntHashMap(int mapSize, int elementSize, CleanupValueFn fn){
+    initialize(mapSize, elementSize, fn, INT_MAP_MAX_LOAD_FACTOR, 0);
+}
+IntHashMap::IntHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad){
+    initialize(mapSize, elementSize, fn, maxLoad, 0);
+}
+IntHashMap::IntHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, int valueAlignment){
+    initialize(mapSize, elementSize, fn, maxLoad, valueAlignment);
+}
+/**
+ * ~IntHashMap()
+ * ----------------------------------------------------------------------------
+ * Calls the cleanup function on every remaining value and frees the arrays.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) without a cleanup function, O(k) otherwise;
+ *          k = number of slots
+ */
+IntHashMap::~IntHashMap()
+{
+    cleanupAllValues();
+    freeSlots(keys, values);
+    delete[] removedValue;
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * set(uint64_t key, void* addr)
+ * ----------------------------------------------------------------------------
+ * Associates key with a copy of the value at addr, cleaning up and replacing
+ * any existing value. Returns false for INT_MAP_EMPTY_KEY.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool IntHashMap::set(uint64_t key, void *addr)
+{
+    if(key == INT_MAP_EMPTY_KEY)
+        return false;
+    int index = findSlot(key);
+    if(keys[index] == key)
+    {
+        cleanupFunction(getValueAtIndex(index));
+        memcpy(getValueAtIndex(index), addr, sizeOfElements);
+        return true;
+    }
+    insertKey(index, key, addr);
+    return true;
+}
+/**
+ * get(uint64_t key)
+ * ----------------------------------------------------------------------------
+ * Returns a pointer to the value of key, or NULL if key isn't in the map. The
+ * pointer is valid until the next insertion or removal, both of which can
+ * move values.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* IntHashMap::get(uint64_t key)
+{
+    if(key == INT_MAP_EMPTY_KEY)
+        return NULL;
+    int index = findSlot(key);
+    return (keys[index] == key) ? getValueAtIndex(index) : NULL;
+}
+/**
+ * getOrInsert(uint64_t key, InitValueFn initFn), upsert(uint64_t key,
+ *                                           void* addr, MergeValueFn mergeFn)
+ * ----------------------------------------------------------------------------
+ * Single-probe read-modify-write with the same contract as HashMap's.
+ * getOrInsert() returns NULL and upsert() false for INT_MAP_EMPTY_KEY.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* IntHashMap::getOrInsert(uint64_t key, InitValueFn initFn)
+{
+    if(key == INT_MAP_EMPTY_KEY)
+        return NULL;
+    int index = findSlot(key);
+    if(keys[index] == key)
+        return getValueAtIndex(index);
+
+    index = insertKey(index, key, NULL);
+    if(initFn != NULL)
+        initFn(getValueAtIndex(index));
+    return getValueAtIndex(index);
+}
+bool IntHashMap::upsert(uint64_t key, void *addr, MergeValueFn mergeFn)
+{
+    if(key == INT_MAP_EMPTY_KEY)
+        return false;
+    int index = findSlot(key);
+    if(keys[index] == key)
+        mergeFn(getValueAtIndex(index), addr);
+    else
+        insertKey(index, key, addr);
+    return true;
+}
+/**
+ * remove(uint64_t key)
+ * ----------------------------------------------------------------------------
+ * Removes key, cleaning up its value, and returns a pointer to a copy of the
+ * removed value that stays valid until the next remove(); NULL if the key
+ * isn't in the map. The entries after it in its probe run are shifted back
+ * one slot where that brings them closer to their home slot, so no
+ * tombstones are left behind.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* IntHashMap::remove(uint64_t key)
+{
+    if(key == INT_MAP_EMPTY_KEY)
+        return NULL;
+    int hole = findSlot(key);
+    if(keys[hole] != key)
+        return NULL;
+
+    cleanupFunction(getValueAtIndex(hole));
+    memcpy(removedValue, getValueAtIndex(hole), sizeOfElements);
+
+    int mask = capacity - 1;
+    for(int index = (hole + 1) & mask; keys[index] != INT_MAP_EMPTY_KEY; index = (index + 1) & mask)
+    {
+        //an entry may fill the hole if the hole lies between its home slot
+        //and where it sits now
+        int home = getHomeIndex(keys[index]);
+        if(((index - home) & mask) >= ((index - hole) & mask))
+        {
+            keys[hole] = keys[index];
+            memcpy(getValueAtIndex(hole), getValueAtIndex(index), sizeOfElements);
+            hole = index;
+        }
+    }
+    keys[hole] = INT_MAP_EMPTY_KEY;
+    numberOfElements--;
+    return removedValue;
+}
+/**
+ * clear()
+ * ----------------------------------------------------------------------------
+ * Removes every key and value, calling the cleanup function on each value.
+ * The capacity is kept.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k); k = number of slots
+ */
+void IntHashMap::clear()
+{
+    cleanupAllValues();
+    for(int x = 0; x < capacity; x++)
+        keys[x] = INT_MAP_EMPTY_KEY;
+    numberOfElements = 0;
+}
+///////////////////////////////////
+// DATA STRUCTURE PROPERTIES
+///////////////////////////////////
+/**
+ * getSize()
+ * ----------------------------------------------------------------------------
+ * Returns the number of elements in the IntHashMap.
+ */
+int IntHashMap::getSize()
+{
+    return numberOfElements;
+}
+/**
+ * getLoadFactor()
+ * ----------------------------------------------------------------------------
+ * Returns the load factor of the IntHashMap (#items in map/#slots).
+ */
+float IntHashMap::getLoadFactor()
+{
+    return (float)numberOfElements / capacity;
+}
+/**
+ * getMaxLoadFactor(), setMaxLoadFactor(float maxLoad)
+ * ----------------------------------------------------------------------------
+ * Gets/sets the load factor that triggers a resize. Values that are <= 0 or
+ * above 0.75 are replaced by 0.75.
+ */
+float IntHashMap::getMaxLoadFactor()
+{
+    return maxLoadFactor;
+}
+void IntHashMap::setMaxLoadFactor(float maxLoad)
+{
+    if(maxLoad <= 0 || maxLoad > INT_MAP_MAX_LOAD_FACTOR)
+        maxLoad = INT_MAP_MAX_LOAD_FACTOR;
+    maxLoadFactor = maxLoad;
+}
+///////////////////////////////////
+// ITERATOR METHODS
+///////////////////////////////////
+/**
+ * firstNode(), nextNode(const uint64_t* prevKey)
+ * ----------------------------------------------------------------------------
+ * These functions allow iteration over the keys in slot order. The returned
+ * pointers point into the key array, so nextNode() finds prevKey's slot from
+ * its address. As with HashMap, removing prevKey ends the iteration.
+ */
+const uint64_t* IntHashMap::firstNode()
+{
+    int index = firstFullFrom(0);
+    return (index < capacity) ? keys + index : NULL;
+}
+const uint64_t* IntHashMap::nextNode(const uint64_t* prevKey)
+{
+    int index = firstFullFrom((int)(prevKey - keys) + 1);
+    return (index < capacity) ? keys + index : NULL;
+}
+/**
+ * firstEntry(IntHashMapCursor* cursor), nextEntry(IntHashMapCursor* cursor)
+ * ----------------------------------------------------------------------------
+ * Cursor based iteration: the cursor holds the current slot index, and both
+ * return false (setting cursor->value to NULL) once there are no entries
+ * left.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool IntHashMap::firstEntry(IntHashMapCursor* cursor)
+{
+    return setCursor(cursor, firstFullFrom(0));
+}
+bool IntHashMap::nextEntry(IntHashMapCursor* cursor)
+{
+    return setCursor(cursor, firstFullFrom(cursor->index + 1));
+}
+/**
+ * begin(), end()
+ * ----------------------------------------------------------------------------
+ * Standard C++ iterators over the IntHashMap's entries.
+ */
+IntHashMap::iterator IntHashMap::begin()
+{
+    return iterator(this, false);
+}
+IntHashMap::iterator IntHashMap::end()
+{
+    return iterator(this, true);
+}
+IntHashMap::iterator::iterator(IntHashMap* map, bool atEnd)
+{
+    this->map = map;
+    if(atEnd)
+        map->setCursor(&cursor, map->capacity);
+    else
+        map->firstEntry(&cursor);
+}
+IntHashMapCursor& IntHashMap::iterator::operator*()
+{
+    return cursor;
+}
+IntHashMapCursor* IntHashMap::iterator::operator->()
+{
+    return &cursor;
+}
+IntHashMap::iterator& IntHashMap::iterator::operator++()
+{
+    map->nextEntry(&cursor);
+    return *this;
+}
+bool IntHashMap::iterator::operator==(const iterator& other) const
+{
+    return cursor.index == other.cursor.index;
+}
+bool IntHashMap::iterator::operator!=(const iterator& other) const
+{
+    return cursor.index != other.cursor.index;
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void IntHashMap::initialize(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, int valueAlignment)
+{
+    //make sure that we're given valid parameters
+    assert(mapSize >= 0);
+    assert(valueAlignment >= 0 && (valueAlignment & (valueAlignment-1)) == 0);
+
+    //if we're given 0 for our size, use the DEFAULT_SIZE
+    if(mapSize == 0)
+        mapSize = DEFAULT_SIZE;
+
+    sizeOfElements = elementSize;
+    this->valueAlignment = (valueAlignment > 0) ? valueAlignment : getDefaultValueAlignment(elementSize);
+    valueStride = alignOffset(elementSize, this->valueAlignment);
+    removedValue = new char[elementSize > 0 ? elementSize : 1];
+    cleanupFunction = (fn != NULL) ? fn : emptyCleanUpFunction;
+    setMaxLoadFactor(maxLoad);
+
+    int newCapacity = INT_MAP_MIN_CAPACITY;
+    while(newCapacity < mapSize)
+        newCapacity *= 2;
+    allocateSlots(newCapacity);
+}
+//allocates newCapacity empty slots
+void IntHashMap::allocateSlots(int newCapacity)
+{
+    capacity = newCapacity;
+    capacityShift = 64;
+    for(int x = capacity; x > 1; x /= 2)
+        capacityShift--;
+    numberOfElements = 0;
+    keys = new uint64_t[capacity];
+    for(int x = 0; x < capacity; x++)
+        keys[x] = INT_MAP_EMPTY_KEY;
+    values = (char*)::operator new[](valueStride * capacity, std::align_val_t(valueAlignment));
+}
+void IntHashMap::freeSlots(uint64_t* oldKeys, char* oldValues)
+{
+    delete[] oldKeys;
+    ::operator delete[](oldValues, std::align_val_t(valueAlignment));
+}
+//returns the slot key hashes to: the top bits of key times 2^64/phi, which
+//spreads sequential ids evenly over the table
+int IntHashMap::getHomeIndex(uint64_t key)
+{
+    if(capacityShift == 64) //a shift by 64 is undefined
+        return 0;
+    return (int)((key * FIBONACCI_MULTIPLIER) >> capacityShift);
+}
+char* IntHashMap::getValueAtIndex(int index)
+{
+    return values + valueStride * index;
+}
+//returns the slot that holds key, or the empty slot that ends its probe run
+//if the key isn't in the map. The load factor cap keeps a slot empty.
+int IntHashMap::findSlot(uint64_t key)
+{
+    int mask = capacity - 1;
+    int index = getHomeIndex(key);
+    while(keys[index] != key && keys[index] != INT_MAP_EMPTY_KEY)
+        index = (index + 1) & mask;
+    return index;
+}
+//stores key and a copy of addr (or a zero-filled value if addr is NULL) in
+//the empty slot at index found by findSlot(), growing the table first if
+//the new element would pass the load factor. Returns the key's slot.
+int IntHashMap::insertKey(int index, uint64_t key, void *addr)
+{
+    if(numberOfElements + 1 > maxLoadFactor * capacity)
+    {
+        resize(capacity * 2);
+        index = findSlot(key);
+    }
+    keys[index] = key;
+    if(addr != NULL)
+        memcpy(getValueAtIndex(index), addr, sizeOfElements);
+    else
+        memset(getValueAtIndex(index), 0, sizeOfElements);
+    numberOfElements++;
+    return index;
+}
+//moves every entry into a fresh table of newCapacity slots
+void IntHashMap::resize(int newCapacity)
+{
+    uint64_t* oldKeys = keys;
+    char* oldValues = values;
+    int oldCapacity = capacity;
+    int elements = numberOfElements;
+
+    allocateSlots(newCapacity);
+    for(int x = 0; x < oldCapacity; x++)
+    {
+        if(oldKeys[x] == INT_MAP_EMPTY_KEY)
+            continue;
+        int index = findSlot(oldKeys[x]);
+        keys[index] = oldKeys[x];
+        memcpy(getValueAtIndex(index), oldValues + valueStride * x, sizeOfElements);
+    }
+    numberOfElements = elements;
+    freeSlots(oldKeys, oldValues);
+}
+//returns the index of the first full slot at or after index, or capacity if
+//there are none
+int IntHashMap::firstFullFrom(int index)
+{
+    while(index < capacity && keys[index] == INT_MAP_EMPTY_KEY)
+        index++;
+    return index;
+}
+//points cursor at the slot index (capacity for the end), returning whether
+//there is an entry there
+bool IntHashMap::setCursor(IntHashMapCursor* cursor, int index)
+{
+    cursor->index = index;
+    if(index >= capacity)
+    {
+        cursor->key = INT_MAP_EMPTY_KEY;
+        cursor->value = NULL;
+        return false;
+    }
+    cursor->key = keys[index];
+    cursor->value = getValueAtIndex(index);
+    return true;
+}
+//calls the cleanup function on every value in the map
+void IntHashMap::cleanupAllValues()
+{
+    if(cleanupFunction == emptyCleanUpFunction)
+        return;
+    for(int x = 0; x < capacity; x++)
+    {
+        if(keys[x] != INT_MAP_EMPTY_KEY)
+            cleanupFunction(getValueAtIndex(x));
+    }
+}
+void IntHashMap::emptyCleanUpFunction(void *addr){}
+
+#endif
@@ -18,15 +18,23 @@
  * -------------------------------------------------------------------------- */
  
 #include "hashmap.h"
+#include "concurrenthashmap.h"
+#include "epochhashmap.h"
+#include "typedhashmap.h"
+#include "inthashmap.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #include <string>
 #include <assert.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <iterator>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 using namespace std;
 
@@ -50,7 +58,8 @@ static int numDeleteCalled = 0; //used to make sure that complexStructDelete is
 
         assert(map1.getSize() == x+1);
     }
-    assert(map1.getLoadFactor() == (float)(100000/100));
+    assert(map1.getLoadFactor() <= map1.getMaxLoadFactor());
+    assert(map1.getElementSize() == sizeof(int));
 
     struct bogusStruct{
         int integerOne;
@@ -69,8 +78,201 @@ static int numDeleteCalled = 0; //used to make sure that complexStructDelete is
 
         assert(map2.getSize() == x+1);
     }
-    assert(map2.getLoadFactor() == (float)(100000/100));
+    assert(map2.getLoadFactor() <= map2.getMaxLoadFactor());
+
+#ifndef HASHMAP_SWISS_ENGINE //open addressing can't hold more keys than slots
+    HashMap map3(100, sizeof(int), NULL, 0); //fixed-size map
+    for(int x = 0; x < 100000; x++)
+    {
+        char* key = (char*)to_string(x).c_str();
+        int tempInt = 1;
+        map3.set(key,&tempInt);
+    }
+    assert(map3.getLoadFactor() == (float)(100000/100));
+#endif
  }
+ /**
+ * resize_test()
+ * ----------------------------------------------------------------------------
+ * Tests that every key stays reachable through get() and the iterator while
+ * the HashMap grows from a single bucket (incrementally, for the chaining
+ * engine).
+ */
+void resize_test()
+{
+    printf("Testing Resize...\n");
+    HashMap map(1, sizeof(int));
+#ifndef HASHMAP_SWISS_ENGINE
+    bool sawRehash = false;
+#endif
+    for(int x = 0; x < 10000; x++)
+    {
+        char* key = (char*)to_string(x).c_str();
+        map.set(key,&x);
+#ifndef HASHMAP_SWISS_ENGINE
+        sawRehash |= map.isRehashing();
+#endif
+
+        for(int y = 0; y <= x; y += 997)
+            assert(*(int*)map.get((char*)to_string(y).c_str()) == y);
+    }
+#ifndef HASHMAP_SWISS_ENGINE
+    assert(sawRehash);
+#endif
+
+    int count = 0;
+    for (char *key = map.firstNode(); key != NULL; key = map.nextNode(key))
+    {
+        assert(*(int*)map.get(key) == atoi(key));
+        count++;
+    }
+    assert(count == map.getSize());
+
+    for(int x = 0; x < 10000; x++)
+    {
+        void* removed = map.remove((char*)to_string(x).c_str());
+        assert(removed != NULL);
+    }
+    assert(map.getSize() == 0);
+    assert(map.firstNode() == NULL);
+}
+ /**
+ * hash_test()
+ * ----------------------------------------------------------------------------
+ * Tests that the HashMap works with each of the built-in hash functions, for
+ * both power-of-two (masked) and other (multiply-shift) bucket counts.
+ */
+void hash_test()
+{
+    printf("Testing Hash Functions...\n");
+    HashKeyFn hashFunctions[] = {multiplicativeHash, wyHash, xxh3Hash, crc32cHash};
+    int mapSizes[] = {100, 128};
+    for(int f = 0; f < 4; f++)
+    {
+        for(int s = 0; s < 2; s++)
+        {
+            HashMap map(mapSizes[s], sizeof(int), NULL, 1.0, hashFunctions[f]);
+            for(int x = 0; x < 10000; x++)
+            {
+                //vary the key lengths so the word-at-a-time paths are covered
+                string key = to_string(x) + string(x % 70, 'k');
+                map.set((char*)key.c_str(), &x);
+            }
+            assert(map.getSize() == 10000);
+            for(int x = 0; x < 10000; x++)
+            {
+                string key = to_string(x) + string(x % 70, 'k');
+                assert(*(int*)map.get((char*)key.c_str()) == x);
+            }
+        }
+    }
+
+    //the CRC32C check value for "123456789" is 0xE3069283 (before the final
+    //inversion: 0x1CF96D7C); crc32cHash mixes in the length and multiplies by
+    //the 64-bit prime 0xC2B2AE3D27D4EB4F, whichever path computed the CRC
+    const uint8_t* check = (const uint8_t*)"123456789";
+    assert(crc32cHash(check, 9) == (0x1CF96D7CULL ^ (9ULL << 32)) * 0xC2B2AE3D27D4EB4FULL);
+    assert(crc32cSoftware(0xFFFFFFFF, check, 9) == 0x1CF96D7C);
+    assert(wyHash("abc", 3) != wyHash("abd", 3));
+    assert(xxh3Hash("abc", 3) != xxh3Hash("abc", 2));
+}
+ /**
+ * key_length_test()
+ * ----------------------------------------------------------------------------
+ * Tests keys on both sides of the inline key limit of the Swiss engine
+ * (22 bytes), through growth, iteration and removal.
+ */
+void key_length_test()
+{
+    printf("Testing Key Lengths...\n");
+    HashMap map(16, sizeof(int));
+    vector<string> keys; //lengths 0 to 49, each a prefix of the next
+    for(int x = 0; x < 50; x++)
+        keys.push_back(string(x, 'k'));
+    for(int x = 0; x < 50; x++)
+    {
+        bool stored = map.set((char*)keys[x].c_str(), &x);
+        assert(stored);
+    }
+    assert(map.getSize() == 50);
+    for(int x = 0; x < 50; x++)
+        assert(*(int*)map.get((char*)keys[x].c_str()) == x);
+    assert(map.get((char*)"kkkkkkkkkkkkkkkkkkkkkkkk") != NULL); //24 bytes
+    assert(map.get((char*)"kkkkkkkkkkkkkkkkkkkkkkkkx") == NULL);
+
+    int visited = 0;
+    for(char* key = map.firstNode(); key != NULL; key = map.nextNode(key))
+    {
+        assert(*(int*)map.get(key) == (int)strlen(key));
+        visited++;
+    }
+    assert(visited == 50);
+    for(int x = 0; x < 50; x += 2)
+    {
+        void* removed = map.remove((char*)keys[x].c_str());
+        assert(removed != NULL);
+    }
+    for(int x = 0; x < 50; x++)
+        assert((map.get((char*)keys[x].c_str()) != NULL) == (x % 2 == 1));
+}
+ /**
+ * arena_test()
+ * ----------------------------------------------------------------------------
+ * Tests that NodeArena hands out aligned blocks, reuses released blocks of
+ * the same size class and tracks blocks too large to pool.
+ */
+void arena_test()
+{
+    printf("Testing Arena...\n");
+    NodeArena arena;
+    void* first = arena.allocate(40);
+    void* second = arena.allocate(33);
+    assert(((size_t)first % 16) == 0 && ((size_t)second % 16) == 0);
+    assert((char*)second - (char*)first == 48);
+
+    arena.release(first, 40);
+    assert(arena.allocate(48) == first); //same size class
+    assert(arena.allocate(40) != first);
+
+    size_t reserved = arena.getBytesReserved();
+    size_t blocks = arena.getBlocksReserved();
+    void* large = arena.allocate(10000);
+    memset(large, 0, 10000);
+    assert(arena.getBytesReserved() == reserved + 10000);
+    assert(arena.getBlocksReserved() == blocks + 1);
+    arena.release(large, 10000);
+    assert(arena.getBytesReserved() == reserved);
+    assert(arena.getBlocksReserved() == blocks);
+
+    arena.releaseAll();
+    assert(arena.getBytesReserved() == 0 && arena.getBlocksReserved() == 0);
+}
+ /**
+ * alignment_test()
+ * ----------------------------------------------------------------------------
+ * Tests that values are aligned for their size by default and to the
+ * alignment given at construction, whatever the length of their key.
+ */
+void alignment_test()
+{
+    printf("Testing Alignment...\n");
+    HashMap doubles(16, sizeof(double));
+    HashMap wide(16, 24, NULL, 1.0, NULL, 64);
+    HashMap packed(16, sizeof(double), NULL, 1.0, NULL, 1);
+    for(int x = 0; x < 200; x++)
+    {
+        string key(x % 40, 'a' + x % 26);
+        double value = x * 1.5;
+        char block[24] = {0};
+        doubles.set((char*)key.c_str(), &value);
+        wide.set((char*)key.c_str(), block);
+        packed.set((char*)key.c_str(), &value);
+        assert((uintptr_t)doubles.get((char*)key.c_str()) % alignof(double) == 0);
+        assert(*(double*)doubles.get((char*)key.c_str()) == value);
+        assert((uintptr_t)wide.get((char*)key.c_str()) % 64 == 0);
+        assert(memcmp(packed.get((char*)key.c_str()), &value, sizeof(double)) == 0);
+    }
+}
  /**
  * consistency_test()
  * ----------------------------------------------------------------------------
@@ -175,6 +377,1162 @@ void complex_delete_test()
     assert(map.getSize() == 0);
     assert(numDeleteCalled == 10000);
 }
+/**
+ * clear_test()
+ * ----------------------------------------------------------------------------
+ * Tests that clear() and the destructor call the cleanup function on every
+ * value still in the HashMap, and that a cleared HashMap can be refilled.
+ */
+void clear_test()
+{
+    printf("Testing Clear...\n");
+    int deletesBefore = numDeleteCalled;
+    {
+        HashMap map(16, sizeof(complexStruct), complexStructDelete);
+        for(int round = 0; round < 2; round++)
+        {
+            for(int x = 0; x < 5000; x++)
+            {
+                complexStruct cs;
+                cs.integer = (int*)malloc(sizeof(int));
+                *cs.integer = x;
+                map.set((char*)to_string(x).c_str(), &cs);
+            }
+            assert(map.getSize() == 5000);
+            map.clear();
+            assert(map.getSize() == 0);
+            assert(map.firstNode() == NULL);
+            assert(map.get((char*)"42") == NULL);
+        }
+        assert(numDeleteCalled == deletesBefore + 10000);
+
+        for(int x = 0; x < 100; x++) //left for the destructor
+        {
+            complexStruct cs;
+            cs.integer = (int*)malloc(sizeof(int));
+            map.set((char*)to_string(x).c_str(), &cs);
+        }
+    }
+    assert(numDeleteCalled == deletesBefore + 10100);
+
+    HashMap plain(16, sizeof(int)); //no cleanup function: nodes aren't visited
+    for(int x = 0; x < 5000; x++)
+        plain.set((char*)to_string(x).c_str(), &x);
+    plain.clear();
+    assert(plain.getSize() == 0);
+}
+/**
+ * cursor_test()
+ * ----------------------------------------------------------------------------
+ * Tests that the cursor and C++ iterators visit every entry exactly once, in
+ * the same order as firstNode/nextNode, including while the HashMap is in the
+ * middle of growing.
+ */
+void cursor_test()
+{
+    printf("Testing Cursor...\n");
+    HashMap map(4, sizeof(int));
+    for(int x = 0; x < 3000; x++)
+    {
+        map.set((char*)to_string(x).c_str(), &x);
+
+        if(x % 250 != 0)
+            continue;
+        vector<char*> keys;
+        for (char *key = map.firstNode(); key != NULL; key = map.nextNode(key))
+            keys.push_back(key);
+        assert((int)keys.size() == map.getSize());
+
+        int index = 0;
+        HashMapCursor cursor;
+        for(bool more = map.firstEntry(&cursor); more; more = map.nextEntry(&cursor))
+        {
+            assert(cursor.key == keys[index++]);
+            assert(*(int*)cursor.value == atoi(cursor.key));
+        }
+        assert(index == map.getSize() && cursor.key == NULL);
+        bool more = map.nextEntry(&cursor); //past the end stays at the end
+        assert(!more && cursor.key == NULL);
+
+        index = 0;
+        for(HashMapCursor& entry : map)
+            assert(entry.key == keys[index++]);
+        assert(index == map.getSize());
+    }
+}
+#ifndef HASHMAP_SWISS_ENGINE
+/**
+ * end_iteration_test()
+ * ----------------------------------------------------------------------------
+ * Tests that get() holds a rehash back while any iteration is open, even after
+ * an inner one runs out, that endIteration() lets it go on, and that
+ * getModificationCount() moves with every change but not with lookups.
+ */
+void end_iteration_test()
+{
+    printf("Testing End Iteration...\n");
+    HashMap map(64, sizeof(int));
+    int keys = 0;
+    for(; !map.isRehashing(); keys++)
+        map.set((char*)to_string(keys).c_str(), &keys);
+    uint64_t modifications = map.getModificationCount();
+
+    HashMapCursor outer, inner;
+    bool more = map.firstEntry(&outer);
+    assert(more);
+    int count = 0;
+    for(bool innerMore = map.firstEntry(&inner); innerMore; innerMore = map.nextEntry(&inner))
+        count++;
+    assert(count == map.getSize());
+    for(int x = 0; x < 1000; x++)
+        assert(*(int*)map.get((char*)to_string(x % keys).c_str()) == x % keys);
+    assert(map.isRehashing()); //the outer iteration is still open
+    assert(map.getModificationCount() == modifications);
+
+    map.endIteration(&outer);
+    more = map.nextEntry(&outer);
+    assert(!more && outer.key == NULL);
+    for(int x = 0; x < 1000 && map.isRehashing(); x++)
+        map.get((char*)"0");
+    assert(!map.isRehashing());
+
+    bool stored = map.set((char*)"new", &keys);
+    assert(stored && map.getModificationCount() == modifications + 1);
+    void* removed = map.remove((char*)"new");
+    assert(removed != NULL && map.getModificationCount() == modifications + 2);
+    assert(map.get((char*)"new") == NULL && map.getModificationCount() == modifications + 2);
+    map.clear();
+    assert(map.getModificationCount() == modifications + 3);
+}
+#endif
+/**
+ * get_many_test()
+ * ----------------------------------------------------------------------------
+ * Tests that getMany() returns the same value pointers as get() for batches
+ * of present and missing keys, including a partial last batch.
+ */
+void get_many_test()
+{
+    printf("Testing Get Many...\n");
+    HashMap map(64, sizeof(int));
+    for(int x = 0; x < 1000; x += 2) //even keys only
+        map.set((char*)to_string(x).c_str(), &x);
+
+    vector<string> keyStrings;
+    for(int x = 0; x < 1000; x += 3)
+        keyStrings.push_back(to_string(x));
+    vector<char*> keys;
+    for(size_t x = 0; x < keyStrings.size(); x++)
+        keys.push_back((char*)keyStrings[x].c_str());
+
+    vector<void*> values(keys.size());
+    int found = map.getMany(keys.data(), keys.size(), values.data());
+
+    int expected = 0;
+    for(size_t x = 0; x < keys.size(); x++)
+    {
+        assert(values[x] == map.get(keys[x]));
+        expected += (values[x] != NULL);
+    }
+    assert(found == expected && found == 167);
+    assert(map.getMany(keys.data(), 0, values.data()) == 0);
+}
+/**
+ * setToOne(), addInts()
+ * ----------------------------------------------------------------------------
+ * InitValueFn/MergeValueFn callbacks used by upsert_test().
+ */
+void setToOne(void* addr)
+{
+    *(int*)addr = 1;
+}
+void addInts(void* existing, void* addr)
+{
+    *(int*)existing += *(int*)addr;
+}
+/**
+ * upsert_test()
+ * ----------------------------------------------------------------------------
+ * Tests counting with getOrInsert() and upsert() against the get()/set()
+ * loop of update_test().
+ */
+void upsert_test()
+{
+    printf("Testing Upsert...\n");
+    HashMap counts(8, sizeof(int));
+    HashMap sums(8, sizeof(int));
+    HashMap initialized(8, sizeof(int));
+    for(int x = 0; x < 20000; x++)
+    {
+        char* key = (char*)to_string(x % 97).c_str();
+        int* count = (int*)counts.getOrInsert(key, NULL); //zero-filled
+        (*count)++;
+
+        int one = 1;
+        sums.upsert(key, &one, addInts);
+
+        int* value = (int*)initialized.getOrInsert(key, setToOne);
+        assert(*value >= 1);
+    }
+    assert(counts.getSize() == 97 && sums.getSize() == 97);
+    for(int x = 0; x < 97; x++)
+    {
+        char* key = (char*)to_string(x).c_str();
+        int expected = 20000/97 + (x < 20000 % 97);
+        assert(*(int*)counts.get(key) == expected);
+        assert(*(int*)sums.get(key) == expected);
+        assert(*(int*)initialized.get(key) == 1);
+    }
+}
+/**
+ * binary_key_test()
+ * ----------------------------------------------------------------------------
+ * Tests (key, length) keys with embedded zero bytes on both sides of the
+ * inline key limit: keys that only differ after a '\0' or in trailing zeros
+ * stay apart, string keys and their bytes name the same entry, and cursors
+ * report each key's length.
+ */
+void binary_key_test()
+{
+    printf("Testing Binary Keys...\n");
+    HashMap map(16, sizeof(int));
+    vector<string> keys;
+    for(int x = 0; x < 40; x++)
+    {
+        keys.push_back(string(x, '\0')); //"", "\0", "\0\0", ...
+        keys.push_back(string("id") + string(x, '\0') + char('A' + x % 26));
+    }
+    for(int x = 0; x < (int)keys.size(); x++)
+    {
+        bool stored = map.set(keys[x].data(), keys[x].size(), &x);
+        assert(stored);
+    }
+    assert(map.getSize() == (int)keys.size());
+    for(int x = 0; x < (int)keys.size(); x++)
+        assert(*(int*)map.get(keys[x].data(), keys[x].size()) == x);
+    assert(map.get("id\0", 3) == NULL);
+
+    //the empty binary key and the empty string are the same key
+    assert(*(int*)map.get((char*)"") == 0);
+    int value = 7;
+    bool stored = map.set((char*)"plain", &value);
+    assert(stored);
+    assert(*(int*)map.get("plain", 5) == 7);
+    assert(map.get("plain", 6) == NULL);
+    assert(*(int*)map.getOrInsert("plain", 5, NULL) == 7);
+    stored = map.upsert("plain", 5, &value, addInts);
+    assert(stored);
+    assert(*(int*)map.get((char*)"plain") == 14);
+    void* removed = map.remove("plain", 5);
+    assert(removed != NULL && map.get((char*)"plain") == NULL);
+
+    int visited = 0;
+    for(HashMapCursor& entry : map)
+    {
+        int index = *(int*)entry.value;
+        assert(entry.keyLength == keys[index].size());
+        assert(memcmp(entry.key, keys[index].data(), entry.keyLength) == 0);
+        assert(entry.key[entry.keyLength] == '\0');
+        visited++;
+    }
+    assert(visited == map.getSize());
+
+    for(int x = 0; x < (int)keys.size(); x += 2)
+    {
+        removed = map.remove(keys[x].data(), keys[x].size());
+        assert(removed != NULL);
+    }
+    for(int x = 0; x < (int)keys.size(); x++)
+        assert((map.get(keys[x].data(), keys[x].size()) != NULL) == (x % 2 == 1));
+}
+/**
+ * snapshot_test()
+ * ----------------------------------------------------------------------------
+ * Tests that a snapshot saved in the middle of a rehash can be mapped by
+ * another HashMap and serves every key (string and binary) from the file,
+ * that the mapped map is read-only until cleared, and that maps with a
+ * different value size or hash function refuse the file.
+ */
+void snapshot_test()
+{
+    printf("Testing Snapshots...\n");
+    const char* path = "maptest_snapshot.bin";
+    ChainedHashMap map(64, 2 * sizeof(double));
+    for(int x = 0; x < 5000; x++)
+    {
+        double value[2] = {(double)x, -(double)x};
+        map.set((char*)to_string(x).c_str(), value);
+    }
+    uint64_t id = 0xFF00FF00ULL;
+    double idValue[2] = {0.5, 0.25};
+    map.set(&id, sizeof(id), idValue);
+    assert(map.isRehashing());
+
+    //saving in the middle of an iteration doesn't end it
+    int visited = 0;
+    bool saved = false;
+    HashMapCursor cursor;
+    for(bool more = map.firstEntry(&cursor); more; more = map.nextEntry(&cursor))
+    {
+        if(visited++ == 100)
+            saved = map.saveSnapshot(path);
+        //would move nodes under the cursor if the iteration had ended
+        assert(map.get(cursor.key, cursor.keyLength) == cursor.value);
+    }
+    assert(saved && visited == 5001 && map.isRehashing());
+
+    ChainedHashMap mapped(4, 2 * sizeof(double));
+    mapped.set((char*)"dropped", idValue);
+    bool opened = mapped.openSnapshot(path);
+    assert(opened && mapped.isSnapshot());
+    assert(mapped.getSize() == 5001 && mapped.get((char*)"dropped") == NULL);
+    for(int x = 0; x < 5000; x++)
+    {
+        double* stored = (double*)mapped.get((char*)to_string(x).c_str());
+        assert(stored != NULL && stored[0] == x && stored[1] == -x);
+        assert((size_t)stored % alignof(double) == 0);
+    }
+    assert(((double*)mapped.get(&id, sizeof(id)))[1] == 0.25);
+    assert(mapped.get((char*)"5000") == NULL);
+
+    char* keys[2] = {(char*)"17", (char*)"missing"};
+    void* values[2];
+    assert(mapped.getMany(keys, 2, values) == 1 && values[0] == mapped.get(keys[0]) && values[1] == NULL);
+
+    visited = 0;
+    for(HashMapCursor& entry : mapped)
+    {
+        assert(entry.value == mapped.get(entry.key, entry.keyLength));
+        visited++;
+    }
+    assert(visited == 5001);
+    visited = 0;
+    for(char* key = mapped.firstNode(); key != NULL; key = mapped.nextNode(key))
+        visited++;
+    assert(visited == 5001);
+
+    //a snapshot is read-only until it is cleared
+    bool stored = mapped.set((char*)"17", idValue);
+    void* removed = mapped.remove((char*)"17");
+    void* inserted = mapped.getOrInsert((char*)"new", NULL);
+    assert(!stored && removed == NULL && inserted == NULL && mapped.getSize() == 5001);
+    mapped.clear();
+    assert(!mapped.isSnapshot() && mapped.getSize() == 0);
+    stored = mapped.set((char*)"17", idValue);
+    assert(stored && mapped.get((char*)"17") != NULL);
+
+    ChainedHashMap wrongSize(4, sizeof(double));
+    opened = wrongSize.openSnapshot(path);
+    assert(!opened && !wrongSize.isSnapshot());
+    ChainedHashMap wrongHash(4, 2 * sizeof(double), NULL, 1.0, xxh3Hash);
+    opened = wrongHash.openSnapshot(path);
+    assert(!opened);
+    opened = mapped.openSnapshot("maptest_missing.bin");
+    assert(!opened && mapped.getSize() == 1);
+    remove(path);
+
+    //corrupt links end their chain instead of leaving the file or looping;
+    //the 64 byte header is followed by the only bucket
+    ChainedHashMap chain(1, sizeof(int), NULL, 100.0);
+    for(int x = 0; x < 3; x++)
+        chain.set((char*)to_string(x).c_str(), &x);
+    saved = chain.saveSnapshot(path);
+    assert(saved);
+    FILE* file = fopen(path, "r+b");
+    uint64_t head, fileSize;
+    fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    fseek(file, 64, SEEK_SET);
+    size_t read = fread(&head, sizeof(head), 1, file);
+    assert(read == 1 && head > 64 && head < fileSize);
+    fseek(file, head, SEEK_SET); //the head node links back to itself
+    fwrite(&head, sizeof(head), 1, file);
+    fclose(file);
+    opened = chain.openSnapshot(path);
+    assert(opened && chain.get((char*)"3") == NULL);
+    visited = 0;
+    for(char* key = chain.firstNode(); key != NULL; key = chain.nextNode(key))
+        visited++;
+    assert(visited == 1);
+
+    file = fopen(path, "r+b");
+    head = fileSize + 4096; //the bucket points past the end of the file
+    fseek(file, 64, SEEK_SET);
+    fwrite(&head, sizeof(head), 1, file);
+    fclose(file);
+    chain.clear();
+    opened = chain.openSnapshot(path);
+    assert(opened && chain.get((char*)"0") == NULL && chain.firstNode() == NULL);
+
+    //a value offset that only fits when its sum with the element size wraps
+    //at 32 bits is rejected; it is kept aligned so only the bounds check fails
+    ChainedHashMap wide(1, 64, NULL, 100.0);
+    char block[64] = {0};
+    wide.set((char*)"0", block);
+    saved = wide.saveSnapshot(path);
+    assert(saved);
+    file = fopen(path, "r+b");
+    fseek(file, 64, SEEK_SET);
+    read = fread(&head, sizeof(head), 1, file);
+    assert(read == 1);
+    uint32_t valueOffset = UINT32_MAX - 63; //+ 64 wraps to 0
+    fseek(file, head + 20, SEEK_SET); //after next, hashCode and keyLength
+    fwrite(&valueOffset, sizeof(valueOffset), 1, file);
+    fclose(file);
+    opened = wide.openSnapshot(path);
+    assert(opened && wide.get((char*)"0") == NULL && wide.firstNode() == NULL);
+    remove(path);
+}
+/**
+ * view_test()
+ * ----------------------------------------------------------------------------
+ * Tests HashMap::openView(): a reader thread saves and walks a view while the
+ * writer updates, removes and inserts keys (growing the map), and the cleanup
+ * calls for replaced values wait until the view is released.
+ */
+static int viewCleanups = 0;
+void countViewCleanup(void* addr)
+{
+    viewCleanups++;
+}
+void view_test()
+{
+    printf("Testing Views...\n");
+    const char* path = "maptest_view.bin";
+    const int KEYS = 5000;
+    ChainedHashMap map(64, sizeof(int), countViewCleanup);
+    for(int x = 0; x < KEYS; x++)
+        map.set((char*)to_string(x).c_str(), &x);
+
+    HashMapView* view = map.openView();
+    HashMapView* second = map.openView();
+    assert(view != NULL && second == NULL && view->getSize() == KEYS);
+    thread reader([view, path, KEYS]() {
+        bool saved = view->saveSnapshot(path);
+        assert(saved);
+        long sum = 0;
+        int visited = 0;
+        HashMapCursor cursor;
+        for(bool more = view->firstEntry(&cursor); more; more = view->nextEntry(&cursor))
+        {
+            assert(view->get(cursor.key, cursor.keyLength) == cursor.value);
+            sum += *(int*)cursor.value;
+            visited++;
+        }
+        assert(visited == KEYS && sum == (long)KEYS * (KEYS - 1) / 2);
+        bool more = view->nextEntry(&cursor); //a finished cursor stays finished
+        assert(!more && cursor.key == NULL);
+        assert(*(int*)view->get((char*)"17") == 17 && view->get((char*)"new0") == NULL);
+    });
+    for(int x = 0; x < KEYS; x++)
+    {
+        int negated = -x;
+        map.set((char*)to_string(x).c_str(), &negated);
+        if(x % 3 == 0)
+            map.remove((char*)to_string(x).c_str());
+        map.set((char*)("new" + to_string(x)).c_str(), &x);
+    }
+    reader.join();
+
+    //the replaced values are cleaned up once the view is released
+    assert(viewCleanups == 0);
+    view->release();
+    int one = 1;
+    bool stored = map.set((char*)"after", &one);
+    assert(stored && viewCleanups == KEYS + (KEYS + 2) / 3);
+    assert(*(int*)map.get((char*)"17") == -17 && map.get((char*)"18") == NULL);
+    assert(map.getSize() == 2 * KEYS - (KEYS + 2) / 3 + 1);
+
+    ChainedHashMap saved(4, sizeof(int));
+    bool opened = saved.openSnapshot(path);
+    assert(opened && saved.getSize() == KEYS);
+    assert(*(int*)saved.get((char*)"18") == 18 && saved.get((char*)"new0") == NULL);
+    remove(path);
+
+    //clear() keeps the nodes alive for an open view
+    viewCleanups = 0;
+    int live = map.getSize();
+    view = map.openView();
+    opened = map.openSnapshot(path);
+    assert(view != NULL && !opened);
+    map.clear();
+    assert(map.getSize() == 0 && view->getSize() == live && *(int*)view->get((char*)"new1") == 1);
+    assert(viewCleanups == 0);
+    view->release();
+    view = map.openView(); //reclaims the released view
+    assert(view != NULL && view->getSize() == 0 && viewCleanups == live);
+    view->release();
+}
+/**
+ * stats_test()
+ * ----------------------------------------------------------------------------
+ * Tests that stats(0) accounts for every key and bucket on the selected
+ * engine, that the default sample stays small and close to the full walk,
+ * reports the exact chain shape of a ChainedHashMap whose keys all collide,
+ * and combines the shards of a ConcurrentHashMap.
+ */
+uint64_t collidingHash(const void* key, size_t length)
+{
+    return 0;
+}
+void stats_test()
+{
+    printf("Testing Stats...\n");
+    HashMap map(64, sizeof(int));
+    HashMapStats empty = map.stats();
+    assert(empty.numberOfElements == 0 && empty.emptyBucketFraction == 1.0);
+    assert(empty.maxChainLength == 0 && empty.successfulProbes == 0);
+    assert(empty.keyBytes == 0 && empty.allocations > 0);
+
+    size_t keyBytes = 0;
+    for(int x = 0; x < 1000; x++)
+    {
+        string key = "stats" + to_string(x);
+        map.set((char*)key.c_str(), &x);
+        keyBytes += key.size();
+    }
+    HashMapStats stats = map.stats(0);
+    int buckets = 0, keys = 0;
+    for(int bin = 0; bin < STATS_HISTOGRAM_SIZE; bin++)
+    {
+        buckets += stats.chainLengths[bin];
+        keys += stats.probeDistances[bin];
+    }
+    assert(stats.numberOfElements == 1000 && keys == 1000);
+    assert(buckets == stats.numberOfBuckets && stats.sampledBuckets == stats.numberOfBuckets);
+    assert(stats.keyBytes == keyBytes && stats.valueBytes == 1000*sizeof(int));
+    assert(stats.successfulProbes >= 1 && stats.unsuccessfulProbes > 0);
+    assert(stats.emptyBucketFraction >= 0 && stats.emptyBucketFraction < 1);
+    assert(stats.maxChainLength > 0 && stats.maxProbeDistance < stats.numberOfBuckets);
+    assert(stats.overheadBytes > 0 && stats.allocations > 0);
+
+    //the default walks a fixed sample of a large table
+    for(int x = 1000; x < 100000; x++)
+    {
+        string key = "stats" + to_string(x);
+        map.set((char*)key.c_str(), &x);
+        keyBytes += key.size();
+    }
+    HashMapStats full = map.stats(0);
+    HashMapStats sampled = map.stats();
+    assert(full.keyBytes == keyBytes && sampled.numberOfBuckets == full.numberOfBuckets);
+    assert(sampled.sampledBuckets <= STATS_SAMPLE_BUCKETS && sampled.sampledBuckets < full.sampledBuckets);
+    assert(sampled.keyBytes > keyBytes*0.9 && sampled.keyBytes < keyBytes*1.1);
+    assert(fabs(sampled.unsuccessfulProbes - full.unsuccessfulProbes) < 0.2*full.unsuccessfulProbes);
+    assert(fabs(sampled.successfulProbes - full.successfulProbes) < 0.2*full.successfulProbes);
+
+    //8 keys chained into one of 4 buckets: the x-th key is found in x+1 probes
+    ChainedHashMap chained(4, sizeof(int), NULL, 0, collidingHash);
+    for(int x = 0; x < 8; x++)
+        chained.set((char*)to_string(x).c_str(), &x);
+    stats = chained.stats();
+    assert(stats.numberOfBuckets == 4 && stats.maxChainLength == 8);
+    assert(stats.chainLengths[0] == 3 && stats.chainLengths[8] == 1);
+    assert(stats.emptyBucketFraction == 0.75);
+    for(int x = 0; x < 8; x++)
+        assert(stats.probeDistances[x] == 1);
+    assert(stats.maxProbeDistance == 7);
+    assert(stats.successfulProbes == 4.5 && stats.unsuccessfulProbes == 2.0);
+    assert(stats.keyBytes == 8 && stats.valueBytes == 8*sizeof(int));
+
+    ConcurrentHashMap sharded(16, sizeof(int), NULL, 4);
+    for(int x = 0; x < 1000; x++)
+        sharded.set((char*)to_string(x).c_str(), &x);
+    stats = sharded.stats();
+    assert(stats.numberOfElements == 1000 && stats.valueBytes == 1000*sizeof(int));
+    assert(stats.successfulProbes >= 1 && stats.numberOfBuckets >= 16);
+    assert(stats.sampledBuckets > 0 && stats.sampledBuckets <= stats.numberOfBuckets);
+}
+#ifdef HASHMAP_INSTRUMENT
+/**
+ * instrument_test()
+ * ----------------------------------------------------------------------------
+ * Tests the HASHMAP_INSTRUMENT counters and latency samples of the selected
+ * engine, and that the per-thread records of a ConcurrentHashMap add up.
+ */
+void instrument_test()
+{
+    printf("Testing Instrumentation...\n");
+    HashMap map(16, sizeof(int));
+    MapInstrumentation* instrumentation = map.getInstrumentation();
+    assert(instrumentation->getPercentile(INSTRUMENT_GET, 0.99) == 0);
+
+    for(int x = 0; x < 1000; x++)
+        map.set((char*)to_string(x).c_str(), &x);
+    int zero = 0;
+    map.set((char*)"0", &zero);
+    for(int x = 0; x < 1010; x++)
+        map.get((char*)to_string(x).c_str());
+    for(int x = 0; x < 501; x++)
+        map.remove((char*)to_string(x * 2).c_str());
+
+    assert(instrumentation->getCount(INSTRUMENT_INSERTS) == 1000);
+    assert(instrumentation->getCount(INSTRUMENT_UPDATES) == 1);
+    assert(instrumentation->getCount(INSTRUMENT_HITS) == 1000);
+    assert(instrumentation->getCount(INSTRUMENT_REMOVES) == 500);
+    assert(instrumentation->getCount(INSTRUMENT_MISSES) == 11);
+    assert(instrumentation->getCount(INSTRUMENT_RESIZES) > 0);
+
+    //the first operation of the thread and every INSTRUMENT_SAMPLE_PERIOD-th after it
+    uint64_t samples = 0;
+    for(int op = 0; op < NUMBER_OF_INSTRUMENTED_OPERATIONS; op++)
+        samples += instrumentation->getSampleCount((InstrumentedOperation)op);
+    assert(samples == (2512 + INSTRUMENT_SAMPLE_PERIOD - 1) / INSTRUMENT_SAMPLE_PERIOD);
+    assert(instrumentation->getSampleCount(INSTRUMENT_SET) > 0);
+    uint64_t median = instrumentation->getPercentile(INSTRUMENT_SET, 0.5);
+    assert(median <= instrumentation->getPercentile(INSTRUMENT_SET, 0.99));
+    assert(instrumentation->getPercentile(INSTRUMENT_SET, 1.0) == instrumentation->getMaxLatency(INSTRUMENT_SET));
+
+    ConcurrentHashMap sharded(16, sizeof(int), NULL, 4);
+    vector<thread> threads;
+    for(int t = 0; t < 4; t++)
+    {
+        threads.push_back(thread([&sharded, t]() {
+            int value;
+            for(int x = 0; x < 1000; x++)
+            {
+                string key = to_string(t) + "-" + to_string(x);
+                sharded.set((char*)key.c_str(), &x);
+                bool found = sharded.get((char*)key.c_str(), &value);
+                assert(found && value == x);
+            }
+        }));
+    }
+    for(thread& worker : threads)
+        worker.join();
+    instrumentation = sharded.getInstrumentation();
+    assert(instrumentation->getCount(INSTRUMENT_INSERTS) == 4000);
+    assert(instrumentation->getCount(INSTRUMENT_HITS) == 4000);
+    assert(instrumentation->getCount(INSTRUMENT_RESIZES) > 0);
+    assert(instrumentation->getSampleCount(INSTRUMENT_SET) + instrumentation->getSampleCount(INSTRUMENT_GET)
+           == 4 * ((2000 + INSTRUMENT_SAMPLE_PERIOD - 1) / INSTRUMENT_SAMPLE_PERIOD));
+}
+#endif
+/**
+ * int_map_test()
+ * ----------------------------------------------------------------------------
+ * Tests IntHashMap with sequential and scattered ids, removal with backward
+ * shifting, iteration and the reserved empty key.
+ */
+void int_map_test()
+{
+    printf("Testing Int Map...\n");
+    IntHashMap map(4, sizeof(int));
+    for(uint64_t x = 0; x < 100000; x++)
+    {
+        int value = (int)x;
+        bool stored = map.set(x * 7919, &value); //scattered over the table
+        assert(stored);
+    }
+    assert(map.getSize() == 100000 && map.getLoadFactor() <= 0.75);
+    for(uint64_t x = 0; x < 100000; x += 2)
+    {
+        int* removed = (int*)map.remove(x * 7919);
+        assert(*removed == (int)x);
+    }
+    void* removed = map.remove(2 * 7919);
+    assert(removed == NULL && map.getSize() == 50000);
+    for(uint64_t x = 0; x < 100000; x++)
+    {
+        int* value = (int*)map.get(x * 7919);
+        assert((x % 2 == 0) ? value == NULL : *value == (int)x);
+    }
+
+    int visited = 0;
+    for(const uint64_t* key = map.firstNode(); key != NULL; key = map.nextNode(key))
+    {
+        assert(*key % 7919 == 0 && *(int*)map.get(*key) == (int)(*key / 7919));
+        visited++;
+    }
+    for(IntHashMapCursor& entry : map)
+        assert(*(int*)entry.value == (int)(entry.key / 7919));
+    assert(visited == 50000);
+
+    int one = 1;
+    bool stored = map.set(INT_MAP_EMPTY_KEY, &one);
+    assert(!stored && map.get(INT_MAP_EMPTY_KEY) == NULL);
+    IntHashMap counts(0, sizeof(int));
+    for(int x = 0; x < 1000; x++)
+    {
+        counts.upsert(x % 10, &one, addInts);
+        (*(int*)counts.getOrInsert(x % 20 + 100, setToOne))++;
+    }
+    assert(*(int*)counts.get(3) == 100 && *(int*)counts.get(105) == 51);
+    counts.clear();
+    assert(counts.getSize() == 0 && counts.get(3) == NULL);
+}
+/**
+ * concurrent_test()
+ * ----------------------------------------------------------------------------
+ * Tests ConcurrentHashMap with several threads setting, reading, merging and
+ * removing keys at the same time.
+ */
+void concurrent_test()
+{
+    printf("Testing Concurrent...\n");
+    const int THREADS = 8;
+    const int KEYS_PER_THREAD = 5000;
+    ConcurrentHashMap map(16, sizeof(int), NULL, 8);
+    assert(map.getShardCount() == 8 && map.getElementSize() == sizeof(int));
+
+    vector<thread> threads;
+    for(int t = 0; t < THREADS; t++)
+    {
+        threads.push_back(thread([&map, t, KEYS_PER_THREAD]() {
+            for(int x = 0; x < KEYS_PER_THREAD; x++)
+            {
+                //every thread owns its own keys...
+                string key = to_string(t) + "-" + to_string(x);
+                int value = x;
+                map.set((char*)key.c_str(), &value);
+                int out = -1;
+                bool found = map.get((char*)key.c_str(), &out);
+                assert(found && out == x);
+                if(x % 2 == 1)
+                {
+                    bool removed = map.remove((char*)key.c_str());
+                    assert(removed);
+                }
+
+                //...and all of them bump the same shared counters
+                int one = 1;
+                string counter = "counter" + to_string(x % 10);
+                map.upsert((char*)counter.c_str(), &one, addInts);
+            }
+        }));
+    }
+    for(int t = 0; t < THREADS; t++)
+        threads[t].join();
+
+    assert(map.getSize() == THREADS * KEYS_PER_THREAD / 2 + 10);
+    for(int x = 0; x < 10; x++)
+    {
+        int count = 0;
+        bool found = map.get((char*)("counter" + to_string(x)).c_str(), &count);
+        assert(found && count == THREADS * KEYS_PER_THREAD / 10);
+    }
+    int out;
+    bool found = map.get((char*)"0-1", &out);
+    assert(!found);
+    found = map.get((char*)"7-4998", &out);
+    assert(found && out == 4998);
+    map.clear();
+    assert(map.getSize() == 0);
+}
+/**
+ * log_test()
+ * ----------------------------------------------------------------------------
+ * Tests recovery from a snapshot plus the write-ahead log written since it,
+ * replay of a log written by several threads into a ConcurrentHashMap, that
+ * a torn record at the end of a log is ignored and cut off, that replay stops
+ * at a lost record and reopening drops what follows it, that values of the
+ * wrong size are refused, and that a record sync() acknowledged while other
+ * threads were appending is replayed from the log as it stood at that point.
+ */
+void log_test()
+{
+    printf("Testing Write-Ahead Log...\n");
+    const char* snapshotPath = "maptest_log.snapshot";
+    const char* logPath = "maptest_log.wal";
+    remove(logPath);
+    {
+        ChainedHashMap map(16, sizeof(int));
+        WriteAheadLog log(logPath, 500);
+        assert(log.isOpen());
+        map.setLog(&log);
+        for(int x = 0; x < 2000; x++)
+            map.set((char*)to_string(x).c_str(), &x);
+        bool saved = map.saveSnapshot(snapshotPath);
+        bool truncated = log.truncate();
+        assert(saved && truncated);
+
+        for(int x = 0; x < 2000; x += 3)
+            map.remove((char*)to_string(x).c_str());
+        int one = 1;
+        for(int x = 0; x < 100; x++)
+            map.upsert((char*)"counter", &one, addInts);
+        int* inserted = (int*)map.getOrInsert((char*)"inserted", setToOne);
+        assert(*inserted == 1);
+        uint64_t id = 0xABCD0000ULL;
+        map.set(&id, sizeof(id), &one);
+        bool synced = log.sync();
+        assert(synced && log.getSequence() == 2000 + 667 + 100 + 2);
+
+        ChainedHashMap recovered(16, sizeof(int));
+        bool loaded = recovered.loadSnapshot(snapshotPath);
+        assert(loaded && recovered.getSize() == 2000);
+        long replayedRecords = WriteAheadLog::replay(logPath, &recovered);
+        assert(replayedRecords == 667 + 100 + 2);
+        assert(recovered.getSize() == map.getSize());
+        for(HashMapCursor& entry : map)
+            assert(*(int*)recovered.get(entry.key, entry.keyLength) == *(int*)entry.value);
+        map.clear();
+        map.setLog(NULL);
+    }
+    {
+        //the log was left holding a clear; reopening it carries on its numbering
+        WriteAheadLog log(logPath);
+        assert(log.getSequence() == 2000 + 667 + 100 + 3);
+        bool truncated = log.truncate();
+        assert(truncated);
+
+        const int THREADS = 4;
+        ConcurrentHashMap map(16, sizeof(int), NULL, 8);
+        map.setLog(&log);
+        vector<thread> threads;
+        for(int t = 0; t < THREADS; t++)
+        {
+            threads.push_back(thread([&map, t]{
+                for(int x = 0; x < 3000; x++)
+                {
+                    int value = x * THREADS + t; //threads race on the same keys
+                    string key = to_string(x % 500);
+                    map.set((char*)key.c_str(), &value);
+                    if(x % 7 == t)
+                        map.remove((char*)key.c_str());
+                }
+            }));
+        }
+        for(int t = 0; t < THREADS; t++)
+            threads[t].join();
+        map.setLog(NULL);
+        bool synced = log.sync();
+        assert(synced);
+
+        ConcurrentHashMap recovered(16, sizeof(int), NULL, 8);
+        long replayedRecords = WriteAheadLog::replay(logPath, &recovered);
+        assert(replayedRecords == (long)(log.getSequence() - 2000 - 667 - 100 - 3));
+        assert(recovered.getSize() == map.getSize());
+        for(int x = 0; x < 500; x++)
+        {
+            int expected = -1, actual = -1;
+            bool found = map.get((char*)to_string(x).c_str(), &expected);
+            bool recoveredFound = recovered.get((char*)to_string(x).c_str(), &actual);
+            assert(recoveredFound == found && actual == expected);
+        }
+    }
+
+    //a torn record at the end is skipped by replay and cut off on reopening
+    ChainedHashMap replayed(16, sizeof(int));
+    long records = WriteAheadLog::replay(logPath, &replayed);
+    FILE* file = fopen(logPath, "ab");
+    fwrite("torn record", 1, 11, file);
+    fclose(file);
+    replayed.clear();
+    long replayedRecords = WriteAheadLog::replay(logPath, &replayed);
+    assert(replayedRecords == records);
+    {
+        WriteAheadLog log(logPath);
+        ChainedHashMap map(16, sizeof(int));
+        map.setLog(&log);
+        int value = 42;
+        map.set((char*)"after", &value);
+        map.setLog(NULL);
+    }
+    ChainedHashMap reopened(16, sizeof(int));
+    replayedRecords = WriteAheadLog::replay(logPath, &reopened);
+    assert(replayedRecords == records + 1);
+    assert(*(int*)reopened.get((char*)"after") == 42);
+    replayedRecords = WriteAheadLog::replay("maptest_missing.wal", &reopened);
+    assert(replayedRecords == -1);
+
+    //values of another size are refused before anything is applied
+    HashMap doubles(16, sizeof(double));
+    doubles.set((char*)"kept", &reopened);
+    replayedRecords = WriteAheadLog::replay(logPath, &doubles);
+    assert(replayedRecords == -1 && doubles.getSize() == 1);
+
+    //a record lost from the middle stops replay, and reopening drops the
+    //records after it. Each record of a one byte key and an int is 29 bytes
+    //(a 24 byte header, the key and the value) after the 16 byte file header.
+    const size_t RECORD = 29, START = 16;
+    vector<char> original;
+    for(int lost = 0; lost < 2; lost++)
+    {
+        remove(logPath);
+        {
+            WriteAheadLog log(logPath);
+            ChainedHashMap map(16, sizeof(int));
+            map.setLog(&log);
+            for(int x = 0; x < 4; x++)
+                map.set((char*)string(1, 'a' + x).c_str(), &x);
+            map.setLog(NULL);
+        }
+        file = fopen(logPath, "rb");
+        original.resize(START + 4 * RECORD);
+        size_t read = fread(original.data(), 1, original.size(), file);
+        fclose(file);
+        assert(read == original.size());
+        //either drop c (original a b d) or drop c and write d before b (a d b)
+        vector<char> damaged(original.begin(), original.begin() + START + RECORD);
+        if(lost == 0)
+            damaged.insert(damaged.end(), original.begin() + START + RECORD, original.begin() + START + 2 * RECORD);
+        damaged.insert(damaged.end(), original.begin() + START + 3 * RECORD, original.end());
+        if(lost == 1)
+            damaged.insert(damaged.end(), original.begin() + START + RECORD, original.begin() + START + 2 * RECORD);
+        file = fopen(logPath, "wb");
+        fwrite(damaged.data(), 1, damaged.size(), file);
+        fclose(file);
+
+        ChainedHashMap partial(16, sizeof(int));
+        replayedRecords = WriteAheadLog::replay(logPath, &partial);
+        assert(replayedRecords == 2 && partial.get((char*)"b") != NULL && partial.get((char*)"d") == NULL);
+        {
+            WriteAheadLog log(logPath);
+            assert(log.isOpen() && log.getSequence() == 2);
+            ChainedHashMap map(16, sizeof(int));
+            map.setLog(&log);
+            int value = 42;
+            map.set((char*)"e", &value);
+            map.setLog(NULL);
+        }
+        partial.clear();
+        replayedRecords = WriteAheadLog::replay(logPath, &partial);
+        assert(replayedRecords == 3 && partial.get((char*)"d") == NULL);
+        assert(*(int*)partial.get((char*)"b") == 1 && *(int*)partial.get((char*)"e") == 42);
+    }
+
+    //the log only grows while the threads run, so its length when sync()
+    //returned marks what a crash at that point would have left on disk
+    const char* crashPath = "maptest_crash.wal";
+    const int THREADS = 4, SYNCS = 50, RECORDS_PER_SYNC = 20;
+    vector<off_t> syncedLengths[THREADS];
+    remove(logPath);
+    {
+        WriteAheadLog log(logPath, 50);
+        vector<thread> threads;
+        for(int t = 0; t < THREADS; t++)
+        {
+            threads.push_back(thread([&log, &syncedLengths, logPath, t]{
+                for(int x = 0; x < SYNCS * RECORDS_PER_SYNC; x++)
+                {
+                    string key = to_string(t) + "-" + to_string(x);
+                    log.logSet(key.c_str(), key.size(), &x, sizeof(int));
+                    if(x % RECORDS_PER_SYNC != RECORDS_PER_SYNC - 1)
+                        continue;
+                    bool synced = log.sync();
+                    struct stat info;
+                    int statResult = stat(logPath, &info);
+                    assert(synced && statResult == 0);
+                    syncedLengths[t].push_back(info.st_size);
+                }
+            }));
+        }
+        for(int t = 0; t < THREADS; t++)
+            threads[t].join();
+    }
+    struct stat info;
+    int statResult = stat(logPath, &info);
+    assert(statResult == 0);
+    file = fopen(logPath, "rb");
+    vector<char> written(info.st_size);
+    size_t read = fread(written.data(), 1, written.size(), file);
+    fclose(file);
+    assert(read == written.size());
+    for(int t = 0; t < THREADS; t++)
+        for(int x = 0; x < SYNCS; x++)
+        {
+            file = fopen(crashPath, "wb");
+            fwrite(written.data(), 1, syncedLengths[t][x], file);
+            fclose(file);
+            ChainedHashMap crashed(16, sizeof(int));
+            replayedRecords = WriteAheadLog::replay(crashPath, &crashed);
+            int last = (x + 1) * RECORDS_PER_SYNC - 1; //the record just before the sync
+            int* value = (int*)crashed.get((char*)(to_string(t) + "-" + to_string(last)).c_str());
+            assert(replayedRecords > last && value != NULL && *value == last);
+        }
+    remove(crashPath);
+    remove(snapshotPath);
+    remove(logPath);
+}
+/**
+ * EpochValue, freeEpochValue(), checkEpochValue()
+ * ----------------------------------------------------------------------------
+ * Values of epoch_test(). Each owns a malloced copy of its key number that
+ * the cleanup function frees, so a value cleaned up while a reader can still
+ * see it shows up as a use after free.
+ */
+struct EpochValue{
+    int key;
+    int* payload;
+};
+static atomic<int> epochValuesFreed(0);
+void freeEpochValue(void* addr)
+{
+    free(((EpochValue*)addr)->payload);
+    epochValuesFreed++;
+}
+void checkEpochValue(char* key, void* value, void* context)
+{
+    EpochValue* entry = (EpochValue*)value;
+    assert(atoi(key) == entry->key && *entry->payload == entry->key);
+    (*(int*)context)++;
+}
+/**
+ * epoch_test()
+ * ----------------------------------------------------------------------------
+ * Tests EpochHashMap with lock-free readers running get() and forEach()
+ * while writers replace, remove and reinsert keys, growing the shards.
+ */
+void epoch_test()
+{
+    printf("Testing Epoch...\n");
+    const int WRITERS = 4;
+    const int READERS = 4;
+    const int KEYS_PER_WRITER = 2000;
+    EpochHashMap map(4, sizeof(EpochValue), freeEpochValue, 4);
+    atomic<int> valuesCreated(0);
+    atomic<bool> writing(true);
+
+    vector<thread> threads;
+    for(int t = 0; t < WRITERS; t++)
+    {
+        threads.push_back(thread([&map, &valuesCreated, t, KEYS_PER_WRITER]() {
+            for(int round = 0; round < 3; round++)
+            {
+                for(int x = t * KEYS_PER_WRITER; x < (t + 1) * KEYS_PER_WRITER; x++)
+                {
+                    string key = to_string(x);
+                    EpochValue value = {x, (int*)malloc(sizeof(int))};
+                    *value.payload = x;
+                    valuesCreated++;
+                    bool stored = map.set((char*)key.c_str(), &value);
+                    assert(stored);
+                    if(round == 1 && x % 3 == 0)
+                    {
+                        int removed = map.remove((char*)key.c_str());
+                        assert(removed == 1);
+                    }
+                }
+            }
+        }));
+    }
+    for(int t = 0; t < READERS; t++)
+    {
+        threads.push_back(thread([&map, &writing, t, WRITERS, KEYS_PER_WRITER]() {
+            int x = t;
+            while(writing)
+            {
+                EpochValue value;
+                string key = to_string(x % (WRITERS * KEYS_PER_WRITER));
+                if(map.get((char*)key.c_str(), &value))
+                    assert(value.key == atoi(key.c_str()));
+                if(x % 5000 == 0)
+                {
+                    int visited = 0;
+                    map.forEach(checkEpochValue, &visited);
+                }
+                x += 7;
+            }
+        }));
+    }
+    for(int t = 0; t < WRITERS; t++)
+        threads[t].join();
+    writing = false;
+    for(int t = WRITERS; t < WRITERS + READERS; t++)
+        threads[t].join();
+
+    //every replaced or removed value is cleaned up once nobody reads
+    assert(map.getSize() == WRITERS * KEYS_PER_WRITER);
+    map.reclaim();
+    assert(map.getRetiredCount() == 0);
+    assert(epochValuesFreed == valuesCreated - map.getSize());
+
+    int visited = 0;
+    map.forEach(checkEpochValue, &visited);
+    assert(visited == WRITERS * KEYS_PER_WRITER);
+    EpochValue value;
+    bool found = map.get((char*)"7999", &value);
+    assert(found && value.key == 7999);
+    int removed = map.remove((char*)"7999");
+    found = map.get((char*)"7999", &value);
+    assert(removed == 1 && !found);
+    removed = map.remove((char*)"7999");
+    assert(removed == 0);
+
+    map.clear();
+    assert(map.getSize() == 0);
+    map.reclaim();
+    assert(epochValuesFreed == valuesCreated);
+}
+/**
+ * Tracked, Wide
+ * ----------------------------------------------------------------------------
+ * Values of typed_test(): Tracked counts the live instances to catch missed
+ * or doubled destructor calls, Wide needs more alignment than the arena has.
+ */
+struct Tracked{
+    static int live;
+    int value;
+    Tracked(int value) : value(value) { live++; }
+    Tracked(const Tracked& other) : value(other.value) { live++; }
+    Tracked& operator=(const Tracked& other) { value = other.value; return *this; }
+    ~Tracked() { live--; }
+};
+int Tracked::live = 0;
+struct alignas(64) Wide{
+    double lanes[8];
+};
+/**
+ * typed_test()
+ * ----------------------------------------------------------------------------
+ * Tests TypedHashMap with string keys, move-only and non-trivial values and
+ * over-aligned values.
+ */
+void typed_test()
+{
+    printf("Testing Typed...\n");
+    TypedHashMap<string, int> counts(4);
+    for(int x = 0; x < 20000; x++)
+        (*counts.emplace(to_string(x % 97), 0))++;
+    assert(counts.getSize() == 97 && counts.getLoadFactor() <= 1.0);
+    assert(*counts.get("5") == 20000/97 + 1 && counts.get("97") == NULL);
+    int total = 0;
+    for(auto& entry : counts)
+        total += entry.value;
+    assert(total == 20000);
+    bool removed = counts.remove("5");
+    bool removedTwice = counts.remove("5");
+    assert(removed && !removedTwice && counts.getSize() == 96);
+
+    TypedHashMap<int, unique_ptr<int> > owners;
+    for(int x = 0; x < 1000; x++)
+    {
+        bool stored = owners.set(x, unique_ptr<int>(new int(x * 2)));
+        assert(stored);
+    }
+    assert(**owners.get(999) == 1998);
+    owners.set(999, unique_ptr<int>(new int(7))); //frees the old value
+    assert(**owners.get(999) == 7);
+    owners.clear();
+    assert(owners.getSize() == 0 && owners.get(1) == NULL);
+
+    {
+        TypedHashMap<int, Tracked> tracked;
+        for(int x = 0; x < 500; x++)
+            tracked.emplace(x, x);
+        tracked.set(3, Tracked(30));
+        assert(tracked.get(3)->value == 30 && Tracked::live == 500);
+        tracked.remove(4);
+        assert(Tracked::live == 499);
+    }
+    assert(Tracked::live == 0);
+
+    TypedHashMap<int, Wide> wide;
+    TypedHashMap<string, double> doubles;
+    for(int x = 0; x < 100; x++)
+    {
+        Wide* value = wide.emplace(x);
+        string key(x % 13, 'k'); //keys of every length
+        doubles.set(key, x * 0.5);
+        assert((uintptr_t)value % alignof(Wide) == 0);
+        assert((uintptr_t)doubles.get(key) % alignof(double) == 0);
+        assert(*doubles.get(key) == x * 0.5); //later rounds overwrite in place
+    }
+    Wide lanes = {{1, 2, 3, 4, 5, 6, 7, 8}};
+    wide.set(3, lanes);
+    assert(wide.getSize() == 100 && wide.get(3)->lanes[7] == 8);
+}
 /**
  * update_test()
  * ----------------------------------------------------------------------------
@@ -216,10 +1574,34 @@ void update_test()
 int main(int argc, char *argv[])
 {
     insert_test();
+    resize_test();
+    hash_test();
+    key_length_test();
+    binary_key_test();
+    arena_test();
+    alignment_test();
     consistency_test();
+    cursor_test();
+#ifndef HASHMAP_SWISS_ENGINE
+    end_iteration_test();
+#endif
+    get_many_test();
+    upsert_test();
+    snapshot_test();
+    view_test();
+    stats_test();
+#ifdef HASHMAP_INSTRUMENT
+    instrument_test();
+#endif
+    int_map_test();
+    concurrent_test();
+    log_test();
+    epoch_test();
+    typed_test();
     update_test();
     delete_test();
     complex_delete_test();
+    clear_test();
     printf("All tests pass!\n");
     return 0;
 }
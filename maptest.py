@@ -0,0 +1,124 @@
+# ---------------------------------------------------------------------------- #
+#                               MapTest (Python)                               #
+# ---------------------------------------------------------------------------- #
+# This program tests the Python interface generated from hashmap.i. Build      #
+# the _hashmap module with CMake (SWIG and the Python headers must be          #
+# installed) and run it with the build directory on PYTHONPATH, or through     #
+# ctest.                                                                       #
+#                                                                              #
+# Author: Thomas Lau                                                           #
+#                                                                              #
+# Licensed under the Apache License, Version 2.0 (the "License"); you may      #
+# not use this file except in compliance with the License. You may obtain a    #
+# copy of the License at http://www.apache.org/licenses/LICENSE-2.0.           #
+#                                                                              #
+# Unless required by applicable law or agreed to in writing, software          #
+# distributed under the License is distributed on an "AS IS" BASIS,            #
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.     #
+# See the License for the specific language governing permissions and          #
+# limitations under the License.                                               #
+# ---------------------------------------------------------------------------- #
+
+import struct
+import hashmap
+
+def pack(x):
+    return struct.pack("q", x)
+
+def raises(error, fn, *args):
+    try:
+        fn(*args)
+    except error:
+        return True
+    return False
+
+def bulk_test():
+    """Tests setMany/getManyBytes/removeMany with lists of keys and values,
+    packed key and value buffers, and that a lone str or bytes key is
+    rejected instead of being split up."""
+    print("Testing Bulk Operations...")
+    map = hashmap.HashMap(16, 8)
+    keys = ["key%d" % x for x in range(1000)]
+    values = [pack(x) for x in range(1000)]
+    assert map.setMany(keys, values) == 1000
+    assert map.getSize() == 1000
+    found = map.getManyBytes(keys + ["missing", b"key7"])
+    assert found[:1000] == values
+    assert found[1000] is None and found[1001] == pack(7)
+
+    wide = b"".join(pack(x) for x in range(100))
+    assert map.setMany(wide, b"".join(values[:100]), 8) == 100
+    assert map.getManyBytes(bytearray(wide), 8) == values[:100]
+    assert map.removeMany(wide, 8) == 100
+    assert map.getManyBytes(wide, 8) == [None] * 100
+
+    assert map.removeMany(keys[:10]) == 10
+    assert map.removeMany(tuple(keys[:10])) == 0
+    assert map.getSize() == 990
+
+    for single in ("key1", b"key1"):
+        assert raises(TypeError, map.getManyBytes, single)
+        assert raises(TypeError, map.removeMany, single)
+        assert raises(TypeError, map.setMany, single, [pack(1)])
+    assert raises(TypeError, map.getManyBytes, "key1", 4)
+    assert raises(TypeError, map.getManyBytes, [1, 2])
+    assert raises(ValueError, map.getManyBytes, b"12345", 2)
+    assert raises(ValueError, map.setMany, ["a", "b"], [pack(1)])
+    assert raises(ValueError, map.setMany, ["a"], [b"short"])
+    assert raises(ValueError, map.setMany, ["a"], b"short")
+    assert map.getSize() == 990
+
+    sharded = hashmap.ConcurrentHashMap(16, 8)
+    assert sharded.setMany(keys, values) == 1000
+    assert sharded.getManyBytes(keys) == values
+    assert sharded.removeMany(keys) == 1000
+    assert sharded.getManyBytes(keys[:3]) == [None] * 3
+
+def iteration_test():
+    """Tests the mapping protocol's iteration: every entry once across
+    several batches, the exported kind constants, RuntimeError when the map
+    changes mid-iteration, and that a rehash goes on after an iteration
+    finishes or stops early."""
+    print("Testing Iteration...")
+    assert (hashmap.HASHMAP_KEYS, hashmap.HASHMAP_VALUES, hashmap.HASHMAP_ITEMS) == (0, 1, 2)
+    map = hashmap.HashMap(16, 8)
+    expected = dict(("key%d" % x, pack(x)) for x in range(1000))
+    for key, value in expected.items():
+        map[key] = value
+    map[b"\xff\x00"] = pack(-1)
+    assert len(map) == 1001 and "key5" in map and "key1000" not in map
+    assert sorted(map.keys(), key=repr) == sorted(list(expected) + [b"\xff\x00"], key=repr)
+    assert sorted(map.values()) == sorted(list(expected.values()) + [pack(-1)])
+    assert dict(map.items())[b"\xff\x00"] == pack(-1)
+    assert sum(1 for key in map) == 1001
+
+    for change in (lambda: map.__setitem__("extra", pack(1)), lambda: map.__delitem__("extra")):
+        entries = iter(map)
+        next(entries)
+        change()
+        assert raises(RuntimeError, list, entries)
+    assert sum(1 for key in map) == 1001
+
+    empty = hashmap.HashMap(16, 8)
+    assert list(empty) == [] and empty.items() == []
+
+    for stop in (True, False):
+        growing = hashmap.HashMap(64, 8)
+        keys = 0
+        while not growing.isRehashing():
+            growing["key%d" % keys] = pack(keys)
+            keys += 1
+        seen = 0
+        for key in growing:
+            seen += 1
+            if stop:
+                break
+        assert seen == (1 if stop else keys)
+        for x in range(1000):
+            assert "key0" in growing
+        assert not growing.isRehashing()
+
+if __name__ == "__main__":
+    bulk_test()
+    iteration_test()
+    print("All tests pass!")
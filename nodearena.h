@@ -0,0 +1,284 @@
+/* -------------------------------------------------------------------------- *
+ *                                NodeArena                                   *
+ * -------------------------------------------------------------------------- *
+ * A per-map allocator for the variable sized nodes of HashMap. Small blocks  *
+ * are rounded up to a 16-byte size class and carved out of large chunks      *
+ * with a bump pointer; released blocks go onto a free list for their class   *
+ * and are handed out again before the chunk is bumped any further. Blocks    *
+ * too large for a size class get their own allocation. Destroying the arena  *
+ * frees every chunk at once, so the owner never has to free its nodes one by *
+ * one.                                                                       *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _nodearena_h
+#define _nodearena_h
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace{ //local namespace variables
+    const size_t ARENA_ALIGNMENT = 16; //granularity and alignment of every block
+    const size_t ARENA_SIZE_CLASSES = 32; //blocks of up to 32*16 = 512 bytes are pooled
+    const size_t ARENA_FIRST_CHUNK = 4096; //chunks double in size from here...
+    const size_t ARENA_MAX_CHUNK = 1 << 20; //...up to 1MB
+}
+
+class NodeArena{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    NodeArena();
+    ~NodeArena();
+
+    ///////////////////////////////////
+    // ALLOCATION METHODS
+    ///////////////////////////////////
+    void* allocate(size_t size);
+    void release(void* block, size_t size);
+    void releaseAll();
+
+    ///////////////////////////////////
+    // ALLOCATOR PROPERTIES
+    ///////////////////////////////////
+    size_t getBytesReserved();
+    size_t getBlocksReserved();
+
+private:
+    //chunks and large blocks start with this header, padded to the alignment
+    struct ChunkHeader{
+        ChunkHeader* prev;
+        ChunkHeader* next;
+        size_t size; //bytes following the header
+        size_t padding;
+    };
+
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    static size_t getSizeClass(size_t size);
+    static ChunkHeader* newChunk(size_t size, ChunkHeader** list);
+    static void unlinkChunk(ChunkHeader* chunk, ChunkHeader** list);
+    static void freeChunks(ChunkHeader* list);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    void* freeLists[ARENA_SIZE_CLASSES]; //released blocks, linked through their first word
+    ChunkHeader* chunks; //chunks that small blocks are bumped out of, newest first
+    ChunkHeader* largeBlocks; //blocks bigger than the largest size class
+    char* bumpPointer; //next free byte in the newest chunk
+    char* bumpLimit; //end of the newest chunk
+    size_t nextChunkSize;
+    size_t bytesReserved; //bytes currently held from malloc
+    size_t blocksReserved; //chunks and large blocks currently held from malloc
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * NodeArena()
+ * ----------------------------------------------------------------------------
+ * Creates an empty arena; no memory is reserved until the first allocate().
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+NodeArena::NodeArena()
+{
+    for(size_t x = 0; x < ARENA_SIZE_CLASSES; x++)
+        freeLists[x] = NULL;
+    chunks = NULL;
+    largeBlocks = NULL;
+    bumpPointer = NULL;
+    bumpLimit = NULL;
+    nextChunkSize = ARENA_FIRST_CHUNK;
+    bytesReserved = 0;
+    blocksReserved = 0;
+}
+/**
+ * ~NodeArena()
+ * ----------------------------------------------------------------------------
+ * Frees every chunk and large block, including blocks that were never
+ * released.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(c); c = number of chunks and large blocks
+ */
+NodeArena::~NodeArena()
+{
+    freeChunks(chunks);
+    freeChunks(largeBlocks);
+}
+///////////////////////////////////
+// ALLOCATION METHODS
+///////////////////////////////////
+/**
+ * allocate(size_t size)
+ * ----------------------------------------------------------------------------
+ * Returns a 16-byte aligned block of at least size bytes, or NULL if memory
+ * couldn't be reserved. Blocks come from the free list of their size class
+ * first, then from the current chunk.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+void* NodeArena::allocate(size_t size)
+{
+    size_t sizeClass = getSizeClass(size);
+    if(sizeClass >= ARENA_SIZE_CLASSES) //too big to pool
+    {
+        ChunkHeader* block = newChunk(size, &largeBlocks);
+        if(block == NULL)
+            return NULL;
+        bytesReserved += block->size;
+        blocksReserved++;
+        return block + 1;
+    }
+
+    if(freeLists[sizeClass] != NULL) //reuse a released block
+    {
+        void* block = freeLists[sizeClass];
+        freeLists[sizeClass] = *(void**)block;
+        return block;
+    }
+
+    size_t blockSize = (sizeClass + 1) * ARENA_ALIGNMENT;
+    if(bumpPointer == NULL || (size_t)(bumpLimit - bumpPointer) < blockSize)
+    {
+        //the tail of the old chunk is abandoned; it's at most one block
+        ChunkHeader* chunk = newChunk(nextChunkSize, &chunks);
+        if(chunk == NULL)
+            return NULL;
+        bytesReserved += chunk->size;
+        blocksReserved++;
+        bumpPointer = (char*)(chunk + 1);
+        bumpLimit = bumpPointer + chunk->size;
+        if(nextChunkSize < ARENA_MAX_CHUNK)
+            nextChunkSize *= 2;
+    }
+    void* block = bumpPointer;
+    bumpPointer += blockSize;
+    return block;
+}
+/**
+ * release(void* block, size_t size)
+ * ----------------------------------------------------------------------------
+ * Gives back a block returned by allocate(size). Pooled blocks are kept on
+ * their free list for reuse; large blocks are freed right away.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+void NodeArena::release(void* block, size_t size)
+{
+    size_t sizeClass = getSizeClass(size);
+    if(sizeClass >= ARENA_SIZE_CLASSES)
+    {
+        ChunkHeader* chunk = (ChunkHeader*)block - 1;
+        bytesReserved -= chunk->size;
+        blocksReserved--;
+        unlinkChunk(chunk, &largeBlocks);
+        free(chunk);
+        return;
+    }
+    *(void**)block = freeLists[sizeClass];
+    freeLists[sizeClass] = block;
+}
+/**
+ * releaseAll()
+ * ----------------------------------------------------------------------------
+ * Frees every block at once and returns the arena to its empty state.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(c); c = number of chunks and large blocks
+ */
+void NodeArena::releaseAll()
+{
+    freeChunks(chunks);
+    freeChunks(largeBlocks);
+    for(size_t x = 0; x < ARENA_SIZE_CLASSES; x++)
+        freeLists[x] = NULL;
+    chunks = NULL;
+    largeBlocks = NULL;
+    bumpPointer = NULL;
+    bumpLimit = NULL;
+    nextChunkSize = ARENA_FIRST_CHUNK;
+    bytesReserved = 0;
+    blocksReserved = 0;
+}
+///////////////////////////////////
+// ALLOCATOR PROPERTIES
+///////////////////////////////////
+/**
+ * getBytesReserved()
+ * ----------------------------------------------------------------------------
+ * Returns the number of bytes the arena currently holds from malloc, not
+ * counting chunk headers.
+ */
+size_t NodeArena::getBytesReserved()
+{
+    return bytesReserved;
+}
+/**
+ * getBlocksReserved()
+ * ----------------------------------------------------------------------------
+ * Returns the number of chunks and large blocks the arena currently holds
+ * from malloc.
+ */
+size_t NodeArena::getBlocksReserved()
+{
+    return blocksReserved;
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//returns the index of the smallest size class that fits size bytes
+size_t NodeArena::getSizeClass(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT - (size != 0);
+}
+//mallocs a chunk with room for size bytes and pushes it onto list
+NodeArena::ChunkHeader* NodeArena::newChunk(size_t size, ChunkHeader** list)
+{
+    ChunkHeader* chunk = (ChunkHeader*)malloc(sizeof(ChunkHeader) + size);
+    if(chunk == NULL)
+        return NULL;
+    chunk->prev = NULL;
+    chunk->next = *list;
+    chunk->size = size;
+    if(*list != NULL)
+        (*list)->prev = chunk;
+    *list = chunk;
+    return chunk;
+}
+//removes chunk from list
+void NodeArena::unlinkChunk(ChunkHeader* chunk, ChunkHeader** list)
+{
+    if(chunk->prev != NULL)
+        chunk->prev->next = chunk->next;
+    else
+        *list = chunk->next;
+    if(chunk->next != NULL)
+        chunk->next->prev = chunk->prev;
+}
+//frees every chunk on list
+void NodeArena::freeChunks(ChunkHeader* list)
+{
+    while(list != NULL)
+    {
+        ChunkHeader* next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+#endif
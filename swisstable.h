@@ -0,0 +1,978 @@
+/* -------------------------------------------------------------------------- *
+ *                              SwissHashMap                                  *
+ * -------------------------------------------------------------------------- *
+ * An open addressing alternative to HashMap in the style of Abseil's Swiss   *
+ * tables. Each slot has a one byte control entry holding either a marker     *
+ * (empty/deleted) or the low 7 bits of the key's hash. Control bytes are     *
+ * probed 16 at a time with SSE2, so the full key comparison only runs on     *
+ * slots whose 7-bit tag matches. Keys and values live in one flat slot       *
+ * array instead of a linked list of nodes. Keys of up to 22 bytes are stored *
+ * inline in the slot's 24-byte key area, zero-padded with the length in its  *
+ * last byte, so comparing a candidate is three word compares with no         *
+ * pointer to chase; only longer keys spill to a buffer in the key arena.     *
+ * SwissHashMap has the same public interface as HashMap; compile with        *
+ * HASHMAP_SWISS_ENGINE defined to make "HashMap" refer to this engine. Keys  *
+ * are hashed with the same HashKeyFn family as HashMap.                      *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _swisstable_h
+#define _swisstable_h
+
+#include "hashmap.h"
+#include <stdint.h>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace{ //local namespace variables
+    const int SWISS_GROUP_WIDTH = 16; //control bytes probed at once
+    const float SWISS_MAX_LOAD_FACTOR = 0.875; //open addressing can't reach 1.0
+    const int8_t SWISS_EMPTY = -128; //0b10000000
+    const int8_t SWISS_DELETED = -2; //0b11111110
+    const size_t SWISS_KEY_SIZE = 24; //bytes of key area at the start of every slot
+    const size_t SWISS_INLINE_KEY_MAX = 22; //longest key kept inline; leaves room for '\0' and the length
+    const uint64_t SWISS_LONG_KEY = 0xFFULL << 56; //last key word of a spilled key: length byte 0xFF
+}
+
+class SwissHashMap{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    SwissHashMap(int mapSize, int elementSize);
+    SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn);
+    SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad);
+    SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn);
+    SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment);
+    ~SwissHashMap();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    bool set(char *key, void *addr);
+    bool set(const void *key, size_t keyLength, void *addr);
+    void* get(char *key);
+    void* get(const void *key, size_t keyLength);
+    int getMany(char **keys, int n, void **outPtrs);
+    void* getOrInsert(char *key, InitValueFn initFn);
+    void* getOrInsert(const void *key, size_t keyLength, InitValueFn initFn);
+    bool upsert(char *key, void *addr, MergeValueFn mergeFn);
+    bool upsert(const void *key, size_t keyLength, void *addr, MergeValueFn mergeFn);
+    void* remove(char *key);
+    void* remove(const void *key, size_t keyLength);
+    void clear();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE PROPERTIES
+    ///////////////////////////////////
+    int getSize();
+    int getElementSize();
+    float getLoadFactor();
+    float getMaxLoadFactor();
+    void setMaxLoadFactor(float maxLoad);
+    HashMapStats stats(int sampleGroups = STATS_SAMPLE_BUCKETS);
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation* getInstrumentation();
+#endif
+
+    ///////////////////////////////////
+    // ITERATOR METHODS
+    ///////////////////////////////////
+    char *firstNode();
+    char *nextNode(char *prevkey);
+    bool firstEntry(HashMapCursor *cursor);
+    bool nextEntry(HashMapCursor *cursor);
+
+    //C++ iteration: for(HashMapCursor& entry : map) visits every key/value
+    class iterator{
+    public:
+        iterator(SwissHashMap* map, bool atEnd);
+        HashMapCursor& operator*();
+        HashMapCursor* operator->();
+        iterator& operator++();
+        bool operator==(const iterator& other) const;
+        bool operator!=(const iterator& other) const;
+    private:
+        SwissHashMap* map;
+        HashMapCursor cursor;
+    };
+    iterator begin();
+    iterator end();
+
+private:
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment);
+    void allocateSlots(int capacity);
+    char* getSlotAtIndex(int index);
+    uint64_t hash(char *s, size_t* length);
+    static void makeProbeKey(char* key, size_t length, uint64_t* words);
+    static bool slotKeyMatches(char* slot, const uint64_t* probe, char* key, size_t length);
+    static bool isSpilledKey(char* slot);
+    static char* getSlotKey(char* slot);
+    static size_t getSlotKeyLength(char* slot);
+    bool storeSlotKey(char* slot, char* key, size_t length);
+    void releaseSlotKey(char* slot);
+    int getKeyIndex(char* key);
+    static uint32_t matchByte(int8_t* group, int8_t b);
+    static uint32_t matchFull(int8_t* group);
+    int findKey(char *key, size_t length, uint64_t keyHash);
+    int getFirstGroup(uint64_t keyHash);
+    int getProbeDistance(int index);
+    int getMissProbes(int group);
+    int findInsertSlot(uint64_t keyHash);
+    int insertKey(char *key, size_t length, uint64_t keyHash, void *addr);
+    void setControl(int index, int8_t control);
+    void resize(int newCapacity);
+    int firstFullFrom(int index);
+    bool setCursor(HashMapCursor* cursor, int index);
+    void cleanupAllValues();
+    static void emptyCleanUpFunction(void *addr);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    int sizeOfElements; //the size of each value element
+    int sizeOfSlots; //key area + value, rounded up to the slot alignment
+    int valueOffset; //from the start of a slot to its aligned value
+    size_t slotAlignment; //alignment of the slot array and of every slot
+    int capacity; //number of slots, a power of two and a multiple of 16
+    int numberOfElements; //the number of elements current in the SwissHashMap
+    int numberOfDeleted; //slots holding a tombstone
+    int8_t* control; //one control byte per slot
+    char* slots; //flat array of capacity slots
+    NodeArena keyArena; //allocator for the spilled long keys
+    CleanupValueFn cleanupFunction;
+    HashKeyFn hashFunction;
+    float maxLoadFactor; //load factor (including tombstones) that triggers a resize
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation instrumentation; //counters and latency samples of set/get/remove
+#endif
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * SwissHashMap()
+ * ----------------------------------------------------------------------------
+ * Creates a SwissHashMap with room for at least mapSize slots. The table is
+ * rebuilt at twice the size once the slots in use (including deleted ones)
+ * pass maxLoad; maxLoad is capped at 0.875 and values <= 0 use the cap, since
+ * an open addressing table can't be kept at a fixed size. A NULL fn means
+ * that values don't require any cleanup. Keys are hashed with hashFn (wyHash
+ * if not specified or NULL); the bits above the low 7 pick the first group to
+ * probe and the low 7 bits are the tag. Values are aligned as in HashMap: to
+ * valueAlignment, or if that is 0 or not specified to the strictest alignment
+ * a type of elementSize bytes can need.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k); k = size of SwissHashMap
+ */
+SwissHashMap::SwissHashMap(int mapSize, int elementSize){
+    initialize(mapSize, elementSize, NULL, SWISS_MAX_LOAD_FACTOR, NULL, 0);
+}
+SwissHashMap::SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn){
+    initialize(mapSize, elementSize, fn, SWISS_MAX_LOAD_FACTOR, NULL, 0);
+}
+SwissHashMap::SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad){
+    initialize(mapSize, elementSize, fn, maxLoad, NULL, 0);
+}
+SwissHashMap::SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn){
+    initialize(mapSize, elementSize, fn, maxLoad, hashFn, 0);
+}
+SwissHashMap::SwissHashMap(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment){
+    initialize(mapSize, elementSize, fn, maxLoad, hashFn, valueAlignment);
+}
+/**
+ * ~SwissHashMap()
+ * ----------------------------------------------------------------------------
+ * Destructor for SwissHashMap. Calls the cleanup function on every remaining
+ * value and frees the slot arrays; the copied keys are released along with
+ * their arena.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(c) without a cleanup function, c = number of arena chunks;
+ *          O(k) otherwise, k = number of slots
+ */
+SwissHashMap::~SwissHashMap()
+{
+    cleanupAllValues();
+    delete[] (char*)control;
+    ::operator delete[](slots, std::align_val_t(slotAlignment));
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * set(char* key, void* addr), set(const void* key, size_t length, void* addr)
+ * ----------------------------------------------------------------------------
+ * Associates a char* key with a copy of the value at addr. If the key already
+ * exists in the SwissHashMap, its value is cleaned up and replaced. As in
+ * HashMap, every key method has a (key, length) form for binary keys; the
+ * stored length byte keeps inline keys with embedded '\0' bytes apart.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool SwissHashMap::set(char* key, void* addr)
+{
+    return set(key, strlen(key), addr);
+}
+bool SwissHashMap::set(const void* bytes, size_t length, void* addr)
+{
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_SET);
+#endif
+    char* key = (char*)bytes;
+    uint64_t keyHash = hashFunction(key, length);
+    int index = findKey(key, length, keyHash);
+
+    if(index >= 0) //if the key already exists in the map, copy over
+    {
+        char* value = getSlotAtIndex(index) + valueOffset;
+        cleanupFunction(value);
+        memcpy(value, addr, sizeOfElements);
+#ifdef HASHMAP_INSTRUMENT
+        operation.setEvent(INSTRUMENT_UPDATES);
+#endif
+        return true;
+    }
+#ifdef HASHMAP_INSTRUMENT
+    if(insertKey(key, length, keyHash, addr) < 0)
+        return false;
+    operation.setEvent(INSTRUMENT_INSERTS);
+    return true;
+#else
+    return insertKey(key, length, keyHash, addr) >= 0; //on allocation failure, return false
+#endif
+}
+/**
+ * get(char* key), get(const void* key, size_t length)
+ * ----------------------------------------------------------------------------
+ * Searches the SwissHashMap for the given key and if found, returns a pointer
+ * to the appropriate value. If the key is not found, NULL is returned.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* SwissHashMap::get(char *key)
+{
+    return get(key, strlen(key));
+}
+void* SwissHashMap::get(const void *bytes, size_t length)
+{
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_GET);
+    operation.setEvent(INSTRUMENT_MISSES);
+#endif
+    char* key = (char*)bytes;
+    uint64_t keyHash = hashFunction(key, length);
+    int index = findKey(key, length, keyHash);
+    if(index >= 0)
+    {
+#ifdef HASHMAP_INSTRUMENT
+        operation.setEvent(INSTRUMENT_HITS);
+#endif
+        return getSlotAtIndex(index) + valueOffset;
+    }
+    return NULL;
+}
+/**
+ * getMany(char** keys, int n, void** outPtrs)
+ * ----------------------------------------------------------------------------
+ * Looks up n keys at once with the same contract as HashMap::getMany(): the
+ * keys of a batch are all hashed and their first control group and slot are
+ * prefetched before any of them is probed.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n) (amortized)
+ */
+int SwissHashMap::getMany(char **keys, int n, void **outPtrs)
+{
+    int found = 0;
+    size_t keyLengths[GET_MANY_BATCH];
+    uint64_t keyHashes[GET_MANY_BATCH];
+    for(int start = 0; start < n; start += GET_MANY_BATCH)
+    {
+        int batch = (n - start < GET_MANY_BATCH) ? n - start : GET_MANY_BATCH;
+
+        for(int x = 0; x < batch; x++)
+        {
+            keyHashes[x] = hash(keys[start+x], &keyLengths[x]);
+            int group = getFirstGroup(keyHashes[x]);
+            __builtin_prefetch(control + group*SWISS_GROUP_WIDTH);
+            __builtin_prefetch(getSlotAtIndex(group*SWISS_GROUP_WIDTH));
+        }
+        for(int x = 0; x < batch; x++)
+        {
+            int index = findKey(keys[start+x], keyLengths[x], keyHashes[x]);
+            outPtrs[start+x] = (index >= 0) ? getSlotAtIndex(index) + valueOffset : NULL;
+            found += (index >= 0);
+        }
+    }
+    return found;
+}
+/**
+ * getOrInsert(char* key, InitValueFn initFn), upsert(char* key, void* addr,
+ *                                                    MergeValueFn mergeFn)
+ * ----------------------------------------------------------------------------
+ * Single-probe read-modify-write with the same contract as HashMap's, except
+ * that the pointer returned by getOrInsert() is only valid until the next
+ * insertion, since growing the table moves the slots.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* SwissHashMap::getOrInsert(char *key, InitValueFn initFn)
+{
+    return getOrInsert(key, strlen(key), initFn);
+}
+void* SwissHashMap::getOrInsert(const void *bytes, size_t length, InitValueFn initFn)
+{
+    char* key = (char*)bytes;
+    uint64_t keyHash = hashFunction(key, length);
+    int index = findKey(key, length, keyHash);
+    if(index >= 0)
+        return getSlotAtIndex(index) + valueOffset;
+
+    index = insertKey(key, length, keyHash, NULL);
+    if(index < 0)
+        return NULL;
+    char* value = getSlotAtIndex(index) + valueOffset;
+    if(initFn != NULL)
+        initFn(value);
+    return value;
+}
+bool SwissHashMap::upsert(char *key, void *addr, MergeValueFn mergeFn)
+{
+    return upsert(key, strlen(key), addr, mergeFn);
+}
+bool SwissHashMap::upsert(const void *bytes, size_t length, void *addr, MergeValueFn mergeFn)
+{
+    char* key = (char*)bytes;
+    uint64_t keyHash = hashFunction(key, length);
+    int index = findKey(key, length, keyHash);
+    if(index >= 0)
+    {
+        mergeFn(getSlotAtIndex(index) + valueOffset, addr);
+        return true;
+    }
+    return insertKey(key, length, keyHash, addr) >= 0;
+}
+/**
+ * remove(char* key), remove(const void* key, size_t length)
+ * ----------------------------------------------------------------------------
+ * Searches the SwissHashMap for the given key and if found, removes the key
+ * and value; returning a pointer to the removed value, which stays readable
+ * until the slot is reused. If the key is not found, NULL is returned.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+void* SwissHashMap::remove(char *key)
+{
+    return remove(key, strlen(key));
+}
+void* SwissHashMap::remove(const void *bytes, size_t length)
+{
+#ifdef HASHMAP_INSTRUMENT
+    MapInstrumentation::Operation operation(&instrumentation, INSTRUMENT_REMOVE);
+    operation.setEvent(INSTRUMENT_MISSES);
+#endif
+    char* key = (char*)bytes;
+    uint64_t keyHash = hashFunction(key, length);
+    int index = findKey(key, length, keyHash);
+    if(index < 0)
+        return NULL;
+#ifdef HASHMAP_INSTRUMENT
+    operation.setEvent(INSTRUMENT_REMOVES);
+#endif
+
+    char* slot = getSlotAtIndex(index);
+    char* value = slot + valueOffset;
+    cleanupFunction(value);
+    releaseSlotKey(slot);
+
+    //a group that still has an empty slot never made a probe move past it, so
+    //the slot can go straight back to empty instead of becoming a tombstone
+    int8_t* group = control + (index & ~(SWISS_GROUP_WIDTH-1));
+    if(matchByte(group, SWISS_EMPTY) != 0)
+    {
+        setControl(index, SWISS_EMPTY);
+    }else{
+        setControl(index, SWISS_DELETED);
+        numberOfDeleted++;
+    }
+    numberOfElements--;
+    return value;
+}
+/**
+ * clear()
+ * ----------------------------------------------------------------------------
+ * Removes every key and value from the SwissHashMap, calling the cleanup
+ * function on each value. The capacity is kept.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k); k = number of slots
+ */
+void SwissHashMap::clear()
+{
+    cleanupAllValues();
+    keyArena.releaseAll();
+    memset(control, SWISS_EMPTY, capacity);
+    numberOfElements = 0;
+    numberOfDeleted = 0;
+}
+///////////////////////////////////
+// DATA STRUCTURE PROPERTIES
+///////////////////////////////////
+/**
+ * getSize()
+ * ----------------------------------------------------------------------------
+ * Returns the number of elements currently in the SwissHashMap.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+int SwissHashMap::getSize()
+{
+    return numberOfElements;
+}
+/**
+ * getElementSize()
+ * ----------------------------------------------------------------------------
+ * Returns the size in bytes of every value, as passed to the constructor.
+ */
+int SwissHashMap::getElementSize()
+{
+    return sizeOfElements;
+}
+/**
+ * getLoadFactor()
+ * ----------------------------------------------------------------------------
+ * Returns the load factor of the SwissHashMap (#items in map/#slots).
+ */
+float SwissHashMap::getLoadFactor()
+{
+    return (double)numberOfElements/capacity;
+}
+/**
+ * getMaxLoadFactor(), setMaxLoadFactor(float maxLoad)
+ * ----------------------------------------------------------------------------
+ * Gets/sets the fraction of used slots that triggers a resize. Values that
+ * are <= 0 or above 0.875 are replaced by 0.875.
+ */
+float SwissHashMap::getMaxLoadFactor()
+{
+    return maxLoadFactor;
+}
+void SwissHashMap::setMaxLoadFactor(float maxLoad)
+{
+    if(maxLoad <= 0 || maxLoad > SWISS_MAX_LOAD_FACTOR)
+        maxLoad = SWISS_MAX_LOAD_FACTOR;
+    maxLoadFactor = maxLoad;
+}
+/**
+ * stats(int sampleGroups)
+ * ----------------------------------------------------------------------------
+ * Returns the shape of the table as in HashMap, with groups of 16 slots in
+ * place of buckets: how many keys each group holds, how many groups past its
+ * first one each key was placed, the average number of groups a hit and a
+ * miss probe, where the memory goes and how many blocks are held from malloc.
+ * Only about sampleGroups evenly spaced groups are walked; 0 walks them all.
+ * Slots don't keep their hash, so every sampled key is hashed again; nothing
+ * is changed, but as with HashMap a scraper on another thread must hold the
+ * lock that guards the map's writers.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(s * (16 + p)); s = sampleGroups, p = longest probe sequence
+ */
+HashMapStats SwissHashMap::stats(int sampleGroups)
+{
+    HashMapStats result;
+    memset(&result, 0, sizeof(result));
+    result.numberOfElements = numberOfElements;
+    result.numberOfBuckets = capacity/SWISS_GROUP_WIDTH;
+
+    int stride = 1;
+    if(sampleGroups > 0 && result.numberOfBuckets > sampleGroups)
+        stride = (result.numberOfBuckets + sampleGroups - 1)/sampleGroups;
+    int sampledKeys = 0;
+    for(int group = 0; group < result.numberOfBuckets; group += stride)
+    {
+        uint32_t full = matchFull(control + group*SWISS_GROUP_WIDTH);
+        int length = __builtin_popcount(full);
+        sampledKeys += length;
+        result.sampledBuckets++;
+        result.chainLengths[getStatsBin(length)]++;
+        if(length > result.maxChainLength)
+            result.maxChainLength = length;
+        result.unsuccessfulProbes += getMissProbes(group);
+
+        for(; full != 0; full &= full - 1)
+        {
+            int index = group*SWISS_GROUP_WIDTH + __builtin_ctz(full);
+            int distance = getProbeDistance(index);
+            result.probeDistances[getStatsBin(distance)]++;
+            if(distance > result.maxProbeDistance)
+                result.maxProbeDistance = distance;
+            result.successfulProbes += distance + 1;
+            result.keyBytes += getSlotKeyLength(getSlotAtIndex(index));
+        }
+    }
+
+    result.emptyBucketFraction = (double)result.chainLengths[0]/result.sampledBuckets;
+    if(sampledKeys > 0)
+        result.successfulProbes /= sampledKeys;
+    result.unsuccessfulProbes /= result.sampledBuckets;
+    if(sampledKeys > 0 && sampledKeys != numberOfElements) //scale the sample's key bytes up to the whole map
+        result.keyBytes = (size_t)((double)result.keyBytes * numberOfElements / sampledKeys);
+
+    size_t totalBytes = (size_t)capacity * (1 + sizeOfSlots) + keyArena.getBytesReserved();
+    result.valueBytes = (size_t)numberOfElements * sizeOfElements;
+    result.overheadBytes = (totalBytes > result.keyBytes + result.valueBytes) ? totalBytes - result.keyBytes - result.valueBytes : 0;
+    result.allocations = 2 + keyArena.getBlocksReserved(); //control bytes, slots and key chunks
+    return result;
+}
+#ifdef HASHMAP_INSTRUMENT
+/**
+ * getInstrumentation()
+ * ----------------------------------------------------------------------------
+ * Returns the counters and sampled latencies of set(), get() and remove()
+ * (see instrument.h). Only built with HASHMAP_INSTRUMENT defined.
+ */
+MapInstrumentation* SwissHashMap::getInstrumentation()
+{
+    return &instrumentation;
+}
+#endif
+///////////////////////////////////
+// ITERATOR METHODS
+///////////////////////////////////
+/**
+ * firstNode(), nextNode(char* prevKey)
+ * ----------------------------------------------------------------------------
+ * These functions allow iteration over the keys in the SwissHashMap in slot
+ * order. Inline keys are returned in place, so their slot index follows from
+ * their address; spilled keys record their slot index in front of the key.
+ * Either way nextNode() resumes the scan of the control bytes without
+ * hashing prevKey. Like value pointers, returned keys are only valid until
+ * the next insertion.
+ */
+char* SwissHashMap::firstNode()
+{
+    int index = firstFullFrom(0);
+    if(index >= capacity)
+        return NULL;
+    return getSlotKey(getSlotAtIndex(index));
+}
+char* SwissHashMap::nextNode(char* prevKey)
+{
+    int index = firstFullFrom(getKeyIndex(prevKey) + 1);
+    if(index >= capacity)
+        return NULL;
+    return getSlotKey(getSlotAtIndex(index));
+}
+/**
+ * firstEntry(HashMapCursor* cursor), nextEntry(HashMapCursor* cursor)
+ * ----------------------------------------------------------------------------
+ * Cursor based iteration with the same contract as HashMap's: the cursor
+ * holds the current slot index, and both return false (setting cursor->key
+ * to NULL) once there are no entries left.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+bool SwissHashMap::firstEntry(HashMapCursor* cursor)
+{
+    return setCursor(cursor, firstFullFrom(0));
+}
+bool SwissHashMap::nextEntry(HashMapCursor* cursor)
+{
+    return setCursor(cursor, firstFullFrom(cursor->bucket + 1));
+}
+/**
+ * begin(), end()
+ * ----------------------------------------------------------------------------
+ * Standard C++ iterators over the SwissHashMap's entries.
+ */
+SwissHashMap::iterator SwissHashMap::begin()
+{
+    return iterator(this, false);
+}
+SwissHashMap::iterator SwissHashMap::end()
+{
+    return iterator(this, true);
+}
+SwissHashMap::iterator::iterator(SwissHashMap* map, bool atEnd)
+{
+    this->map = map;
+    if(atEnd)
+        map->setCursor(&cursor, map->capacity);
+    else
+        map->firstEntry(&cursor);
+}
+HashMapCursor& SwissHashMap::iterator::operator*()
+{
+    return cursor;
+}
+HashMapCursor* SwissHashMap::iterator::operator->()
+{
+    return &cursor;
+}
+SwissHashMap::iterator& SwissHashMap::iterator::operator++()
+{
+    map->nextEntry(&cursor);
+    return *this;
+}
+bool SwissHashMap::iterator::operator==(const iterator& other) const
+{
+    return cursor.node == other.cursor.node;
+}
+bool SwissHashMap::iterator::operator!=(const iterator& other) const
+{
+    return cursor.node != other.cursor.node;
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void SwissHashMap::initialize(int mapSize, int elementSize, CleanupValueFn fn, float maxLoad, HashKeyFn hashFn, int valueAlignment)
+{
+    //make sure that we're given valid parameters
+    assert(mapSize >= 0);
+    assert(valueAlignment >= 0 && (valueAlignment & (valueAlignment-1)) == 0);
+
+    //if we're given 0 for our size, use the DEFAULT_SIZE
+    if(mapSize == 0)
+        mapSize = DEFAULT_SIZE;
+
+    sizeOfElements = elementSize;
+    size_t alignment = (valueAlignment > 0) ? valueAlignment : getDefaultValueAlignment(elementSize);
+    slotAlignment = (alignment > sizeof(char*)) ? alignment : sizeof(char*);
+    valueOffset = (int)alignOffset(SWISS_KEY_SIZE, alignment);
+    sizeOfSlots = (int)alignOffset(valueOffset + elementSize, slotAlignment);
+    cleanupFunction = (fn != NULL) ? fn : emptyCleanUpFunction;
+    hashFunction = (hashFn != NULL) ? hashFn : wyHash;
+    setMaxLoadFactor(maxLoad);
+
+    //round the capacity up to a power of two that holds whole groups
+    int newCapacity = SWISS_GROUP_WIDTH;
+    while(newCapacity < mapSize)
+        newCapacity *= 2;
+    allocateSlots(newCapacity);
+}
+//allocates empty control bytes and slots for newCapacity slots
+void SwissHashMap::allocateSlots(int newCapacity)
+{
+    capacity = newCapacity;
+    numberOfElements = 0;
+    numberOfDeleted = 0;
+    control = (int8_t*)new char[capacity];
+    memset(control, SWISS_EMPTY, capacity);
+    slots = (char*)::operator new[]((size_t)capacity * sizeOfSlots, std::align_val_t(slotAlignment));
+}
+//returns a pointer to the index-th slot: the key area followed by the value
+char* SwissHashMap::getSlotAtIndex(int index)
+{
+    return slots + (size_t)index * sizeOfSlots;
+}
+//returns the full hash code of s, storing strlen(s) in length
+uint64_t SwissHashMap::hash(char *s, size_t* length)
+{
+    *length = strlen(s);
+    return hashFunction(s, *length);
+}
+//fills words with the key area a slot holding key would have: the key
+//zero-padded with its length in the last byte if it fits inline, otherwise
+//a pointer to it, its length and the SWISS_LONG_KEY marker
+void SwissHashMap::makeProbeKey(char* key, size_t length, uint64_t* words)
+{
+    if(length > SWISS_INLINE_KEY_MAX)
+    {
+        words[0] = (uint64_t)(uintptr_t)key;
+        words[1] = length;
+        words[2] = SWISS_LONG_KEY;
+        return;
+    }
+    words[0] = words[1] = words[2] = 0;
+    memcpy(words, key, length);
+    words[2] |= (uint64_t)length << 56;
+}
+//returns whether the key in slot is key, whose probe key is probe. Inline
+//keys compare as three words, with the length byte telling apart keys that
+//only differ in trailing zeros; spilled keys compare lengths, then bytes.
+bool SwissHashMap::slotKeyMatches(char* slot, const uint64_t* probe, char* key, size_t length)
+{
+    uint64_t words[3];
+    memcpy(words, slot, SWISS_KEY_SIZE);
+    if(length <= SWISS_INLINE_KEY_MAX)
+        return ((words[0] ^ probe[0]) | (words[1] ^ probe[1]) | (words[2] ^ probe[2])) == 0;
+    return words[2] == SWISS_LONG_KEY && words[1] == length
+           && memcmp((char*)(uintptr_t)words[0], key, length) == 0;
+}
+//returns whether the key of slot lives in the key arena
+bool SwissHashMap::isSpilledKey(char* slot)
+{
+    return (uint8_t)slot[SWISS_KEY_SIZE - 1] == 0xFF;
+}
+//returns the '\0' terminated key of slot
+char* SwissHashMap::getSlotKey(char* slot)
+{
+    return isSpilledKey(slot) ? *(char**)slot : slot;
+}
+size_t SwissHashMap::getSlotKeyLength(char* slot)
+{
+    return isSpilledKey(slot) ? *(size_t*)(slot + sizeof(char*)) : (uint8_t)slot[SWISS_KEY_SIZE - 1];
+}
+//writes key into the key area of slot, spilling a long key into a buffer
+//from the key arena that is prefixed by the key's slot index. Returns false
+//if the buffer couldn't be allocated.
+bool SwissHashMap::storeSlotKey(char* slot, char* key, size_t length)
+{
+    uint64_t words[3];
+    makeProbeKey(key, length, words);
+    if(length > SWISS_INLINE_KEY_MAX)
+    {
+        char* buffer = (char*)keyArena.allocate(sizeof(size_t) + length + 1);
+        if(buffer == NULL)
+            return false;
+        *(size_t*)buffer = (size_t)((slot - slots) / sizeOfSlots);
+        memcpy(buffer + sizeof(size_t), key, length);
+        buffer[sizeof(size_t) + length] = '\0';
+        words[0] = (uint64_t)(uintptr_t)(buffer + sizeof(size_t));
+    }
+    memcpy(slot, words, SWISS_KEY_SIZE);
+    return true;
+}
+//gives the buffer of a spilled key back to the arena
+void SwissHashMap::releaseSlotKey(char* slot)
+{
+    if(isSpilledKey(slot))
+        keyArena.release(*(char**)slot - sizeof(size_t), sizeof(size_t) + getSlotKeyLength(slot) + 1);
+}
+//given a key returned by firstNode/nextNode, returns its slot index: inline
+//keys lie inside the slot array, spilled keys are prefixed by their index
+int SwissHashMap::getKeyIndex(char* key)
+{
+    if(key >= slots && key < slots + (size_t)capacity * sizeOfSlots)
+        return (int)((key - slots) / sizeOfSlots);
+    return (int)*(size_t*)(key - sizeof(size_t));
+}
+//returns a bitmask with bit i set if group[i] == b
+uint32_t SwissHashMap::matchByte(int8_t* group, int8_t b)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((__m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+    uint32_t mask = 0;
+    for(int i = 0; i < SWISS_GROUP_WIDTH; i++)
+        if(group[i] == b)
+            mask |= 1u << i;
+    return mask;
+#endif
+}
+//returns a bitmask with bit i set if group[i] holds a key (tags are >= 0)
+uint32_t SwissHashMap::matchFull(int8_t* group)
+{
+#ifdef __SSE2__
+    return ~_mm_movemask_epi8(_mm_loadu_si128((__m128i*)group)) & 0xFFFF;
+#else
+    uint32_t mask = 0;
+    for(int i = 0; i < SWISS_GROUP_WIDTH; i++)
+        if(group[i] >= 0)
+            mask |= 1u << i;
+    return mask;
+#endif
+}
+// returns the slot index holding key, or -1 if the key isn't in the map.
+// Groups are probed quadratically starting from the hash bits above the tag;
+// the probe ends at the first group that has an empty slot.
+int SwissHashMap::findKey(char *key, size_t length, uint64_t keyHash)
+{
+    uint64_t probe[3];
+    makeProbeKey(key, length, probe);
+    int8_t tag = (int8_t)(keyHash & 0x7F);
+    int groupMask = capacity/SWISS_GROUP_WIDTH - 1;
+    int group = getFirstGroup(keyHash);
+
+    for(int step = 1; ; step++)
+    {
+        int8_t* groupControl = control + group*SWISS_GROUP_WIDTH;
+        for(uint32_t match = matchByte(groupControl, tag); match != 0; match &= match - 1)
+        {
+            int index = group*SWISS_GROUP_WIDTH + __builtin_ctz(match);
+            if(slotKeyMatches(getSlotAtIndex(index), probe, key, length))
+                return index;
+        }
+        if(matchByte(groupControl, SWISS_EMPTY) != 0 || step > groupMask)
+            return -1;
+        group = (group + step) & groupMask;
+    }
+}
+// returns the group that keyHash's probe sequence starts at
+int SwissHashMap::getFirstGroup(uint64_t keyHash)
+{
+    return (int)(keyHash >> 7) & (capacity/SWISS_GROUP_WIDTH - 1);
+}
+// returns how many groups the probe for the key in the index-th slot passes
+// before reaching the group that holds it
+int SwissHashMap::getProbeDistance(int index)
+{
+    char* slot = getSlotAtIndex(index);
+    int groupMask = capacity/SWISS_GROUP_WIDTH - 1;
+    int group = getFirstGroup(hashFunction(getSlotKey(slot), getSlotKeyLength(slot)));
+    int distance = 0;
+    while(group != index/SWISS_GROUP_WIDTH)
+    {
+        distance++;
+        group = (group + distance) & groupMask;
+    }
+    return distance;
+}
+// returns how many groups findKey() probes for a missing key whose probe
+// sequence starts at group
+int SwissHashMap::getMissProbes(int group)
+{
+    int groupMask = capacity/SWISS_GROUP_WIDTH - 1;
+    for(int step = 1; ; step++)
+    {
+        if(matchByte(control + group*SWISS_GROUP_WIDTH, SWISS_EMPTY) != 0 || step > groupMask)
+            return step;
+        group = (group + step) & groupMask;
+    }
+}
+// returns the first empty or deleted slot on keyHash's probe sequence
+int SwissHashMap::findInsertSlot(uint64_t keyHash)
+{
+    int groupMask = capacity/SWISS_GROUP_WIDTH - 1;
+    int group = getFirstGroup(keyHash);
+
+    for(int step = 1; ; step++)
+    {
+        uint32_t available = ~matchFull(control + group*SWISS_GROUP_WIDTH) & 0xFFFF;
+        if(available != 0)
+            return group*SWISS_GROUP_WIDTH + __builtin_ctz(available);
+        group = (group + step) & groupMask;
+    }
+}
+// inserts key, which must not be in the map yet, with a copy of the value at
+// addr (zero-filled if addr is NULL), growing the table first if needed.
+// Returns the key's slot index, or -1 on allocation failure.
+int SwissHashMap::insertKey(char *key, size_t length, uint64_t keyHash, void *addr)
+{
+    if(numberOfElements + numberOfDeleted + 1 > capacity * maxLoadFactor)
+    {
+        //reclaim tombstones in place if they make up most of the used slots
+        if(numberOfDeleted > numberOfElements)
+            resize(capacity);
+        else
+            resize(capacity * 2);
+    }
+
+    int index = findInsertSlot(keyHash);
+    char* slot = getSlotAtIndex(index);
+    if(!storeSlotKey(slot, key, length))
+        return -1;
+    if(control[index] == SWISS_DELETED)
+        numberOfDeleted--;
+    setControl(index, (int8_t)(keyHash & 0x7F));
+
+    if(addr != NULL)
+        memcpy(slot + valueOffset, addr, sizeOfElements);
+    else
+        memset(slot + valueOffset, 0, sizeOfElements);
+    numberOfElements++;
+    return index;
+}
+void SwissHashMap::setControl(int index, int8_t controlByte)
+{
+    control[index] = controlByte;
+}
+// moves every key into a fresh table of newCapacity slots, dropping the
+// tombstones along the way
+void SwissHashMap::resize(int newCapacity)
+{
+#ifdef HASHMAP_INSTRUMENT
+    instrumentation.count(INSTRUMENT_RESIZES);
+#endif
+    int8_t* oldControl = control;
+    char* oldSlots = slots;
+    int oldCapacity = capacity;
+    int elements = numberOfElements;
+
+    allocateSlots(newCapacity);
+    for(int x = 0; x < oldCapacity; x++)
+    {
+        if(oldControl[x] < 0)
+            continue;
+        char* oldSlot = oldSlots + (size_t)x * sizeOfSlots;
+        char* key = getSlotKey(oldSlot);
+        int index = findInsertSlot(hashFunction(key, getSlotKeyLength(oldSlot)));
+        setControl(index, oldControl[x]);
+        if(isSpilledKey(oldSlot))
+            *(size_t*)(key - sizeof(size_t)) = index;
+        memcpy(getSlotAtIndex(index), oldSlot, sizeOfSlots);
+    }
+    numberOfElements = elements;
+
+    delete[] (char*)oldControl;
+    ::operator delete[](oldSlots, std::align_val_t(slotAlignment));
+}
+// returns the index of the first full slot at or after index, or capacity if
+// there are none
+int SwissHashMap::firstFullFrom(int index)
+{
+    //finish the partial group that index starts in
+    while(index < capacity && (index & (SWISS_GROUP_WIDTH-1)) != 0)
+    {
+        if(control[index] >= 0)
+            return index;
+        index++;
+    }
+    //then scan whole groups at a time
+    for(; index < capacity; index += SWISS_GROUP_WIDTH)
+    {
+        uint32_t full = matchFull(control + index);
+        if(full != 0)
+            return index + __builtin_ctz(full);
+    }
+    return capacity;
+}
+// fills in cursor for the slot at index, or marks it done if index is past
+// the last slot; returns whether cursor points at an entry
+bool SwissHashMap::setCursor(HashMapCursor* cursor, int index)
+{
+    cursor->bucket = index;
+    if(index >= capacity)
+    {
+        cursor->node = NULL;
+        cursor->key = NULL;
+        cursor->value = NULL;
+        cursor->keyLength = 0;
+        return false;
+    }
+    cursor->node = getSlotAtIndex(index);
+    cursor->key = getSlotKey((char*)cursor->node);
+    cursor->keyLength = getSlotKeyLength((char*)cursor->node);
+    cursor->value = (char*)cursor->node + valueOffset;
+    return true;
+}
+// calls the cleanup function on every value in the map; does nothing if there
+// is no cleanup function
+void SwissHashMap::cleanupAllValues()
+{
+    if(cleanupFunction == emptyCleanUpFunction)
+        return;
+
+    for(int x = firstFullFrom(0); x < capacity; x = firstFullFrom(x+1))
+        cleanupFunction(getSlotAtIndex(x) + valueOffset);
+}
+void SwissHashMap::emptyCleanUpFunction(void *addr) {};
+
+#endif
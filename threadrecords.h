@@ -0,0 +1,154 @@
+/* -------------------------------------------------------------------------- *
+ *                             ThreadRecordList                               *
+ * -------------------------------------------------------------------------- *
+ * One record per thread that ever used an object, for structures whose hot   *
+ * path writes only to state owned by the calling thread: the reader epochs   *
+ * of EpochReclaimer, the append buffers of WriteAheadLog and the counters of *
+ * MapInstrumentation. Records are pushed onto a lock-free list the first     *
+ * time a thread asks for one and are never removed, so any thread can walk   *
+ * them while others are adding theirs. Each thread caches the records it     *
+ * was handed in a small table indexed by list id, so a thread working with   *
+ * a few objects in turn (copying from one map into another, say) doesn't     *
+ * search the list on every call. A thread id reused by a new thread takes    *
+ * over the old thread's record.                                              *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _threadrecords_h
+#define _threadrecords_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+namespace{ //local namespace variables
+    std::atomic<uint64_t> nextThreadRecordListId(1); //tells lists apart in the thread caches
+}
+
+//Record must be default constructible (the constructor sets up a new
+//thread's state) and have the fields pthread_t owner and Record* next, which
+//the list maintains. CACHE_SIZE is the number of lists of this Record type a
+//thread finds its record in without a search.
+template<class Record, int CACHE_SIZE>
+class ThreadRecordList{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    ThreadRecordList();
+    ~ThreadRecordList();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    Record* getThreadRecord();
+    Record* getFirst();
+
+private:
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    uint64_t listId;
+    std::atomic<Record*> records; //newest first
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * ThreadRecordList()
+ * ----------------------------------------------------------------------------
+ * Creates an empty list; a thread gets a record the first time it asks.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+template<class Record, int CACHE_SIZE>
+ThreadRecordList<Record, CACHE_SIZE>::ThreadRecordList() : records(NULL)
+{
+    listId = nextThreadRecordListId.fetch_add(1);
+}
+/**
+ * ~ThreadRecordList()
+ * ----------------------------------------------------------------------------
+ * Deletes the records. No thread may still be using them.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t); t = number of threads that ever asked for a record
+ */
+template<class Record, int CACHE_SIZE>
+ThreadRecordList<Record, CACHE_SIZE>::~ThreadRecordList()
+{
+    Record* record = records.load();
+    while(record != NULL)
+    {
+        Record* next = record->next;
+        delete record;
+        record = next;
+    }
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * getThreadRecord()
+ * ----------------------------------------------------------------------------
+ * Returns the calling thread's record, creating it on the thread's first
+ * call. Ids start at 1, so a slot of the zero initialized cache never
+ * matches a list it wasn't filled for.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) on a cache hit, O(t) otherwise; t = number of records
+ */
+template<class Record, int CACHE_SIZE>
+Record* ThreadRecordList<Record, CACHE_SIZE>::getThreadRecord()
+{
+    struct CacheSlot{
+        uint64_t listId;
+        Record* record;
+    };
+    static thread_local CacheSlot cache[CACHE_SIZE];
+    CacheSlot* slot = &cache[listId % CACHE_SIZE];
+    if(slot->listId == listId)
+        return slot->record;
+
+    pthread_t self = pthread_self();
+    Record* record = records.load(std::memory_order_acquire);
+    while(record != NULL && !pthread_equal(record->owner, self))
+        record = record->next;
+
+    if(record == NULL)
+    {
+        record = new Record;
+        record->owner = self;
+        record->next = records.load(std::memory_order_relaxed);
+        while(!records.compare_exchange_weak(record->next, record, std::memory_order_release))
+            ;
+    }
+    slot->listId = listId;
+    slot->record = record;
+    return record;
+}
+/**
+ * getFirst()
+ * ----------------------------------------------------------------------------
+ * Returns the newest record, or NULL if no thread has asked for one; the
+ * rest follow through next. Records added during a walk may be missed.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+template<class Record, int CACHE_SIZE>
+Record* ThreadRecordList<Record, CACHE_SIZE>::getFirst()
+{
+    return records.load(std::memory_order_acquire);
+}
+
+#endif
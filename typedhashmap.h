@@ -0,0 +1,508 @@
+/* -------------------------------------------------------------------------- *
+ *                              TypedHashMap                                  *
+ * -------------------------------------------------------------------------- *
+ * A compile-time typed counterpart of HashMap for C++ clients. Keys and      *
+ * values are stored as real K and V objects inside the chained nodes, so the *
+ * compiler sees every copy and move, values are aligned for their type, and  *
+ * set() and emplace() construct values in place instead of going through a  *
+ * memcpy of sizeOfElements bytes. Nodes come from a NodeArena (or from       *
+ * aligned operator new when K or V needs more than the arena's 16 bytes) and *
+ * never move once created, so pointers returned by get() stay valid until    *
+ * the entry is removed. Values are destroyed with their destructor, which    *
+ * takes the place of HashMap's CleanupValueFn; maps whose keys and values    *
+ * are trivially destructible skip the walk over the nodes when clearing, and *
+ * set() overwrites a trivially copyable value with a plain memcpy.           *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _typedhashmap_h
+#define _typedhashmap_h
+
+#include "hashmap.h"
+#include <functional>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+//default hash for TypedHashMap: std::hash mixed so that the low bits, which
+//pick the bucket, depend on every bit of the key
+template<class K>
+struct TypedKeyHash{
+    uint64_t operator()(const K& key) const
+    {
+        return multiplyFold((uint64_t)std::hash<K>()(key) ^ WY_SECRET[0], WY_SECRET[1]);
+    }
+};
+//strings hash their bytes with the same function HashMap uses by default
+template<>
+struct TypedKeyHash<std::string>{
+    uint64_t operator()(const std::string& key) const
+    {
+        return wyHash(key.data(), key.size());
+    }
+};
+
+template<class K, class V, class Hash = TypedKeyHash<K>, class Eq = std::equal_to<K> >
+class TypedHashMap{
+public:
+    //what iteration visits; the key can't change while it's in the map
+    struct Entry{
+        const K key;
+        V value;
+    };
+
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    TypedHashMap();
+    TypedHashMap(int mapSize);
+    TypedHashMap(int mapSize, float maxLoad);
+    TypedHashMap(const TypedHashMap&) = delete;
+    TypedHashMap& operator=(const TypedHashMap&) = delete;
+    ~TypedHashMap();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    template<class ValueArg> bool set(const K& key, ValueArg&& value);
+    template<class ValueArg> bool set(K&& key, ValueArg&& value);
+    template<class... Args> V* emplace(const K& key, Args&&... args);
+    template<class... Args> V* emplace(K&& key, Args&&... args);
+    V* get(const K& key);
+    bool remove(const K& key);
+    void clear();
+
+    ///////////////////////////////////
+    // DATA STRUCTURE PROPERTIES
+    ///////////////////////////////////
+    int getSize();
+    float getLoadFactor();
+    float getMaxLoadFactor();
+    void setMaxLoadFactor(float maxLoad);
+
+private:
+    struct Node{
+        template<class KeyArg, class... Args>
+        Node(uint64_t keyHash, KeyArg&& key, Args&&... args)
+            : next(NULL), hashCode(keyHash), entry{std::forward<KeyArg>(key), V(std::forward<Args>(args)...)} {}
+        Node* next;
+        uint64_t hashCode;
+        Entry entry;
+    };
+
+public:
+    ///////////////////////////////////
+    // ITERATOR METHODS
+    ///////////////////////////////////
+    //C++ iteration: for(auto& entry : map) visits every key/value
+    class iterator{
+    public:
+        iterator(TypedHashMap* map, int bucket, Node* node) : map(map), bucket(bucket), node(node) {}
+        Entry& operator*() { return node->entry; }
+        Entry* operator->() { return &node->entry; }
+        iterator& operator++()
+        {
+            node = node->next;
+            while(node == NULL && ++bucket < map->numberOfBuckets)
+                node = map->buckets[bucket];
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return node == other.node; }
+        bool operator!=(const iterator& other) const { return node != other.node; }
+    private:
+        TypedHashMap* map;
+        int bucket;
+        Node* node;
+    };
+    iterator begin();
+    iterator end();
+
+private:
+    //nodes that fit the arena's alignment are carved out of it
+    static const bool ARENA_NODES = alignof(Node) <= ARENA_ALIGNMENT;
+    static const bool TRIVIAL_ENTRIES = std::is_trivially_destructible<K>::value
+                                        && std::is_trivially_destructible<V>::value;
+    static const bool TRIVIAL_VALUES = std::is_trivially_copyable<V>::value;
+
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(int mapSize, float maxLoad);
+    Node** findKey(const K& key, uint64_t keyHash);
+    template<class KeyArg, class... Args> Node* insertNode(uint64_t keyHash, KeyArg&& key, Args&&... args);
+    template<class ValueArg> static void assignValue(V* target, ValueArg&& value);
+    void* allocateNode();
+    void releaseNode(void* node);
+    void destroyNode(Node* node);
+    void destroyAllNodes();
+    void grow();
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    int numberOfBuckets; //a power of two
+    int numberOfElements;
+    Node** buckets;
+    NodeArena nodeArena;
+    float maxLoadFactor; //<= 0 means the bucket array never grows
+    Hash hashFunction;
+    Eq keysEqual;
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * TypedHashMap()
+ * ----------------------------------------------------------------------------
+ * Creates a TypedHashMap with at least mapSize buckets (DEFAULT_SIZE if not
+ * specified or 0), rounded up to a power of two. The map doubles its buckets
+ * whenever the load factor exceeds maxLoad (DEFAULT_MAX_LOAD_FACTOR if not
+ * specified); a maxLoad <= 0 keeps the size fixed.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k); k = mapSize
+ */
+template<class K, class V, class Hash, class Eq>
+TypedHashMap<K, V, Hash, Eq>::TypedHashMap(){
+    initialize(DEFAULT_SIZE, DEFAULT_MAX_LOAD_FACTOR);
+}
+template<class K, class V, class Hash, class Eq>
+TypedHashMap<K, V, Hash, Eq>::TypedHashMap(int mapSize){
+    initialize(mapSize, DEFAULT_MAX_LOAD_FACTOR);
+}
+template<class K, class V, class Hash, class Eq>
+TypedHashMap<K, V, Hash, Eq>::TypedHashMap(int mapSize, float maxLoad){
+    initialize(mapSize, maxLoad);
+}
+/**
+ * ~TypedHashMap()
+ * ----------------------------------------------------------------------------
+ * Destroys every key and value and frees the nodes.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n + k) (O(k) for trivially destructible K and V);
+ *          n = number of elements, k = number of buckets
+ */
+template<class K, class V, class Hash, class Eq>
+TypedHashMap<K, V, Hash, Eq>::~TypedHashMap()
+{
+    destroyAllNodes();
+    delete[] buckets;
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * set(K key, V value)
+ * ----------------------------------------------------------------------------
+ * Associates key with value, copying or moving both as they're passed in.
+ * An existing value is assigned to, so its old contents are released by V's
+ * own assignment operator. Returns false if a node couldn't be allocated.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+template<class K, class V, class Hash, class Eq>
+template<class ValueArg>
+bool TypedHashMap<K, V, Hash, Eq>::set(const K& key, ValueArg&& value)
+{
+    uint64_t keyHash = hashFunction(key);
+    Node** link = findKey(key, keyHash);
+    if(*link != NULL)
+    {
+        assignValue(&(*link)->entry.value, std::forward<ValueArg>(value));
+        return true;
+    }
+    return insertNode(keyHash, key, std::forward<ValueArg>(value)) != NULL;
+}
+template<class K, class V, class Hash, class Eq>
+template<class ValueArg>
+bool TypedHashMap<K, V, Hash, Eq>::set(K&& key, ValueArg&& value)
+{
+    uint64_t keyHash = hashFunction(key);
+    Node** link = findKey(key, keyHash);
+    if(*link != NULL)
+    {
+        assignValue(&(*link)->entry.value, std::forward<ValueArg>(value));
+        return true;
+    }
+    return insertNode(keyHash, std::move(key), std::forward<ValueArg>(value)) != NULL;
+}
+/**
+ * emplace(K key, Args... args)
+ * ----------------------------------------------------------------------------
+ * Returns a pointer to the value of key, constructing it in its node from
+ * args if the key isn't in the map yet. An existing value is left untouched
+ * and args are not used. Returns NULL if a node couldn't be allocated.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+template<class K, class V, class Hash, class Eq>
+template<class... Args>
+V* TypedHashMap<K, V, Hash, Eq>::emplace(const K& key, Args&&... args)
+{
+    uint64_t keyHash = hashFunction(key);
+    Node** link = findKey(key, keyHash);
+    Node* node = (*link != NULL) ? *link : insertNode(keyHash, key, std::forward<Args>(args)...);
+    return (node != NULL) ? &node->entry.value : NULL;
+}
+template<class K, class V, class Hash, class Eq>
+template<class... Args>
+V* TypedHashMap<K, V, Hash, Eq>::emplace(K&& key, Args&&... args)
+{
+    uint64_t keyHash = hashFunction(key);
+    Node** link = findKey(key, keyHash);
+    Node* node = (*link != NULL) ? *link : insertNode(keyHash, std::move(key), std::forward<Args>(args)...);
+    return (node != NULL) ? &node->entry.value : NULL;
+}
+/**
+ * get(K key)
+ * ----------------------------------------------------------------------------
+ * Returns a pointer to the value of key, or NULL if the key isn't in the map.
+ * The pointer stays valid until the key is removed or the map is cleared.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+template<class K, class V, class Hash, class Eq>
+V* TypedHashMap<K, V, Hash, Eq>::get(const K& key)
+{
+    Node* node = *findKey(key, hashFunction(key));
+    return (node != NULL) ? &node->entry.value : NULL;
+}
+/**
+ * remove(K key)
+ * ----------------------------------------------------------------------------
+ * Removes key, destroying its key and value. Returns whether it was found.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized)
+ */
+template<class K, class V, class Hash, class Eq>
+bool TypedHashMap<K, V, Hash, Eq>::remove(const K& key)
+{
+    Node** link = findKey(key, hashFunction(key));
+    Node* node = *link;
+    if(node == NULL)
+        return false;
+    *link = node->next;
+    numberOfElements--;
+    destroyNode(node);
+    return true;
+}
+/**
+ * clear()
+ * ----------------------------------------------------------------------------
+ * Removes every entry, keeping the current number of buckets.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n + k) (O(k) for trivially destructible K and V);
+ *          n = number of elements, k = number of buckets
+ */
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::clear()
+{
+    destroyAllNodes();
+    for(int x = 0; x < numberOfBuckets; x++)
+        buckets[x] = NULL;
+    numberOfElements = 0;
+}
+///////////////////////////////////
+// DATA STRUCTURE PROPERTIES
+///////////////////////////////////
+/**
+ * getSize(), getLoadFactor(), getMaxLoadFactor(), setMaxLoadFactor()
+ * ----------------------------------------------------------------------------
+ * As for HashMap.
+ */
+template<class K, class V, class Hash, class Eq>
+int TypedHashMap<K, V, Hash, Eq>::getSize()
+{
+    return numberOfElements;
+}
+template<class K, class V, class Hash, class Eq>
+float TypedHashMap<K, V, Hash, Eq>::getLoadFactor()
+{
+    return (float)numberOfElements / numberOfBuckets;
+}
+template<class K, class V, class Hash, class Eq>
+float TypedHashMap<K, V, Hash, Eq>::getMaxLoadFactor()
+{
+    return maxLoadFactor;
+}
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::setMaxLoadFactor(float maxLoad)
+{
+    maxLoadFactor = maxLoad;
+}
+///////////////////////////////////
+// ITERATOR METHODS
+///////////////////////////////////
+/**
+ * begin(), end()
+ * ----------------------------------------------------------------------------
+ * Iterate over every Entry in bucket order. set() of a new key and remove()
+ * of the current entry invalidate the iterator.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) per step (amortized)
+ */
+template<class K, class V, class Hash, class Eq>
+typename TypedHashMap<K, V, Hash, Eq>::iterator TypedHashMap<K, V, Hash, Eq>::begin()
+{
+    for(int x = 0; x < numberOfBuckets; x++)
+    {
+        if(buckets[x] != NULL)
+            return iterator(this, x, buckets[x]);
+    }
+    return end();
+}
+template<class K, class V, class Hash, class Eq>
+typename TypedHashMap<K, V, Hash, Eq>::iterator TypedHashMap<K, V, Hash, Eq>::end()
+{
+    return iterator(this, numberOfBuckets, NULL);
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::initialize(int mapSize, float maxLoad)
+{
+    //make sure that we're given valid parameters
+    assert(mapSize >= 0);
+
+    //if we're given 0 for our size, use the DEFAULT_SIZE
+    if(mapSize == 0)
+        mapSize = DEFAULT_SIZE;
+
+    numberOfBuckets = 1;
+    while(numberOfBuckets < mapSize)
+        numberOfBuckets *= 2;
+    numberOfElements = 0;
+    maxLoadFactor = maxLoad;
+    buckets = new Node*[numberOfBuckets]();
+}
+//returns the link that points at key's node, or the NULL link at the end of
+//its chain
+template<class K, class V, class Hash, class Eq>
+typename TypedHashMap<K, V, Hash, Eq>::Node** TypedHashMap<K, V, Hash, Eq>::findKey(const K& key, uint64_t keyHash)
+{
+    Node** link = &buckets[keyHash & (numberOfBuckets - 1)];
+    while(*link != NULL && ((*link)->hashCode != keyHash || !keysEqual((*link)->entry.key, key)))
+        link = &(*link)->next;
+    return link;
+}
+//constructs a node from key and args at the front of its bucket, growing the
+//map once its load factor passes maxLoadFactor; returns NULL on allocation
+//failure. An exception from K's or V's constructor frees the node again.
+template<class K, class V, class Hash, class Eq>
+template<class KeyArg, class... Args>
+typename TypedHashMap<K, V, Hash, Eq>::Node* TypedHashMap<K, V, Hash, Eq>::insertNode(uint64_t keyHash, KeyArg&& key, Args&&... args)
+{
+    void* block = allocateNode();
+    if(block == NULL)
+        return NULL;
+    Node* node;
+    try{
+        node = new (block) Node(keyHash, std::forward<KeyArg>(key), std::forward<Args>(args)...);
+    }catch(...){
+        releaseNode(block);
+        throw;
+    }
+    Node** bucket = &buckets[keyHash & (numberOfBuckets - 1)];
+    node->next = *bucket;
+    *bucket = node;
+    numberOfElements++;
+
+    if(maxLoadFactor > 0 && getLoadFactor() > maxLoadFactor)
+        grow();
+    return node;
+}
+//overwrites the value of an existing node. A trivially copyable V given as
+//a V is copied bytewise; anything else goes through V's assignment operator.
+template<class K, class V, class Hash, class Eq>
+template<class ValueArg>
+void TypedHashMap<K, V, Hash, Eq>::assignValue(V* target, ValueArg&& value)
+{
+    if constexpr(TRIVIAL_VALUES && std::is_same<typename std::decay<ValueArg>::type, V>::value)
+        memcpy((void*)target, (const void*)&value, sizeof(V));
+    else
+        *target = std::forward<ValueArg>(value);
+}
+template<class K, class V, class Hash, class Eq>
+void* TypedHashMap<K, V, Hash, Eq>::allocateNode()
+{
+    if constexpr(ARENA_NODES)
+        return nodeArena.allocate(sizeof(Node));
+    else
+        return ::operator new(sizeof(Node), std::align_val_t(alignof(Node)), std::nothrow);
+}
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::releaseNode(void* node)
+{
+    if constexpr(ARENA_NODES)
+        nodeArena.release(node, sizeof(Node));
+    else
+        ::operator delete(node, std::align_val_t(alignof(Node)));
+}
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::destroyNode(Node* node)
+{
+    node->~Node();
+    releaseNode(node);
+}
+//destroys every node. Trivially destructible entries in arena nodes need no
+//visit at all; the arena drops its chunks in one go.
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::destroyAllNodes()
+{
+    if constexpr(ARENA_NODES && TRIVIAL_ENTRIES)
+    {
+        nodeArena.releaseAll();
+        return;
+    }
+    for(int x = 0; x < numberOfBuckets; x++)
+    {
+        Node* node = buckets[x];
+        while(node != NULL)
+        {
+            Node* next = node->next;
+            destroyNode(node);
+            node = next;
+        }
+    }
+}
+//doubles the buckets and relinks every node by its cached hash; nodes don't
+//move, so pointers to values stay valid
+template<class K, class V, class Hash, class Eq>
+void TypedHashMap<K, V, Hash, Eq>::grow()
+{
+    int newNumberOfBuckets = numberOfBuckets * 2;
+    Node** newBuckets = new (std::nothrow) Node*[newNumberOfBuckets]();
+    if(newBuckets == NULL) //keep the longer chains
+        return;
+    for(int x = 0; x < numberOfBuckets; x++)
+    {
+        Node* node = buckets[x];
+        while(node != NULL)
+        {
+            Node* next = node->next;
+            Node** bucket = &newBuckets[node->hashCode & (newNumberOfBuckets - 1)];
+            node->next = *bucket;
+            *bucket = node;
+            node = next;
+        }
+    }
+    delete[] buckets;
+    buckets = newBuckets;
+    numberOfBuckets = newNumberOfBuckets;
+}
+
+#endif
@@ -0,0 +1,381 @@
+/* -------------------------------------------------------------------------- *
+ *                                 Workload                                   *
+ * -------------------------------------------------------------------------- *
+ * YCSB style workload generation for hashmap_bench. A KeyChooser draws the   *
+ * record ids that operations touch from a uniform, Zipfian (with a tunable   *
+ * theta), latest or hotspot distribution, an OperationChooser mixes reads,   *
+ * updates, inserts, scans and read-modify-writes in configurable             *
+ * proportions, and getYcsbWorkload() returns the standard core workloads A   *
+ * through F. LatencyHistogram records per operation latencies in log-linear  *
+ * buckets, in the style of HdrHistogram.                                     *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _workload_h
+#define _workload_h
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <random>
+#include "histogram.h"
+
+namespace{ //local namespace variables
+    const double DEFAULT_ZIPFIAN_THETA = 0.99; //YCSB's zipfian constant
+    const double DEFAULT_HOT_FRACTION = 0.2; //share of the records that are hot
+    const double DEFAULT_HOT_OPERATION_FRACTION = 0.8; //share of the operations that go to them
+    const int DEFAULT_MAX_SCAN_LENGTH = 100;
+    const int HISTOGRAM_SUB_BUCKETS = 16; //linear buckets per power of two, ~6% precision
+    const int HISTOGRAM_SUB_BUCKET_BITS = 4; //log2(HISTOGRAM_SUB_BUCKETS)
+    const int HISTOGRAM_BUCKETS = 40 * HISTOGRAM_SUB_BUCKETS; //covers values up to 2^40
+}
+
+enum KeyDistribution{ DISTRIBUTION_UNIFORM, DISTRIBUTION_ZIPFIAN, DISTRIBUTION_LATEST, DISTRIBUTION_HOTSPOT };
+enum OperationType{ OPERATION_READ, OPERATION_UPDATE, OPERATION_INSERT, OPERATION_SCAN, OPERATION_READ_MODIFY_WRITE, NUMBER_OF_OPERATION_TYPES };
+
+//the names used for distributions and operations in options and output
+const char* const DISTRIBUTION_NAMES[] = {"uniform", "zipfian", "latest", "hotspot"};
+const char* const OPERATION_NAMES[] = {"read", "update", "insert", "scan", "read-modify-write"};
+
+//what a workload does: the proportion of each operation type (summing to 1),
+//the distribution of the records they touch and the longest scan
+struct WorkloadSpec{
+    const char* name;
+    double proportions[NUMBER_OF_OPERATION_TYPES];
+    KeyDistribution distribution;
+    int maxScanLength;
+};
+
+/**
+ * getYcsbWorkload(char letter, WorkloadSpec* spec)
+ * ----------------------------------------------------------------------------
+ * Fills in spec with YCSB core workload A-F (either case) and returns true, or
+ * returns false for any other letter:
+ *   A  50% read, 50% update, zipfian              (update heavy)
+ *   B  95% read, 5% update, zipfian               (read mostly)
+ *   C  100% read, zipfian                         (read only)
+ *   D  95% read, 5% insert, latest                (read latest)
+ *   E  95% scan, 5% insert, zipfian               (short ranges)
+ *   F  50% read, 50% read-modify-write, zipfian
+ */
+bool getYcsbWorkload(char letter, WorkloadSpec* spec)
+{
+    static const WorkloadSpec WORKLOADS[] = {
+        {"a", {0.50, 0.50, 0, 0, 0}, DISTRIBUTION_ZIPFIAN, DEFAULT_MAX_SCAN_LENGTH},
+        {"b", {0.95, 0.05, 0, 0, 0}, DISTRIBUTION_ZIPFIAN, DEFAULT_MAX_SCAN_LENGTH},
+        {"c", {1.00, 0, 0, 0, 0}, DISTRIBUTION_ZIPFIAN, DEFAULT_MAX_SCAN_LENGTH},
+        {"d", {0.95, 0, 0.05, 0, 0}, DISTRIBUTION_LATEST, DEFAULT_MAX_SCAN_LENGTH},
+        {"e", {0, 0, 0.05, 0.95, 0}, DISTRIBUTION_ZIPFIAN, DEFAULT_MAX_SCAN_LENGTH},
+        {"f", {0.50, 0, 0, 0, 0.50}, DISTRIBUTION_ZIPFIAN, DEFAULT_MAX_SCAN_LENGTH},
+    };
+    int index = (letter | 0x20) - 'a'; //lower case
+    if(index < 0 || index >= (int)(sizeof(WORKLOADS)/sizeof(WorkloadSpec)))
+        return false;
+    *spec = WORKLOADS[index];
+    return true;
+}
+
+class KeyChooser{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    KeyChooser(KeyDistribution distribution, uint64_t records, uint64_t seed);
+    KeyChooser(KeyDistribution distribution, uint64_t records, uint64_t seed, double theta, double hotFraction, double hotOperationFraction);
+
+    ///////////////////////////////////
+    // DATA STRUCTURE ACCESS METHODS
+    ///////////////////////////////////
+    uint64_t next(uint64_t records);
+    uint64_t nextUniform(uint64_t limit);
+
+private:
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(KeyDistribution distribution, uint64_t records, uint64_t seed, double theta, double hotFraction, double hotOperationFraction);
+    double nextDouble();
+    uint64_t nextZipfian(uint64_t items);
+    void growZeta(uint64_t items);
+    static uint64_t scramble(uint64_t value);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    KeyDistribution distribution;
+    std::mt19937_64 random;
+    double hotFraction;
+    double hotOperationFraction;
+
+    //Zipfian state (Gray et al., "Quickly Generating Billion-Record Synthetic
+    //Databases"): zetan is zeta(zetaItems, theta), extended as records are
+    //inserted
+    double theta;
+    double alpha; //1 / (1 - theta)
+    double zeta2; //zeta(2, theta)
+    double zetan;
+    double eta;
+    uint64_t zetaItems;
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * KeyChooser()
+ * ----------------------------------------------------------------------------
+ * Creates a chooser of record ids for a table that starts with records
+ * records. theta (0.99 if not specified) sets the skew of the Zipfian and
+ * latest distributions and must be in (0, 1); a hotspot chooser sends
+ * hotOperationFraction (0.8) of the operations to the first hotFraction (0.2)
+ * of the records. Equal seeds give equal sequences.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(n) for the Zipfian and latest distributions, n = records;
+ *          O(1) otherwise
+ */
+KeyChooser::KeyChooser(KeyDistribution distribution, uint64_t records, uint64_t seed){
+    initialize(distribution, records, seed, DEFAULT_ZIPFIAN_THETA, DEFAULT_HOT_FRACTION, DEFAULT_HOT_OPERATION_FRACTION);
+}
+KeyChooser::KeyChooser(KeyDistribution distribution, uint64_t records, uint64_t seed, double theta, double hotFraction, double hotOperationFraction){
+    initialize(distribution, records, seed, theta, hotFraction, hotOperationFraction);
+}
+///////////////////////////////////
+// DATA STRUCTURE ACCESS METHODS
+///////////////////////////////////
+/**
+ * next(uint64_t records)
+ * ----------------------------------------------------------------------------
+ * Returns the id of an existing record, in [0, records), where records is the
+ * number inserted so far (ids are assigned in insertion order):
+ *   uniform  every record is equally likely
+ *   zipfian  the rank of a record follows a Zipfian distribution; ranks are
+ *            scrambled so the hot records are spread over the key space
+ *   latest   Zipfian by age: the most recently inserted records are hottest
+ *   hotspot  hotOperationFraction of the picks fall uniformly on the first
+ *            hotFraction of the records, the rest on the others
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) (amortized over the records inserted)
+ */
+uint64_t KeyChooser::next(uint64_t records)
+{
+    switch(distribution)
+    {
+    case DISTRIBUTION_ZIPFIAN:
+        return scramble(nextZipfian(records)) % records;
+    case DISTRIBUTION_LATEST:
+        return records - 1 - nextZipfian(records);
+    case DISTRIBUTION_HOTSPOT:
+    {
+        uint64_t hotRecords = (uint64_t)(records * hotFraction);
+        if(hotRecords == 0 || hotRecords == records)
+            return nextUniform(records);
+        if(nextDouble() < hotOperationFraction)
+            return nextUniform(hotRecords);
+        return hotRecords + nextUniform(records - hotRecords);
+    }
+    default:
+        return nextUniform(records);
+    }
+}
+/**
+ * nextUniform(uint64_t limit)
+ * ----------------------------------------------------------------------------
+ * Returns a uniformly distributed value in [0, limit); also used for scan
+ * lengths.
+ */
+uint64_t KeyChooser::nextUniform(uint64_t limit)
+{
+    return (uint64_t)(((__uint128_t)random() * limit) >> 64);
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void KeyChooser::initialize(KeyDistribution distribution, uint64_t records, uint64_t seed, double theta, double hotFraction, double hotOperationFraction)
+{
+    this->distribution = distribution;
+    random.seed(seed);
+    this->hotFraction = hotFraction;
+    this->hotOperationFraction = hotOperationFraction;
+
+    this->theta = theta;
+    alpha = 1.0 / (1.0 - theta);
+    zeta2 = 1.0 + pow(0.5, theta);
+    zetan = 0;
+    eta = 0;
+    zetaItems = 0;
+    if((distribution == DISTRIBUTION_ZIPFIAN || distribution == DISTRIBUTION_LATEST) && records > 0)
+        growZeta(records);
+}
+//returns a uniformly distributed double in [0, 1)
+double KeyChooser::nextDouble()
+{
+    return (random() >> 11) * (1.0 / (1ULL << 53));
+}
+//returns a Zipfian distributed rank in [0, items), 0 being the most popular
+uint64_t KeyChooser::nextZipfian(uint64_t items)
+{
+    if(items > zetaItems)
+        growZeta(items);
+    double u = nextDouble();
+    double uz = u * zetan;
+    if(uz < 1.0)
+        return 0;
+    if(uz < zeta2)
+        return 1;
+    uint64_t rank = (uint64_t)(items * pow(eta * u - eta + 1.0, alpha));
+    return (rank < items) ? rank : items - 1;
+}
+//extends zetan to zeta(items, theta) and recomputes eta; inserts only ever
+//add a term or two, so the sum is never recomputed from scratch
+void KeyChooser::growZeta(uint64_t items)
+{
+    for(uint64_t x = zetaItems + 1; x <= items; x++)
+        zetan += 1.0 / pow((double)x, theta);
+    zetaItems = items;
+    eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+}
+//FNV-1a over the bytes of value, as YCSB scrambles its Zipfian ranks
+uint64_t KeyChooser::scramble(uint64_t value)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int x = 0; x < 8; x++)
+    {
+        hash ^= (value >> (x * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+class OperationChooser{
+public:
+    OperationChooser(const WorkloadSpec& spec, uint64_t seed);
+    OperationType next();
+private:
+    double cumulative[NUMBER_OF_OPERATION_TYPES]; //running sums of the proportions
+    std::mt19937_64 random;
+};
+/**
+ * OperationChooser(const WorkloadSpec& spec, uint64_t seed), next()
+ * ----------------------------------------------------------------------------
+ * Draws operation types in the proportions of spec. The proportions are
+ * normalized, so they needn't sum to exactly 1.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+OperationChooser::OperationChooser(const WorkloadSpec& spec, uint64_t seed) : random(seed)
+{
+    double total = 0;
+    for(int x = 0; x < NUMBER_OF_OPERATION_TYPES; x++)
+        cumulative[x] = (total += spec.proportions[x]);
+    for(int x = 0; x < NUMBER_OF_OPERATION_TYPES; x++)
+        cumulative[x] /= total;
+}
+OperationType OperationChooser::next()
+{
+    double u = (random() >> 11) * (1.0 / (1ULL << 53));
+    for(int x = 0; x < NUMBER_OF_OPERATION_TYPES - 1; x++)
+        if(u < cumulative[x])
+            return (OperationType)x;
+    return (OperationType)(NUMBER_OF_OPERATION_TYPES - 1);
+}
+
+class LatencyHistogram{
+public:
+    LatencyHistogram();
+    void record(uint64_t value);
+    uint64_t getCount();
+    uint64_t getMax();
+    double getMean();
+    uint64_t getPercentile(double fraction);
+    int getNumberOfBuckets();
+    uint64_t getBucketCount(int bucket);
+    uint64_t getBucketLowerBound(int bucket);
+private:
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+    double sum;
+};
+/**
+ * LatencyHistogram()
+ * ----------------------------------------------------------------------------
+ * A histogram of non-negative values (nanoseconds, here). Values below
+ * 2 * HISTOGRAM_SUB_BUCKETS get a bucket each; above that every power of two
+ * is split into HISTOGRAM_SUB_BUCKETS equal buckets (see histogram.h), so a
+ * bucket is never wider than ~6% of the values in it and recording is a
+ * couple of shifts.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1) per record
+ */
+LatencyHistogram::LatencyHistogram()
+{
+    memset(counts, 0, sizeof(counts));
+    count = 0;
+    max = 0;
+    sum = 0;
+}
+void LatencyHistogram::record(uint64_t value)
+{
+    counts[getHistogramBucket(value, HISTOGRAM_SUB_BUCKET_BITS, HISTOGRAM_BUCKETS)]++;
+    count++;
+    sum += value;
+    if(value > max)
+        max = value;
+}
+/**
+ * getCount(), getMax(), getMean(), getPercentile(double fraction)
+ * ----------------------------------------------------------------------------
+ * Summaries of the recorded values. getPercentile() returns the largest value
+ * that falls in the same bucket as the value at fraction (0.99 for p99) of
+ * the sorted recordings, like HdrHistogram's highest equivalent value.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(b) for getPercentile(), b = number of buckets; O(1) otherwise
+ */
+uint64_t LatencyHistogram::getCount()
+{
+    return count;
+}
+uint64_t LatencyHistogram::getMax()
+{
+    return max;
+}
+double LatencyHistogram::getMean()
+{
+    return (count > 0) ? sum / count : 0;
+}
+uint64_t LatencyHistogram::getPercentile(double fraction)
+{
+    return getHistogramPercentile(counts, HISTOGRAM_SUB_BUCKET_BITS, HISTOGRAM_BUCKETS, count, max, fraction);
+}
+/**
+ * getNumberOfBuckets(), getBucketCount(int bucket), getBucketLowerBound(int bucket)
+ * ----------------------------------------------------------------------------
+ * Expose the raw buckets for output: bucket holds the values from its lower
+ * bound up to the lower bound of the next one.
+ */
+int LatencyHistogram::getNumberOfBuckets()
+{
+    return HISTOGRAM_BUCKETS;
+}
+uint64_t LatencyHistogram::getBucketCount(int bucket)
+{
+    return counts[bucket];
+}
+uint64_t LatencyHistogram::getBucketLowerBound(int bucket)
+{
+    return getHistogramLowerBound(bucket, HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+#endif
@@ -0,0 +1,739 @@
+/* -------------------------------------------------------------------------- *
+ *                             WriteAheadLog                                  *
+ * -------------------------------------------------------------------------- *
+ * An append-only log of map mutations that lets a map survive a crash        *
+ * without a full snapshot after every write. A map with a log attached       *
+ * (HashMap::setLog, ConcurrentHashMap::setLog) appends a compact binary      *
+ * record for every set, upsert, remove and clear. Records go into a buffer   *
+ * owned by the writing thread, so appending takes no lock shared between     *
+ * threads; a background flusher drains every buffer into the file and       *
+ * syncs it once per sync interval, so one fsync commits a whole group of     *
+ * records. The interval is the latency/throughput knob: a longer interval    *
+ * means larger groups and fewer syncs, but more recent writes lost in a      *
+ * crash. sync() waits for everything appended so far, and every record     *
+ * numbered before it, to be on disk.                                         *
+ *                                                                            *
+ * To checkpoint, save a snapshot and truncate the log. To recover, load the  *
+ * last snapshot (HashMap::loadSnapshot) and replay the log on top of it.     *
+ *                                                                            *
+ * Author: Thomas Lau                                                         *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#ifndef _writeaheadlog_h
+#define _writeaheadlog_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include "hashfn.h"
+#include "threadrecords.h"
+
+namespace{ //local namespace variables
+    const uint64_t LOG_MAGIC = 0x474f4c574243504bULL; //"KPCBWLOG" read little-endian
+    const uint32_t LOG_VERSION = 1;
+    const int DEFAULT_LOG_SYNC_INTERVAL = 2000; //microseconds between group commits
+    const size_t LOG_BUFFER_SIZE = 64 * 1024; //a thread buffer this full wakes the flusher early
+    const int LOG_THREAD_CACHE_SIZE = 8; //logs a thread finds its buffer for without a search
+    const char* const LOG_TEMP_SUFFIX = ".tmp"; //a rewritten log is renamed over the original
+}
+
+class WriteAheadLog{
+public:
+    ///////////////////////////////////
+    // CONSTRUCTORS AND DESTRUCTORS
+    ///////////////////////////////////
+    WriteAheadLog(const char *path);
+    WriteAheadLog(const char *path, int syncInterval);
+    ~WriteAheadLog();
+
+    ///////////////////////////////////
+    // LOGGING METHODS
+    ///////////////////////////////////
+    void logSet(const void *key, size_t keyLength, const void *value, size_t valueSize);
+    void logRemove(const void *key, size_t keyLength);
+    void logClear();
+    bool sync();
+    bool truncate();
+
+    ///////////////////////////////////
+    // RECOVERY METHODS
+    ///////////////////////////////////
+    template<class Map> static long replay(const char *path, Map *map);
+
+    ///////////////////////////////////
+    // DATA STRUCTURE PROPERTIES
+    ///////////////////////////////////
+    bool isOpen();
+    uint64_t getSequence();
+
+private:
+    enum RecordType : uint8_t{
+        LOG_SET = 1,
+        LOG_REMOVE = 2,
+        LOG_CLEAR = 3
+    };
+    //first bytes of the file
+    struct FileHeader{
+        uint64_t magic; //LOG_MAGIC; also rejects files of the other byte order
+        uint32_t version;
+        uint32_t reserved;
+    };
+    //starts every record and is followed by the key and then the value
+    struct RecordHeader{
+        uint64_t sequence; //order the mutation was applied in, starting at 1
+        uint32_t keyLength;
+        uint32_t valueLength;
+        uint32_t checksum; //of the whole record with this field zeroed
+        uint8_t type; //a RecordType
+        uint8_t padding[3];
+    };
+    //records appended by one thread and not yet written. The flusher swaps
+    //data with spare under lock and writes the swapped out records unlocked.
+    struct alignas(64) ThreadBuffer{
+        pthread_mutex_t lock; //only ever contended by the flusher
+        char* data;
+        size_t length;
+        size_t capacity;
+        char* spare;
+        size_t spareCapacity;
+        pthread_t owner;
+        ThreadBuffer* next;
+        ThreadBuffer();
+        ~ThreadBuffer();
+    };
+    //a record found by replay(), sorted by sequence before it is applied
+    struct ReplayEntry{
+        uint64_t sequence;
+        size_t offset;
+    };
+
+    ///////////////////////////////////
+    // PRIVATE HELPER METHODS
+    ///////////////////////////////////
+    void initialize(const char* path, int syncInterval);
+    void append(RecordType type, const void* key, size_t keyLength, const void* value, size_t valueLength);
+    static void* runFlusher(void* log);
+    void flushLoop();
+    bool drainBuffers(uint64_t* covered);
+    static bool writeAll(int fd, const char* data, size_t length);
+    static uint32_t getChecksum(char* record, size_t recordSize);
+    static char* readFile(const char* path, size_t* length);
+    static bool readRecords(char* data, size_t length, ReplayEntry** entries, size_t* count, size_t* end);
+    static size_t sortRecords(ReplayEntry* entries, size_t count);
+    static int compareEntries(const void* a, const void* b);
+    template<class Map> static bool fitsMap(char* data, ReplayEntry* entries, size_t count, Map* map);
+    bool cutLog(const char* path, char* data, ReplayEntry* entries, size_t kept, size_t count, size_t end, size_t length);
+
+    ///////////////////////////////////
+    // PRIVATE MEMBER VARIABLES
+    ///////////////////////////////////
+    int fd; //the log file, opened for appending; -1 if it couldn't be opened
+    int syncInterval; //microseconds between group commits
+    std::atomic<uint64_t> sequence; //last sequence number handed out
+    //one per thread that ever appended; a thread finds its buffers of
+    //LOG_THREAD_CACHE_SIZE logs without a search
+    ThreadRecordList<ThreadBuffer, LOG_THREAD_CACHE_SIZE> buffers;
+
+    //flusher state, guarded by flushLock
+    pthread_t flusher;
+    pthread_mutex_t flushLock;
+    pthread_cond_t flushWake; //wakes the flusher before its interval is up
+    pthread_cond_t flushDone; //wakes sync() callers after a group commit
+    uint64_t syncRequested; //sync() calls so far
+    uint64_t syncCompleted; //sync() calls covered by a finished group commit
+    uint64_t durableSequence; //every record up to this one is written and synced
+    bool flushFailed; //a write or fsync has failed; sync() reports it
+    bool stopping;
+
+    pthread_mutex_t fileLock; //serializes draining with truncate()
+};
+
+///////////////////////////////////
+// CONSTRUCTORS AND DESTRUCTORS
+///////////////////////////////////
+/**
+ * WriteAheadLog(const char* path)
+ * ----------------------------------------------------------------------------
+ * Opens (or creates) the log at path for appending and starts its flusher,
+ * which commits the buffered records every syncInterval microseconds (2ms if
+ * not specified). Records already in the file are kept, so a recovered map
+ * can go on logging to the log it was replayed from. If the file can't be
+ * opened or isn't a log, isOpen() returns false and nothing is logged.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(1)
+ */
+WriteAheadLog::WriteAheadLog(const char* path){
+    initialize(path, DEFAULT_LOG_SYNC_INTERVAL);
+}
+WriteAheadLog::WriteAheadLog(const char* path, int syncInterval){
+    initialize(path, syncInterval);
+}
+/**
+ * ~WriteAheadLog()
+ * ----------------------------------------------------------------------------
+ * Stops the flusher after a last group commit of every buffered record and
+ * closes the log. No thread may be appending.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(t + r); t = number of threads that ever appended,
+ *          r = bytes still buffered
+ */
+WriteAheadLog::~WriteAheadLog()
+{
+    if(fd >= 0)
+    {
+        pthread_mutex_lock(&flushLock);
+        stopping = true;
+        pthread_cond_signal(&flushWake);
+        pthread_mutex_unlock(&flushLock);
+        pthread_join(flusher, NULL);
+        close(fd);
+    }
+    pthread_mutex_destroy(&flushLock);
+    pthread_mutex_destroy(&fileLock);
+    pthread_cond_destroy(&flushWake);
+    pthread_cond_destroy(&flushDone);
+}
+///////////////////////////////////
+// LOGGING METHODS
+///////////////////////////////////
+/**
+ * logSet(const void* key, size_t keyLength, const void* value, size_t valueSize),
+ * logRemove(const void* key, size_t keyLength), logClear()
+ * ----------------------------------------------------------------------------
+ * Append a record that key now holds a copy of value, that key was removed,
+ * or that the map was cleared. Each record gets the next sequence number, and
+ * replay() applies records in sequence order; a map calls these while it
+ * still holds whatever lock orders its writes, so the log orders mutations of
+ * a key the same way the map did. The record is copied into the calling
+ * thread's buffer and becomes durable with the next group commit.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(k + v); k = key length, v = value size
+ */
+void WriteAheadLog::logSet(const void* key, size_t keyLength, const void* value, size_t valueSize)
+{
+    append(LOG_SET, key, keyLength, value, valueSize);
+}
+void WriteAheadLog::logRemove(const void* key, size_t keyLength)
+{
+    append(LOG_REMOVE, key, keyLength, NULL, 0);
+}
+void WriteAheadLog::logClear()
+{
+    append(LOG_CLEAR, NULL, 0, NULL, 0);
+}
+/**
+ * sync()
+ * ----------------------------------------------------------------------------
+ * Wakes the flusher and waits until every record numbered up to the last one
+ * appended before the call has been written and synced. A group commit can
+ * write a later record of one thread before an earlier one of another that
+ * was appended while the buffers were being drained, and replay() stops at
+ * such a gap, so it isn't enough that this thread's own records are on disk.
+ * Returns false if the log isn't open or a write or fsync has ever failed.
+ * ----------------------------------------------------------------------------
+ * Runtime: one or two group commits
+ */
+bool WriteAheadLog::sync()
+{
+    if(fd < 0)
+        return false;
+    pthread_mutex_lock(&flushLock);
+    uint64_t target = sequence.load();
+    syncRequested++;
+    pthread_cond_signal(&flushWake);
+    while(durableSequence < target && !flushFailed)
+        pthread_cond_wait(&flushDone, &flushLock);
+    bool synced = !flushFailed;
+    pthread_mutex_unlock(&flushLock);
+    return synced;
+}
+/**
+ * truncate()
+ * ----------------------------------------------------------------------------
+ * Commits the buffered records and then discards every record in the log,
+ * which is done after saving a snapshot that already holds their effect.
+ * Records appended by other threads while truncate() runs may be discarded
+ * too, so writers should be paused around the snapshot and the truncate.
+ * Sequence numbers keep counting up. Returns false on I/O failure.
+ * ----------------------------------------------------------------------------
+ * Runtime: one group commit
+ */
+bool WriteAheadLog::truncate()
+{
+    if(!sync())
+        return false;
+    pthread_mutex_lock(&fileLock);
+    bool truncated = ftruncate(fd, sizeof(FileHeader)) == 0 && fdatasync(fd) == 0;
+    pthread_mutex_unlock(&fileLock);
+    return truncated;
+}
+///////////////////////////////////
+// RECOVERY METHODS
+///////////////////////////////////
+/**
+ * replay(const char* path, Map* map)
+ * ----------------------------------------------------------------------------
+ * Applies the records of the log at path to map in sequence order, through
+ * map->set(key, keyLength, value), map->remove(key, keyLength) and
+ * map->clear(), and returns the number of records applied; -1 if the file
+ * can't be read, isn't a log or holds values of another size than
+ * map->getElementSize(), in which case map is left untouched. Reading stops
+ * at the first torn or corrupt record, and replay stops at the first
+ * sequence number missing among the records read: the buffers of different
+ * threads are written one after another, so a crash or a failed write can
+ * lose a record that later ones depend on. Replay into a map with no log
+ * attached (or one loaded from the last snapshot), then attach the log to go
+ * on from where it ended.
+ * ----------------------------------------------------------------------------
+ * Runtime: O(r log r); r = number of records
+ */
+template<class Map>
+long WriteAheadLog::replay(const char* path, Map* map)
+{
+    size_t length, count, end;
+    ReplayEntry* entries = NULL;
+    char* data = readFile(path, &length);
+    if(data == NULL || !readRecords(data, length, &entries, &count, &end))
+    {
+        free(data);
+        return -1;
+    }
+
+    count = sortRecords(entries, count);
+    if(!fitsMap(data, entries, count, map))
+    {
+        free(entries);
+        free(data);
+        return -1;
+    }
+
+    for(size_t x = 0; x < count; x++)
+    {
+        RecordHeader header;
+        memcpy(&header, data + entries[x].offset, sizeof(RecordHeader));
+        char* key = data + entries[x].offset + sizeof(RecordHeader);
+        if(header.type == LOG_SET)
+            map->set(key, header.keyLength, key + header.keyLength);
+        else if(header.type == LOG_REMOVE)
+            map->remove(key, header.keyLength);
+        else if(header.type == LOG_CLEAR)
+            map->clear();
+    }
+    free(entries);
+    free(data);
+    return (long)count;
+}
+///////////////////////////////////
+// DATA STRUCTURE PROPERTIES
+///////////////////////////////////
+/**
+ * isOpen()
+ * ----------------------------------------------------------------------------
+ * Returns whether the log file could be opened; a log that isn't open drops
+ * every record.
+ */
+bool WriteAheadLog::isOpen()
+{
+    return fd >= 0;
+}
+/**
+ * getSequence()
+ * ----------------------------------------------------------------------------
+ * Returns the sequence number of the last record appended, or 0 if none has
+ * been.
+ */
+uint64_t WriteAheadLog::getSequence()
+{
+    return sequence.load();
+}
+///////////////////////////////////
+// PRIVATE HELPER METHODS
+///////////////////////////////////
+//shared body of the constructors
+void WriteAheadLog::initialize(const char* path, int syncInterval)
+{
+    assert(syncInterval > 0);
+    this->syncInterval = syncInterval;
+    sequence.store(0);
+    pthread_mutex_init(&flushLock, NULL);
+    pthread_mutex_init(&fileLock, NULL);
+    pthread_cond_init(&flushWake, NULL);
+    pthread_cond_init(&flushDone, NULL);
+    syncRequested = 0;
+    syncCompleted = 0;
+    durableSequence = 0;
+    flushFailed = false;
+    stopping = false;
+
+    //a new log starts with its header. An existing log has to be valid; its
+    //sequence numbers are carried on from the last record replay() would
+    //apply, and the records it would skip are cut off so that new records
+    //follow the ones it applies.
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(fd < 0)
+        return;
+    bool valid = false;
+    if(lseek(fd, 0, SEEK_END) == 0)
+    {
+        FileHeader header;
+        memset(&header, 0, sizeof(FileHeader));
+        header.magic = LOG_MAGIC;
+        header.version = LOG_VERSION;
+        valid = writeAll(fd, (char*)&header, sizeof(FileHeader)) && fdatasync(fd) == 0;
+    }else{
+        size_t length, count, end;
+        ReplayEntry* entries = NULL;
+        char* data = readFile(path, &length);
+        valid = data != NULL && readRecords(data, length, &entries, &count, &end);
+        if(valid)
+        {
+            size_t kept = sortRecords(entries, count);
+            if(kept > 0)
+                sequence.store(entries[kept - 1].sequence);
+            valid = cutLog(path, data, entries, kept, count, end, length) && fdatasync(fd) == 0;
+            durableSequence = sequence.load(); //the kept records are on disk now
+        }
+        free(entries);
+        free(data);
+    }
+    if(!valid || pthread_create(&flusher, NULL, runFlusher, this) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+// copies a record into the calling thread's buffer, waking the flusher if
+// the buffer is getting full
+void WriteAheadLog::append(RecordType type, const void* key, size_t keyLength, const void* value, size_t valueLength)
+{
+    if(fd < 0)
+        return;
+    ThreadBuffer* buffer = buffers.getThreadRecord();
+    size_t recordSize = sizeof(RecordHeader) + keyLength + valueLength;
+
+    pthread_mutex_lock(&buffer->lock);
+    if(buffer->length + recordSize > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity * 2;
+        if(capacity < buffer->length + recordSize)
+            capacity = buffer->length + recordSize;
+        buffer->data = (char*)realloc(buffer->data, capacity);
+        assert(buffer->data != NULL);
+        buffer->capacity = capacity;
+    }
+    char* record = buffer->data + buffer->length;
+    RecordHeader header;
+    memset(&header, 0, sizeof(RecordHeader));
+    header.sequence = sequence.fetch_add(1) + 1;
+    header.keyLength = (uint32_t)keyLength;
+    header.valueLength = (uint32_t)valueLength;
+    header.type = type;
+    memcpy(record, &header, sizeof(RecordHeader));
+    if(keyLength > 0)
+        memcpy(record + sizeof(RecordHeader), key, keyLength);
+    if(valueLength > 0)
+        memcpy(record + sizeof(RecordHeader) + keyLength, value, valueLength);
+    header.checksum = getChecksum(record, recordSize);
+    memcpy(record + offsetof(RecordHeader, checksum), &header.checksum, sizeof(uint32_t));
+    buffer->length += recordSize;
+    bool full = buffer->length >= LOG_BUFFER_SIZE;
+    pthread_mutex_unlock(&buffer->lock);
+
+    if(full)
+    {
+        pthread_mutex_lock(&flushLock);
+        pthread_cond_signal(&flushWake);
+        pthread_mutex_unlock(&flushLock);
+    }
+}
+// a new thread's buffer, empty with LOG_BUFFER_SIZE bytes of room; the spare
+// array is allocated by the first drain that needs it
+WriteAheadLog::ThreadBuffer::ThreadBuffer()
+{
+    pthread_mutex_init(&lock, NULL);
+    capacity = LOG_BUFFER_SIZE;
+    data = (char*)malloc(capacity);
+    length = 0;
+    spare = NULL;
+    spareCapacity = 0;
+    assert(data != NULL);
+}
+WriteAheadLog::ThreadBuffer::~ThreadBuffer()
+{
+    pthread_mutex_destroy(&lock);
+    free(data);
+    free(spare);
+}
+//pthread entry point of the flusher
+void* WriteAheadLog::runFlusher(void* log)
+{
+    ((WriteAheadLog*)log)->flushLoop();
+    return NULL;
+}
+// the flusher: sleeps for syncInterval (or until woken by sync(), a full
+// buffer or the destructor), then commits every buffered record as one group
+void WriteAheadLog::flushLoop()
+{
+    pthread_mutex_lock(&flushLock);
+    while(true)
+    {
+        if(!stopping && syncRequested == syncCompleted)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)(syncInterval % 1000000) * 1000;
+            deadline.tv_sec += syncInterval / 1000000 + deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&flushWake, &flushLock, &deadline);
+        }
+        uint64_t requested = syncRequested;
+        bool stop = stopping;
+        pthread_mutex_unlock(&flushLock);
+
+        uint64_t covered;
+        bool committed = drainBuffers(&covered);
+
+        pthread_mutex_lock(&flushLock);
+        flushFailed = flushFailed || !committed;
+        if(committed && covered > durableSequence)
+            durableSequence = covered;
+        syncCompleted = requested;
+        pthread_cond_broadcast(&flushDone);
+        if(stop)
+            break;
+    }
+    pthread_mutex_unlock(&flushLock);
+}
+// writes out the records of every thread buffer and syncs the file if any
+// were written; returns false on I/O failure. covered gets the last sequence
+// number handed out before the drain started: append() numbers a record
+// under its buffer's lock and fills it in before letting go, so every record
+// up to covered is already in a buffer this drain reaches, or was written by
+// an earlier one.
+bool WriteAheadLog::drainBuffers(uint64_t* covered)
+{
+    pthread_mutex_lock(&fileLock);
+    *covered = sequence.load();
+    bool written = true;
+    bool wroteAny = false;
+    for(ThreadBuffer* buffer = buffers.getFirst(); buffer != NULL; buffer = buffer->next)
+    {
+        pthread_mutex_lock(&buffer->lock);
+        char* records = buffer->data;
+        size_t length = buffer->length;
+        size_t capacity = buffer->capacity;
+        if(length > 0 && buffer->spare != NULL) //hand the owner the empty spare
+        {
+            buffer->data = buffer->spare;
+            buffer->capacity = buffer->spareCapacity;
+            buffer->length = 0;
+        }else if(length > 0){ //first drain: the owner gets a new array
+            char* fresh = (char*)malloc(LOG_BUFFER_SIZE);
+            if(fresh == NULL)
+            {
+                pthread_mutex_unlock(&buffer->lock);
+                written = false;
+                continue;
+            }
+            buffer->data = fresh;
+            buffer->capacity = LOG_BUFFER_SIZE;
+            buffer->length = 0;
+        }
+        pthread_mutex_unlock(&buffer->lock);
+
+        if(length == 0)
+            continue;
+        written = writeAll(fd, records, length) && written;
+        wroteAny = true;
+        //the written array becomes the next spare
+        pthread_mutex_lock(&buffer->lock);
+        buffer->spare = records;
+        buffer->spareCapacity = capacity;
+        pthread_mutex_unlock(&buffer->lock);
+    }
+    if(wroteAny)
+        written = (fdatasync(fd) == 0) && written;
+    pthread_mutex_unlock(&fileLock);
+    return written;
+}
+// writes length bytes to fd, retrying short writes
+bool WriteAheadLog::writeAll(int fd, const char* data, size_t length)
+{
+    while(length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if(written < 0)
+            return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+//returns the checksum of a record whose checksum field is zero or is zeroed
+//here (the record is restored before returning)
+uint32_t WriteAheadLog::getChecksum(char* record, size_t recordSize)
+{
+    uint32_t stored;
+    char* field = record + offsetof(RecordHeader, checksum);
+    memcpy(&stored, field, sizeof(uint32_t));
+    memset(field, 0, sizeof(uint32_t));
+    uint32_t checksum = (uint32_t)crc32cHash(record, recordSize);
+    memcpy(field, &stored, sizeof(uint32_t));
+    return checksum;
+}
+// returns a malloc'd copy of the file at path and its length in length, or
+// NULL if it can't be read or is shorter than a FileHeader
+char* WriteAheadLog::readFile(const char* path, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if(file == NULL)
+        return NULL;
+    char* data = NULL;
+    long size = -1;
+    if(fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= (long)sizeof(FileHeader) && fseek(file, 0, SEEK_SET) == 0)
+    {
+        data = (char*)malloc(size);
+        if(data != NULL && fread(data, 1, size, file) != (size_t)size)
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    *length = (size_t)size;
+    return data;
+}
+// finds the intact records of a log read by readFile(), storing a malloc'd
+// array of them (in file order) in entries, their number in count and the
+// offset just past the last one in end. Stops at the first torn or corrupt
+// record. Returns false if data isn't a log.
+bool WriteAheadLog::readRecords(char* data, size_t length, ReplayEntry** entries, size_t* count, size_t* end)
+{
+    FileHeader fileHeader;
+    memcpy(&fileHeader, data, sizeof(FileHeader));
+    if(fileHeader.magic != LOG_MAGIC || fileHeader.version != LOG_VERSION)
+        return false;
+
+    size_t capacity = 0;
+    size_t offset = sizeof(FileHeader);
+    *entries = NULL;
+    *count = 0;
+    while(length - offset >= sizeof(RecordHeader))
+    {
+        RecordHeader header;
+        memcpy(&header, data + offset, sizeof(RecordHeader));
+        size_t recordSize = sizeof(RecordHeader) + (size_t)header.keyLength + header.valueLength;
+        if(recordSize > length - offset || getChecksum(data + offset, recordSize) != header.checksum)
+            break;
+        if(*count == capacity)
+        {
+            capacity = (capacity > 0) ? capacity * 2 : 1024;
+            *entries = (ReplayEntry*)realloc(*entries, sizeof(ReplayEntry) * capacity);
+            assert(*entries != NULL);
+        }
+        (*entries)[*count].sequence = header.sequence;
+        (*entries)[*count].offset = offset;
+        (*count)++;
+        offset += recordSize;
+    }
+    *end = offset;
+    return true;
+}
+// sorts the entries found by readRecords() by sequence number and returns
+// how many of them replay applies: those up to the first missing sequence
+// number (or repeated one, which only a corrupt log has)
+size_t WriteAheadLog::sortRecords(ReplayEntry* entries, size_t count)
+{
+    qsort(entries, count, sizeof(ReplayEntry), compareEntries);
+    size_t kept = (count > 0) ? 1 : 0;
+    while(kept < count && entries[kept].sequence == entries[kept - 1].sequence + 1)
+        kept++;
+    return kept;
+}
+//orders ReplayEntries by sequence number for qsort()
+int WriteAheadLog::compareEntries(const void* a, const void* b)
+{
+    uint64_t first = ((const ReplayEntry*)a)->sequence;
+    uint64_t second = ((const ReplayEntry*)b)->sequence;
+    return (first > second) - (first < second);
+}
+// returns whether every record to replay has a known type and, for sets, a
+// value of map's element size, so that no value is read past its record
+template<class Map>
+bool WriteAheadLog::fitsMap(char* data, ReplayEntry* entries, size_t count, Map* map)
+{
+    for(size_t x = 0; x < count; x++)
+    {
+        RecordHeader header;
+        memcpy(&header, data + entries[x].offset, sizeof(RecordHeader));
+        if(header.type == LOG_SET ? header.valueLength != (uint32_t)map->getElementSize()
+           : (header.type != LOG_REMOVE && header.type != LOG_CLEAR) || header.valueLength != 0)
+            return false;
+    }
+    return true;
+}
+// drops the records that replay() skips from the log opened by initialize():
+// entries holds the count intact records sorted by sequence, of which the
+// first kept are replayed, and end is the offset just past the last intact
+// one. If the dropped records all follow the kept ones in the file, the file
+// is cut at the first of them; otherwise the kept records are written to a
+// new log that is renamed over path and reopened. Returns false on I/O
+// failure.
+bool WriteAheadLog::cutLog(const char* path, char* data, ReplayEntry* entries, size_t kept, size_t count, size_t end, size_t length)
+{
+    size_t cut = end;
+    for(size_t x = kept; x < count; x++)
+        if(entries[x].offset < cut)
+            cut = entries[x].offset;
+    bool keptAfterCut = false;
+    for(size_t x = 0; x < kept; x++)
+        keptAfterCut = keptAfterCut || entries[x].offset > cut;
+    if(!keptAfterCut)
+        return cut == length || ftruncate(fd, cut) == 0;
+
+    char* tempPath = new char[strlen(path) + strlen(LOG_TEMP_SUFFIX) + 1];
+    strcpy(tempPath, path);
+    strcat(tempPath, LOG_TEMP_SUFFIX);
+    int tempFd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = tempFd >= 0 && writeAll(tempFd, data, sizeof(FileHeader));
+    for(size_t x = 0; written && x < kept; x++)
+    {
+        RecordHeader header;
+        memcpy(&header, data + entries[x].offset, sizeof(RecordHeader));
+        written = writeAll(tempFd, data + entries[x].offset, sizeof(RecordHeader) + (size_t)header.keyLength + header.valueLength);
+    }
+    written = written && fdatasync(tempFd) == 0;
+    written = (tempFd < 0 || close(tempFd) == 0) && written;
+    written = written && rename(tempPath, path) == 0;
+    if(!written)
+        unlink(tempPath);
+    delete[] tempPath;
+
+    if(written) //the old descriptor still refers to the replaced file
+    {
+        close(fd);
+        fd = open(path, O_RDWR | O_APPEND);
+        written = fd >= 0;
+    }
+    return written;
+}
+
+#endif